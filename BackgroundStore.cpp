@@ -0,0 +1,83 @@
+#include "BackgroundStore.h"
+
+#include <stdio.h>
+
+BackgroundStore::BackgroundStore(int frame_width, int frame_height) :
+    _bgd(cv::Mat(frame_height, frame_width, CV_8UC1, cv::Scalar(0))),
+    _version(0) {
+    int rc = 0;
+    if( (rc = pthread_rwlock_init(&_lock, NULL)) != 0) {
+        perror("rwlock initialization failed in BackgroundStore constructor.");
+    }
+}
+
+BackgroundStore::~BackgroundStore() {
+    pthread_rwlock_destroy(&_lock);
+}
+
+bool BackgroundStore::set(const cv::Mat& bgd) {
+    return set(bgd, cv::Mat());
+}
+
+bool BackgroundStore::set(const cv::Mat& bgd, const cv::Mat& thresh) {
+    // Copy outside the lock; readers still holding the previous
+    // frame keep it alive until they drop it
+    cv::Mat published = bgd.clone();
+    cv::Mat published_thresh = thresh.clone();
+
+    if(pthread_rwlock_wrlock(&_lock) != 0) {
+        perror("could not obtain bgd write lock to set bgd");
+        return false;
+    } 
+
+    _bgd = published;
+    _thresh = published_thresh;
+    _version++;
+    std::cout << "New bgd set" << std::endl;
+
+    if(pthread_rwlock_unlock(&_lock) != 0) {
+        perror("could not release write lock to set bgd");
+        return false;
+    } 
+    return true;
+}
+
+bool BackgroundStore::get(cv::Mat* bgd, unsigned int* version) {
+    return get(bgd, NULL, version);
+}
+
+bool BackgroundStore::get(cv::Mat* bgd, cv::Mat* thresh,
+        unsigned int* version) {
+    int rc = 0;
+    if ( (rc = pthread_rwlock_rdlock(&_lock)) != 0) {
+        perror("unable to obtain read lock in getBgd");
+        return false;
+    }
+
+    *bgd = _bgd;
+    if (thresh != NULL) {
+        *thresh = _thresh;
+    }
+    if (version != NULL) {
+        *version = _version;
+    }
+
+    if ( (rc = pthread_rwlock_unlock(&_lock)) != 0) {
+        perror("unable to release read lock in getBgd");
+    }
+    return true;
+}
+
+unsigned int BackgroundStore::version() {
+    int rc = 0;
+    if ( (rc = pthread_rwlock_rdlock(&_lock)) != 0) {
+        perror("unable to obtain read lock in getBgdVersion");
+    }
+
+    unsigned int version = _version;
+
+    if ( (rc = pthread_rwlock_unlock(&_lock)) != 0) {
+        perror("unable to release read lock in getBgdVersion");
+    }
+    return version;
+}
@@ -0,0 +1,44 @@
+#ifndef BACKGROUND_STORE_H
+#define BACKGROUND_STORE_H
+
+#include <opencv2/opencv.hpp>
+#include <pthread.h>
+
+// The one background frame shared by all frame processors. Every set
+// publishes a new, never again written Mat and bumps the version, so
+// readers take a reference to the current frame instead of copying it
+// and only re-derive data from it (a downscaled copy, ...) when the
+// version they last saw changes.
+//
+// Backgrounds built from running statistics come with a per pixel
+// motion threshold plane; a bgd set on its own (a single captured
+// frame) has none and consumers fall back to a global threshold.
+class BackgroundStore {
+    public:
+        BackgroundStore(int frame_width, int frame_height);
+        ~BackgroundStore();
+
+        // Publishes a copy of bgd as the new background
+        bool set(const cv::Mat& bgd);
+        // Same, with the per pixel threshold that goes with it
+        bool set(const cv::Mat& bgd, const cv::Mat& thresh);
+        // Shares the current background into bgd, which must be treated
+        // as read only. version, if given, gets the version it belongs
+        // to.
+        bool get(cv::Mat* bgd, unsigned int* version);
+        // Also shares the threshold plane, left empty if this bgd has
+        // none
+        bool get(cv::Mat* bgd, cv::Mat* thresh, unsigned int* version);
+        // Incremented on every set, 0 before the first
+        unsigned int version();
+
+    private:
+        cv::Mat _bgd;
+        cv::Mat _thresh;
+        unsigned int _version;
+        // Guards the _bgd and _thresh headers and _version, not the
+        // pixel data, which is immutable once published
+        pthread_rwlock_t _lock;
+};
+
+#endif // BACKGROUND_STORE_H
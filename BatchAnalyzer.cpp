@@ -0,0 +1,358 @@
+#include "BatchAnalyzer.h"
+#include "BackgroundStore.h"
+#include "BgdCapturerRunning.h"
+#include "MotionLocBlobThresh.h"
+#include "SegmentReader.h"
+#include "StaticFrameDetector.h"
+#include "video_frame.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <map>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool eventStartsBefore(const BatchEvent_t& a, const BatchEvent_t& b) {
+    return a.first_frame < b.first_frame;
+}
+
+BatchAnalyzer::BatchAnalyzer() :
+    _total_frames(0),
+    _fps(0),
+    _frame_width(0),
+    _frame_height(0),
+    _threads(sysconf(_SC_NPROCESSORS_ONLN)),
+    _motion_scale(1),
+    _zones(NULL),
+    _warmup_frames(200),
+    _min_range_frames(2000),
+    _prefetch(16),
+    _join_frames(10),
+    _next_range(0) {
+    int rc = 0;
+    if( (rc = pthread_mutex_init(&_lock, NULL)) != 0) {
+        perror("mutex initialization failed in batch analyzer constructor.");
+    }
+}
+
+BatchAnalyzer::~BatchAnalyzer() {
+    pthread_mutex_destroy(&_lock);
+}
+
+bool BatchAnalyzer::addInput(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        perror(path.c_str());
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        _segments.push_back(path);
+        return true;
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL) {
+        perror(path.c_str());
+        return false;
+    }
+    std::vector<std::string> names;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); i++) {
+        _segments.push_back(path + "/" + names[i]);
+    }
+    return true;
+}
+
+// Counts the frames of every segment and splits them into ranges
+bool BatchAnalyzer::plan() {
+    _segment_frames.clear();
+    _total_frames = 0;
+    for (size_t i = 0; i < _segments.size(); i++) {
+        cv::VideoCapture cap(_segments[i]);
+        if (!cap.isOpened()) {
+            std::cout << "unable to open " << _segments[i] << std::endl;
+            return false;
+        }
+        if (i == 0) {
+            _frame_width = (int) cap.get(CV_CAP_PROP_FRAME_WIDTH);
+            _frame_height = (int) cap.get(CV_CAP_PROP_FRAME_HEIGHT);
+            _fps = cap.get(CV_CAP_PROP_FPS);
+        }
+        long frames = (long) cap.get(CV_CAP_PROP_FRAME_COUNT);
+        if (frames <= 0) {
+            // Container without a frame count, count without decoding
+            frames = 0;
+            while (cap.grab()) {
+                frames++;
+            }
+        }
+        _segment_frames.push_back(frames);
+        _total_frames += frames;
+    }
+    if (_total_frames == 0 || _frame_width <= 0 || _frame_height <= 0) {
+        std::cout << "no frames to analyze" << std::endl;
+        return false;
+    }
+    if (_fps <= 0) {
+        _fps = 30;
+    }
+
+    // A few ranges per worker, so the last ones to finish are short
+    long num_ranges = std::max(1L, std::min((long) _threads * 4,
+                _total_frames / _min_range_frames));
+    long range_frames = (_total_frames + num_ranges - 1) / num_ranges;
+    _ranges.clear();
+    for (long begin = 0; begin < _total_frames; begin += range_frames) {
+        Range_t range;
+        range.begin = begin;
+        range.end = std::min(begin + range_frames, _total_frames);
+        range.ok = false;
+        _ranges.push_back(range);
+    }
+    return true;
+}
+
+bool BatchAnalyzer::run(std::ostream& log) {
+    if (_segments.empty()) {
+        std::cout << "no input to analyze" << std::endl;
+        return false;
+    }
+    if (!plan()) {
+        return false;
+    }
+    int threads = std::max(1, std::min(_threads, (int) _ranges.size()));
+    std::cout << "analyzing " << _total_frames << " frames (" <<
+        _frame_width << "x" << _frame_height << ") in " << _ranges.size() <<
+        " ranges on " << threads << " threads" << std::endl;
+
+    double start = (double) cv::getTickCount();
+    _next_range = 0;
+    std::vector<pthread_t> workers(threads);
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, &workerThread, this)) {
+            perror("Could not create batch worker thread.");
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    double seconds = ((double) cv::getTickCount() - start) /
+        cv::getTickFrequency();
+
+    bool ok = (started > 0);
+    for (size_t r = 0; r < _ranges.size(); r++) {
+        if (!_ranges[r].ok) {
+            std::cout << "range " << _ranges[r].begin << "-" <<
+                _ranges[r].end << " failed" << std::endl;
+            ok = false;
+        }
+    }
+    std::vector<BatchEvent_t> events;
+    joinEvents(&events);
+    log << "# first_frame last_frame start_s end_s max_area x y w h" <<
+        std::endl;
+    for (size_t i = 0; i < events.size(); i++) {
+        char line[256];
+        snprintf(line, sizeof(line),
+                "%ld %ld %.3f %.3f %u %d %d %d %d",
+                events[i].first_frame, events[i].last_frame,
+                events[i].first_frame / _fps,
+                events[i].last_frame / _fps,
+                events[i].max_area,
+                events[i].bbox.x, events[i].bbox.y,
+                events[i].bbox.width, events[i].bbox.height);
+        log << line << std::endl;
+    }
+
+    std::cout << "analyzed " << _total_frames << " frames in " << seconds <<
+        " s, " << _total_frames / std::max(seconds, 1e-3) << " frames/s, " <<
+        (_total_frames / _fps) / std::max(seconds, 1e-3) <<
+        "x real time" << std::endl;
+    return ok;
+}
+
+// An event starting just after a range begins continues an event cut
+// at the end of the range before when their bboxes overlap there.
+// Ranges are in time order and so are the events within each, and a
+// joined event keeps its earlier start, so the result stays in order.
+void BatchAnalyzer::joinEvents(std::vector<BatchEvent_t>* events) const {
+    events->clear();
+    // Events of the previous range cut at its end, not yet continued
+    std::vector<size_t> cut;
+    for (size_t r = 0; r < _ranges.size(); r++) {
+        // Nothing is carried over a failed range
+        if (!_ranges[r].ok) {
+            cut.clear();
+        }
+        std::vector<size_t> next_cut;
+        const std::vector<BatchEvent_t>& range_events = _ranges[r].events;
+        for (size_t i = 0; i < range_events.size(); i++) {
+            const BatchEvent_t& event = range_events[i];
+            size_t joined = events->size();
+            if (event.first_frame - _ranges[r].begin <= _join_frames) {
+                for (size_t c = 0; c < cut.size(); c++) {
+                    BatchEvent_t& prev = (*events)[cut[c]];
+                    if ((prev.last_bbox & event.first_bbox).area() > 0) {
+                        joined = cut[c];
+                        cut.erase(cut.begin() + c);
+                        break;
+                    }
+                }
+            }
+            if (joined == events->size()) {
+                events->push_back(event);
+            } else {
+                BatchEvent_t& prev = (*events)[joined];
+                prev.last_frame = event.last_frame;
+                prev.last_bbox = event.last_bbox;
+                prev.cut = event.cut;
+                if (event.max_area > prev.max_area) {
+                    prev.max_area = event.max_area;
+                    prev.bbox = event.bbox;
+                }
+            }
+            if (event.cut) {
+                next_cut.push_back(joined);
+            }
+        }
+        cut = next_cut;
+    }
+}
+
+void* BatchAnalyzer::workerThread(void* arg) {
+    ((BatchAnalyzer*) arg)->work();
+    return NULL;
+}
+
+void BatchAnalyzer::work() {
+    for (;;) {
+        pthread_mutex_lock(&_lock);
+        size_t r = _next_range++;
+        pthread_mutex_unlock(&_lock);
+        if (r >= _ranges.size()) {
+            return;
+        }
+        _ranges[r].ok = analyzeRange(&_ranges[r]);
+    }
+}
+
+// Runs the live processors on one range, calling processFrame directly
+// on a single slot buffer, so no locking is needed
+bool BatchAnalyzer::analyzeRange(Range_t* range) {
+    std::vector<VideoFrame_t> frame_buffer(1);
+    frame_buffer[0].exit_thread = false;
+    frame_buffer[0].rw_lock = NULL;
+
+    BackgroundStore bgd_store(_frame_width, _frame_height);
+    BgdCapturerRunning bgd_capturer(&frame_buffer, 1,
+            _frame_width, _frame_height);
+    bgd_capturer.setBackgroundStore(&bgd_store);
+    MotionLocBlobThresh motion(&frame_buffer, 1,
+            _frame_width, _frame_height);
+    motion.setBackgroundStore(&bgd_store);
+    if (!motion.setScale(_motion_scale)) {
+        return false;
+    }
+    if (_zones != NULL) {
+        motion.setZones(_zones);
+    }
+
+    long warmup_begin = std::max(0L, range->begin - _warmup_frames);
+    SegmentReader reader(_segments, _segment_frames,
+            _frame_width, _frame_height, _prefetch);
+    if (!reader.start(warmup_begin, range->end)) {
+        return false;
+    }
+
+    // Frames are compared with the last one flagged as changed, as in
+    // the live capture loop
+    StaticFrameDetector static_detector;
+    cv::Mat change_ref;
+    unsigned long last_change_seq = 0;
+    // Confirmed tracks by id, moved to the range's events when they end
+    std::map<int, BatchEvent_t> open_events;
+    std::vector<BlobTrack_t> tracks;
+
+    cv::Mat frame;
+    long index = 0;
+    while (reader.read(&frame, &index)) {
+        VideoFrame_t& slot = frame_buffer[0];
+        slot.frame = frame;
+        slot.seq = index + 1;
+        if (change_ref.empty() ||
+                !static_detector.isStatic(frame, change_ref)) {
+            last_change_seq = slot.seq;
+            change_ref = frame;
+        }
+        slot.last_change_seq = last_change_seq;
+
+        bgd_capturer.processFrame();
+        // Warm-up, or the very start of the recording before the
+        // model has published a bgd
+        if (index < range->begin || bgd_store.version() == 0) {
+            continue;
+        }
+
+        motion.processFrame();
+        motion.getTracks(&tracks);
+        std::map<int, bool> alive;
+        for (size_t t = 0; t < tracks.size(); t++) {
+            if (!motion.isConfirmed(tracks[t])) {
+                continue;
+            }
+            // A coasting track keeps its event open but doesn't
+            // extend it
+            alive[tracks[t].id] = true;
+            std::map<int, BatchEvent_t>::iterator it =
+                open_events.find(tracks[t].id);
+            if (it == open_events.end()) {
+                BatchEvent_t event;
+                event.first_frame = index;
+                event.last_frame = index;
+                event.max_area = 0;
+                event.first_bbox = tracks[t].bbox;
+                event.last_bbox = tracks[t].bbox;
+                event.cut = false;
+                it = open_events.insert(
+                        std::make_pair(tracks[t].id, event)).first;
+            }
+            if (tracks[t].misses > 0) {
+                continue;
+            }
+            it->second.last_frame = index;
+            it->second.last_bbox = tracks[t].bbox;
+            if (tracks[t].area > it->second.max_area) {
+                it->second.max_area = tracks[t].area;
+                it->second.bbox = tracks[t].bbox;
+            }
+        }
+        for (std::map<int, BatchEvent_t>::iterator it = open_events.begin();
+                it != open_events.end(); ) {
+            if (alive.find(it->first) == alive.end()) {
+                range->events.push_back(it->second);
+                open_events.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (std::map<int, BatchEvent_t>::iterator it = open_events.begin();
+            it != open_events.end(); ++it) {
+        it->second.cut = true;
+        range->events.push_back(it->second);
+    }
+    std::sort(range->events.begin(), range->events.end(),
+            eventStartsBefore);
+    return true;
+}
@@ -0,0 +1,103 @@
+#ifndef BATCH_ANALYZER_H
+#define BATCH_ANALYZER_H
+
+#include <opencv2/opencv.hpp>
+#include <ostream>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "ZoneMap.h"
+
+// Motion event found in a recording: a confirmed track from the frame
+// it was first seen on to the frame it was last seen on
+typedef struct BatchEvent {
+    long first_frame;
+    long last_frame;
+    // Largest blob area over the track's life, and its bbox then
+    unsigned int max_area;
+    cv::Rect bbox;
+    // Bboxes on the first and last frame, and whether the track was
+    // still open at the end of its range; used to join events cut at
+    // range boundaries
+    cv::Rect first_bbox;
+    cv::Rect last_bbox;
+    bool cut;
+} BatchEvent_t;
+
+// Offline analysis of recorded footage as fast as the machine allows.
+// The recording (one file, or a directory of segment files in name
+// order) is split into time ranges that worker threads analyze
+// independently, each with its own background model, motion locator
+// and prefetching decoder. Every range starts with warm-up frames taken
+// from before it, which only feed the background model, so detection
+// in the range starts against a settled background. Events still open
+// at the end of a range are cut there and picked up again by the next;
+// the two parts are joined again before the log is written.
+class BatchAnalyzer {
+    public:
+        BatchAnalyzer();
+        ~BatchAnalyzer();
+
+        // A video file, or a directory whose files are taken as
+        // consecutive segments
+        bool addInput(const std::string& path);
+        // Worker threads, all cores by default
+        void setThreads(int threads) {
+            _threads = threads;
+        };
+        void setMotionScale(int scale) {
+            _motion_scale = scale;
+        };
+        // Zones motion is looked for in, the whole frame if NULL
+        void setZones(const ZoneMap* zones) {
+            _zones = zones;
+        };
+        // Analyzes the inputs and writes the event log to log
+        bool run(std::ostream& log);
+
+    private:
+        typedef struct Range {
+            long begin;
+            long end;
+            std::vector<BatchEvent_t> events;
+            bool ok;
+        } Range_t;
+
+        bool plan();
+        static void* workerThread(void* arg);
+        void work();
+        bool analyzeRange(Range_t* range);
+        // Events of all ranges in time order, with those cut at range
+        // boundaries joined
+        void joinEvents(std::vector<BatchEvent_t>* events) const;
+
+        std::vector<std::string> _segments;
+        std::vector<long> _segment_frames;
+        long _total_frames;
+        double _fps;
+        int _frame_width;
+        int _frame_height;
+
+        int _threads;
+        int _motion_scale;
+        const ZoneMap* _zones;
+        // Frames before each range fed only to the background model
+        long _warmup_frames;
+        // Ranges are at least this long, so warm-up stays a small part
+        // of the work
+        long _min_range_frames;
+        // Frames each range's decoder may run ahead
+        size_t _prefetch;
+        // Frames into a range an event may start and still continue
+        // one cut at the end of the range before, which covers the
+        // frames a new track takes to be confirmed
+        long _join_frames;
+
+        std::vector<Range_t> _ranges;
+        // Next range a worker picks up, guarded by _lock
+        size_t _next_range;
+        pthread_mutex_t _lock;
+};
+
+#endif // BATCH_ANALYZER_H
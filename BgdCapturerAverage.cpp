@@ -1,13 +1,16 @@
 #include "BgdCapturerAverage.h"
 #include "video_frame.h"
+#include "PixelKernels.h"
 
 // When process frame is called, this thread holdes rd locks on
 // _cur_frame_i and _cur_frame_i + 1
 bool BgdCapturerAverage::processFrame() {
-    _ctr = (_ctr + 1) % _step;
-    // Occurs every _step frames
-    if (_ctr == 0) {
-        addFrameToBgd();
+    // Under load the model samples half as many frames
+    int step = (shedLevel() >= LoadShedder::SHED_BGD_HALF) ?
+        2 * _step : _step;
+    _ctr = (_ctr + 1) % step;
+    // Occurs every step frames
+    if (_ctr == 0 && addFrameToBgd()) {
         updateBgd();
     }
     return true;
@@ -19,25 +22,50 @@ bool BgdCapturerAverage::updateBgd() {
     // buffer for bgd frames first time through which would mess 
     // with averages.
     if (_bgd_frame_i == (_frames_per_bgd - 1)) {
-        cv::Mat bgd_float_sum = cv::Mat(_frame_height, 
-                _frame_width, CV_32FC1, cv::Scalar(0));
-        
-        int start_iter = _frames_for_bgd.size() - 1;
-        for (int i = start_iter; i >= 0; i--) {
-            cv::Mat bgd_float_single = cv::Mat(_frame_height,
-                    _frame_width, CV_32FC1, cv::Scalar(0));
-
-            _frames_for_bgd[i].convertTo(bgd_float_single, CV_32FC1);
-
-            cv::add(bgd_float_sum, bgd_float_single, bgd_float_sum);
+        // Integer sum of the frames, row by row with the vectorized
+        // kernels; 16 bits hold up to 257 frames
+        _bgd_sum.setTo(cv::Scalar(0));
+        for (int i = _frames_for_bgd.size() - 1; i >= 0; i--) {
+            for (int y = 0; y < _frame_height; y++) {
+                accumulateRow(_frames_for_bgd[i].ptr<unsigned char>(y),
+                        _bgd_sum.ptr<uint16_t>(y), _frame_width);
+            }
         }
 
-        cv::Mat bgd_8uc1(_frame_height, _frame_width, CV_8UC1, 
-                cv::Scalar(0));
-        bgd_float_sum.convertTo(bgd_8uc1, CV_8UC1, 
-                1.0 / (1.0 * _frames_per_bgd));
+        cv::Mat bgd_8uc1(_frame_height, _frame_width, CV_8UC1);
+        for (int y = 0; y < _frame_height; y++) {
+            averageRow(_bgd_sum.ptr<uint16_t>(y), _frames_per_bgd,
+                    bgd_8uc1.ptr<unsigned char>(y), _frame_width);
+        }
 
         setBgd(bgd_8uc1);
+        if (_compositor != NULL) {
+            _compositor->writePanel(DisplayCompositor::PANEL_BGD, bgd_8uc1);
+        }
+        if (_checkpoint != NULL) {
+            _checkpoint->save(BGD_MODEL_AVERAGE,
+                    std::vector<cv::Mat>(1, bgd_8uc1), 0);
+        }
+    }
+    return true;
+}
+
+bool BgdCapturerAverage::restoreCheckpoint() {
+    std::vector<cv::Mat> planes;
+    unsigned long updates = 0;
+    if (_checkpoint == NULL ||
+            !_checkpoint->load(BGD_MODEL_AVERAGE, &planes, &updates) ||
+            planes.size() != 1 || planes[0].type() != CV_8UC1) {
+        return false;
+    }
+    // The next average blends new frames into the restored bgd
+    // rather than starting from black
+    for (int i = 0; i < _frames_per_bgd; i++) {
+        planes[0].copyTo(_frames_for_bgd[i]);
+    }
+    setBgd(planes[0]);
+    if (_compositor != NULL) {
+        _compositor->writePanel(DisplayCompositor::PANEL_BGD, planes[0]);
     }
     return true;
 }
@@ -47,6 +75,11 @@ bool BgdCapturerAverage::addFrameToBgd() {
    
     // Copy frame to buffer of bgd frames 
     (this_frame.frame).copyTo(_frames_for_bgd[_bgd_frame_i]);
+    // Off a bus the copy is kept only if capture did not overwrite the
+    // frame while it was taken
+    if (!frameIntact()) {
+        return false;
+    }
     // Increment index of where to write into bgd buffer
     _bgd_frame_i = (_bgd_frame_i + 1) % _frames_per_bgd;
     return true;
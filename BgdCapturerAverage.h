@@ -5,6 +5,7 @@
 #include <vector>
 
 #include "FrameProcessor.h"
+#include "BgdCheckpoint.h"
 #include "video_frame.h"
 
 class BgdCapturerAverage : public FrameProcessor {
@@ -15,7 +16,8 @@ class BgdCapturerAverage : public FrameProcessor {
             FrameProcessor(frame_buffer, buffer_length, 
                     frame_width, frame_height),
             _ctr(0), _step(5), _frames_per_bgd(frames_per_bgd),
-   _bgd_frame_i(0) {
+   _bgd_frame_i(0),
+            _checkpoint(NULL) {
                 _frames_for_bgd
                     = std::vector<cv::Mat>(_frames_per_bgd);
                 for(int i = 0; i < _frames_per_bgd; i++) {            
@@ -25,9 +27,25 @@ class BgdCapturerAverage : public FrameProcessor {
                             CV_8UC1,
                             cv::Scalar(0));
                 }
+                if (_frames_per_bgd > MAX_FRAMES_PER_BGD) {
+                    std::cout << "averaging more than " <<
+                        MAX_FRAMES_PER_BGD << " frames overflows the bgd sum" <<
+                        std::endl;
+                }
+                _bgd_sum = cv::Mat(frame_height, frame_width, CV_16UC1);
             };
         virtual bool processFrame();
+        // Every published bgd is saved to checkpoint
+        void setCheckpoint(BgdCheckpoint* checkpoint) {
+            _checkpoint = checkpoint;
+        };
+        // Publishes the checkpointed bgd and fills the frames averaged
+        // with it. Call after the background store is set.
+        bool restoreCheckpoint();
     private:
+        // Most frames whose sum fits the 16 bit accumulator
+        static const int MAX_FRAMES_PER_BGD = 257;
+
         bool addFrameToBgd();
         bool updateBgd();
 
@@ -38,6 +56,9 @@ class BgdCapturerAverage : public FrameProcessor {
         // Index of current frame in _frames_for_bgd to be
         // written into
         int _bgd_frame_i;
+        // Scratch for the sum of _frames_for_bgd
+        cv::Mat _bgd_sum;
+        BgdCheckpoint* _checkpoint;
 };
 
 #endif
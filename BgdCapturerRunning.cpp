@@ -0,0 +1,90 @@
+#include "BgdCapturerRunning.h"
+#include "PixelKernels.h"
+
+// When process frame is called, this thread holds rd locks on
+// _cur_frame_i and _cur_frame_i + 1
+bool BgdCapturerRunning::processFrame() {
+    // Under load the model samples half as many frames
+    int step = (shedLevel() >= LoadShedder::SHED_BGD_HALF) ?
+        2 * _step : _step;
+    _ctr = (_ctr + 1) % step;
+    // Occurs every step frames
+    if (_ctr == 0 && updateStats()) {
+        if (_updates >= _warmup_updates &&
+                _updates % _publish_interval == 0) {
+            publish();
+            _publishes++;
+            if (_checkpoint != NULL &&
+                    _publishes % _checkpoint_interval == 0) {
+                std::vector<cv::Mat> planes;
+                planes.push_back(_mean);
+                planes.push_back(_var);
+                _checkpoint->save(BGD_MODEL_RUNNING, planes, _updates);
+            }
+        }
+    }
+    return true;
+}
+
+bool BgdCapturerRunning::restoreCheckpoint() {
+    std::vector<cv::Mat> planes;
+    unsigned long updates = 0;
+    if (_checkpoint == NULL ||
+            !_checkpoint->load(BGD_MODEL_RUNNING, &planes, &updates) ||
+            planes.size() != 2 ||
+            planes[0].type() != CV_16UC1 || planes[1].type() != CV_16UC1) {
+        return false;
+    }
+    planes[0].copyTo(_mean);
+    planes[1].copyTo(_var);
+    _updates = std::max((long) updates, (long) _warmup_updates);
+    publish();
+    return true;
+}
+
+bool BgdCapturerRunning::updateStats() {
+    cv::Mat frame = (*_frame_buffer)[_cur_frame_i].frame;
+    // The stats are updated in place, so off a bus they take in a copy
+    // of the frame that capture did not overwrite while it was taken
+    if (_frame_bus != NULL) {
+        frame.copyTo(_bus_frame);
+        if (!frameIntact()) {
+            return false;
+        }
+        frame = _bus_frame;
+    }
+
+    if (_updates == 0) {
+        // Start from the first frame with the noise of the minimum
+        // threshold
+        uint16_t var0 = (uint16_t) std::min(65535.0f,
+                16.0f * _min_thresh * _min_thresh / (_k * _k));
+        frame.convertTo(_mean, CV_16UC1, 256);
+        _var.setTo(cv::Scalar(var0));
+    } else {
+        for (int y = 0; y < _frame_height; y++) {
+            updateMeanVarRow(frame.ptr<unsigned char>(y),
+                    _mean.ptr<uint16_t>(y), _var.ptr<uint16_t>(y),
+                    _shift, _frame_width);
+        }
+    }
+    _updates++;
+    return true;
+}
+
+bool BgdCapturerRunning::publish() {
+    cv::Mat bgd(_frame_height, _frame_width, CV_8UC1);
+    cv::Mat thresh(_frame_height, _frame_width, CV_8UC1);
+    for (int y = 0; y < _frame_height; y++) {
+        meanVarToThresholdRow(_mean.ptr<uint16_t>(y), _var.ptr<uint16_t>(y),
+                _k, _min_thresh,
+                bgd.ptr<unsigned char>(y), thresh.ptr<unsigned char>(y),
+                _frame_width);
+    }
+
+    setBgd(bgd, thresh);
+    if (_compositor != NULL) {
+        _compositor->writePanel(DisplayCompositor::PANEL_BGD, bgd);
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef BGD_CAPTURER_RUNNING_H
+#define BGD_CAPTURER_RUNNING_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "FrameProcessor.h"
+#include "BgdCheckpoint.h"
+#include "video_frame.h"
+
+// Background from a per pixel running mean and variance, updated in
+// fixed point on every _step-th frame. Along with the bgd it publishes
+// a per pixel threshold of k * sigma, so motion detection ignores
+// pixels that are noisy anyway (sensor noise, flicker, leaves) and
+// stays sensitive where the scene is steady.
+class BgdCapturerRunning : public FrameProcessor {
+    public:
+        BgdCapturerRunning(std::vector<VideoFrame_t>* frame_buffer,
+                int buffer_length, int frame_width, int frame_height) :
+            FrameProcessor(frame_buffer, buffer_length,
+                    frame_width, frame_height),
+            _ctr(0),
+            _step(5),
+            _shift(5),
+            _k(3.0f),
+            _min_thresh(3),
+            _warmup_updates(32),
+            _publish_interval(8),
+            _updates(0),
+            _mean(cv::Mat(frame_height, frame_width, CV_16UC1)),
+            _var(cv::Mat(frame_height, frame_width, CV_16UC1)),
+            _checkpoint(NULL),
+            _checkpoint_interval(8),
+            _publishes(0) {};
+
+        virtual bool processFrame();
+        // Multiple of sigma a pixel must differ from the mean by to
+        // count as motion
+        void setSigmaScale(float k) {
+            _k = k;
+        };
+        // The mean and variance are saved to checkpoint every
+        // _checkpoint_interval publishes
+        void setCheckpoint(BgdCheckpoint* checkpoint) {
+            _checkpoint = checkpoint;
+        };
+        // Resumes from the checkpointed mean and variance and
+        // publishes them right away, skipping the warm-up. Call after
+        // the background store is set.
+        bool restoreCheckpoint();
+
+    private:
+        bool updateStats();
+        bool publish();
+
+        int _ctr;
+        int _step;
+        // Stats move 2^-_shift of the way to each sampled frame
+        int _shift;
+        float _k;
+        // Lower bound on the threshold, for pixels with no noise
+        int _min_thresh;
+        // Updates before the first publish, so the stats have settled
+        int _warmup_updates;
+        // Updates between publishes
+        int _publish_interval;
+        long _updates;
+
+        // Q8.8 mean and Q12.4 variance, see updateMeanVarRow
+        cv::Mat _mean;
+        cv::Mat _var;
+        // Copy of a frame read off a bus, checked intact before the
+        // stats take it in
+        cv::Mat _bus_frame;
+
+        BgdCheckpoint* _checkpoint;
+        int _checkpoint_interval;
+        long _publishes;
+};
+
+#endif // BGD_CAPTURER_RUNNING_H
@@ -0,0 +1,197 @@
+#include "BgdCheckpoint.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const static char CHECKPOINT_MAGIC[8] = {'B', 'G', 'D', 'C', 'K', 'P', 'T', 0};
+const static uint32_t CHECKPOINT_FORMAT_VERSION = 1;
+
+BgdCheckpoint::BgdCheckpoint(const std::string& path, int frame_width,
+        int frame_height) :
+    _path(path),
+    _frame_width(frame_width),
+    _frame_height(frame_height),
+    _started(false),
+    _stop(false),
+    _pending(false),
+    _pending_model(0),
+    _pending_updates(0) {
+    int rc = 0;
+    if( (rc = pthread_mutex_init(&_lock, NULL)) != 0) {
+        perror("mutex initialization failed in bgd checkpoint constructor.");
+    }
+    if( (rc = pthread_cond_init(&_cond, NULL)) != 0) {
+        perror("cond initialization failed in bgd checkpoint constructor.");
+    }
+}
+
+BgdCheckpoint::~BgdCheckpoint() {
+    stop();
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_lock);
+}
+
+bool BgdCheckpoint::start() {
+    if (pthread_create(&_thread, NULL, &writerThread, this)) {
+        perror("Could not create bgd checkpoint thread.");
+        return false;
+    }
+    _started = true;
+    return true;
+}
+
+void BgdCheckpoint::stop() {
+    if (!_started) {
+        return;
+    }
+    pthread_mutex_lock(&_lock);
+    _stop = true;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_lock);
+    pthread_join(_thread, NULL);
+    _started = false;
+}
+
+bool BgdCheckpoint::load(int model, std::vector<cv::Mat>* planes,
+        unsigned long* updates) {
+    int fd = open(_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+            (size_t) st.st_size < sizeof(BgdCheckpointHeader_t)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("unable to map bgd checkpoint");
+        return false;
+    }
+
+    const BgdCheckpointHeader_t* header = (const BgdCheckpointHeader_t*) map;
+    bool ok = memcmp(header->magic, CHECKPOINT_MAGIC, 8) == 0 &&
+        header->format_version == CHECKPOINT_FORMAT_VERSION &&
+        header->model == (uint32_t) model &&
+        header->width == (uint32_t) _frame_width &&
+        header->height == (uint32_t) _frame_height &&
+        header->num_planes <= (uint32_t) BGD_CHECKPOINT_MAX_PLANES;
+
+    // Planes are views into the mapping, copied out before it goes
+    size_t offset = sizeof(BgdCheckpointHeader_t);
+    planes->clear();
+    for (uint32_t i = 0; ok && i < header->num_planes; i++) {
+        cv::Mat view(_frame_height, _frame_width, header->plane_types[i],
+                (unsigned char*) map + offset);
+        size_t plane_size = view.total() * view.elemSize();
+        if (offset + plane_size > size) {
+            ok = false;
+            break;
+        }
+        planes->push_back(view.clone());
+        offset += plane_size;
+    }
+    if (ok) {
+        *updates = header->updates;
+    } else {
+        std::cout << "ignoring bgd checkpoint " << _path <<
+            " from another model or frame size" << std::endl;
+    }
+    munmap(map, size);
+    return ok;
+}
+
+void BgdCheckpoint::save(int model, const std::vector<cv::Mat>& planes,
+        unsigned long updates) {
+    if (planes.size() > (size_t) BGD_CHECKPOINT_MAX_PLANES) {
+        std::cout << "too many planes for a bgd checkpoint" << std::endl;
+        return;
+    }
+    // Copy outside the lock, the writer may be holding it only briefly
+    // but the model's thread must never wait on the disk
+    std::vector<cv::Mat> copies(planes.size());
+    for (size_t i = 0; i < planes.size(); i++) {
+        copies[i] = planes[i].clone();
+    }
+
+    pthread_mutex_lock(&_lock);
+    _pending = true;
+    _pending_model = model;
+    _pending_planes.swap(copies);
+    _pending_updates = updates;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_lock);
+}
+
+void* BgdCheckpoint::writerThread(void* arg) {
+    ((BgdCheckpoint*) arg)->writeLoop();
+    return NULL;
+}
+
+void BgdCheckpoint::writeLoop() {
+    for (;;) {
+        pthread_mutex_lock(&_lock);
+        while (!_pending && !_stop) {
+            pthread_cond_wait(&_cond, &_lock);
+        }
+        if (!_pending) {
+            pthread_mutex_unlock(&_lock);
+            return;
+        }
+        int model = _pending_model;
+        std::vector<cv::Mat> planes;
+        planes.swap(_pending_planes);
+        unsigned long updates = _pending_updates;
+        _pending = false;
+        pthread_mutex_unlock(&_lock);
+
+        write(model, planes, updates);
+    }
+}
+
+bool BgdCheckpoint::write(int model, const std::vector<cv::Mat>& planes,
+        unsigned long updates) {
+    BgdCheckpointHeader_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+    header.format_version = CHECKPOINT_FORMAT_VERSION;
+    header.model = model;
+    header.width = _frame_width;
+    header.height = _frame_height;
+    header.num_planes = planes.size();
+    for (size_t i = 0; i < planes.size(); i++) {
+        header.plane_types[i] = planes[i].type();
+    }
+    header.updates = updates;
+
+    std::string tmp_path = _path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("unable to create bgd checkpoint");
+        return false;
+    }
+    bool ok = ::write(fd, &header, sizeof(header)) == sizeof(header);
+    for (size_t i = 0; ok && i < planes.size(); i++) {
+        size_t row_size = planes[i].cols * planes[i].elemSize();
+        for (int y = 0; ok && y < planes[i].rows; y++) {
+            ok = ::write(fd, planes[i].ptr(y), row_size) ==
+                (ssize_t) row_size;
+        }
+    }
+    // On disk before the rename makes it the checkpoint
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp_path.c_str(), _path.c_str()) != 0) {
+        perror("unable to write bgd checkpoint");
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef BGD_CHECKPOINT_H
+#define BGD_CHECKPOINT_H
+
+#include <opencv2/opencv.hpp>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Background model a checkpoint was written by
+enum BgdModel {
+    BGD_MODEL_AVERAGE = 1,
+    BGD_MODEL_RUNNING
+};
+
+const static int BGD_CHECKPOINT_MAX_PLANES = 4;
+
+// File layout: this header, then each plane's rows packed one after
+// the other
+typedef struct BgdCheckpointHeader {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t model;
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_planes;
+    // cv::Mat type of each plane
+    uint32_t plane_types[BGD_CHECKPOINT_MAX_PLANES];
+    uint64_t updates;
+} BgdCheckpointHeader_t;
+
+// Background model state of one camera kept in a file, so a restart
+// picks up the model where it left off instead of relearning the
+// background. Saves only copy the planes; a writer thread of its own
+// writes them to a temporary file and renames it over the checkpoint,
+// so a crash never leaves a torn one behind.
+class BgdCheckpoint {
+    public:
+        BgdCheckpoint(const std::string& path, int frame_width,
+                int frame_height);
+        ~BgdCheckpoint();
+
+        bool start();
+        // Writes whatever save is still pending and stops the writer
+        void stop();
+
+        // Maps the checkpoint and copies its planes into planes. False
+        // if there is none, or it is from another model or frame size.
+        bool load(int model, std::vector<cv::Mat>* planes,
+                unsigned long* updates);
+        // Queues a copy of the model state for the writer; a save still
+        // pending is replaced
+        void save(int model, const std::vector<cv::Mat>& planes,
+                unsigned long updates);
+
+    private:
+        static void* writerThread(void* arg);
+        void writeLoop();
+        bool write(int model, const std::vector<cv::Mat>& planes,
+                unsigned long updates);
+
+        std::string _path;
+        int _frame_width;
+        int _frame_height;
+
+        bool _started;
+        bool _stop;
+        // Latest state handed to save, not yet written
+        bool _pending;
+        int _pending_model;
+        std::vector<cv::Mat> _pending_planes;
+        unsigned long _pending_updates;
+
+        pthread_t _thread;
+        pthread_mutex_t _lock;
+        pthread_cond_t _cond;
+};
+
+#endif // BGD_CHECKPOINT_H
@@ -0,0 +1,122 @@
+#include "BlobStats.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Running sums of one blob
+typedef struct BlobAccumulator {
+    unsigned int count;
+    uint64_t sum_luma;
+    uint64_t sum_luma2;
+    uint64_t sum_diff;
+    uint64_t sum_bgr[3];
+    unsigned int hist[BLOB_HIST_BINS];
+} BlobAccumulator_t;
+
+void computeBlobStats(const cv::Mat& labels, const cvb::CvBlobs& blobs,
+        const cv::Mat& frame, const cv::Mat& color, const cv::Mat& diff,
+        std::map<cvb::CvLabel, BlobStats_t>* stats) {
+    stats->clear();
+    if (blobs.empty()) {
+        return;
+    }
+
+    // Accumulator index of each label, and the box the pass covers
+    cvb::CvLabel max_label = 0;
+    int minx = labels.cols;
+    int miny = labels.rows;
+    int maxx = -1;
+    int maxy = -1;
+    for (cvb::CvBlobs::const_iterator it = blobs.begin();
+            it != blobs.end(); ++it) {
+        const cvb::CvBlob* blob = it->second;
+        max_label = std::max(max_label, it->first);
+        minx = std::min(minx, (int) blob->minx);
+        miny = std::min(miny, (int) blob->miny);
+        maxx = std::max(maxx, (int) blob->maxx);
+        maxy = std::max(maxy, (int) blob->maxy);
+    }
+    minx = std::max(minx, 0);
+    miny = std::max(miny, 0);
+    maxx = std::min(maxx, labels.cols - 1);
+    maxy = std::min(maxy, labels.rows - 1);
+
+    std::vector<int> index(max_label + 1, -1);
+    std::vector<BlobAccumulator_t> acc(blobs.size());
+    memset(&acc[0], 0, acc.size() * sizeof(BlobAccumulator_t));
+    int n = 0;
+    for (cvb::CvBlobs::const_iterator it = blobs.begin();
+            it != blobs.end(); ++it) {
+        index[it->first] = n++;
+    }
+
+    bool has_color = !color.empty();
+    for (int y = miny; y <= maxy; y++) {
+        const cvb::CvLabel* l = labels.ptr<cvb::CvLabel>(y);
+        const uchar* f = frame.ptr<uchar>(y);
+        const uchar* d = diff.ptr<uchar>(y);
+        const uchar* c = has_color ? color.ptr<uchar>(y) : NULL;
+        cvb::CvLabel run_label = 0;
+        BlobAccumulator_t* a = NULL;
+        for (int x = minx; x <= maxx; x++) {
+            cvb::CvLabel label = l[x];
+            if (label == 0) {
+                continue;
+            }
+            if (label != run_label) {
+                run_label = label;
+                a = (label <= max_label && index[label] >= 0) ?
+                    &acc[index[label]] : NULL;
+            }
+            if (a == NULL) {
+                continue;
+            }
+
+            unsigned int v = f[x];
+            a->count++;
+            a->sum_luma += v;
+            a->sum_luma2 += v * v;
+            a->sum_diff += d[x];
+            int bin;
+            if (has_color) {
+                unsigned int b = c[3 * x];
+                unsigned int g = c[3 * x + 1];
+                unsigned int r = c[3 * x + 2];
+                a->sum_bgr[0] += b;
+                a->sum_bgr[1] += g;
+                a->sum_bgr[2] += r;
+                bin = ((b >> 6) << 4) | ((g >> 6) << 2) | (r >> 6);
+            } else {
+                bin = v >> 2;
+            }
+            a->hist[bin]++;
+        }
+    }
+
+    for (cvb::CvBlobs::const_iterator it = blobs.begin();
+            it != blobs.end(); ++it) {
+        const cvb::CvBlob* blob = it->second;
+        const BlobAccumulator_t& a = acc[index[it->first]];
+        BlobStats_t& s = (*stats)[it->first];
+        memset(&s, 0, sizeof(s));
+        s.area = a.count;
+        if (a.count == 0) {
+            continue;
+        }
+        double bbox_area = (double) (blob->maxx - blob->minx + 1) *
+            (blob->maxy - blob->miny + 1);
+        s.density = a.count / bbox_area;
+        s.mean_diff = (float) a.sum_diff / a.count;
+        double mean = (double) a.sum_luma / a.count;
+        s.mean_luma = mean;
+        s.var_luma = (double) a.sum_luma2 / a.count - mean * mean;
+        for (int ch = 0; ch < 3; ch++) {
+            s.mean_bgr[ch] = has_color ?
+                (float) a.sum_bgr[ch] / a.count : s.mean_luma;
+        }
+        for (int bin = 0; bin < BLOB_HIST_BINS; bin++) {
+            s.hist[bin] = (float) a.hist[bin] / a.count;
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef BLOB_STATS_H
+#define BLOB_STATS_H
+
+#include <opencv2/opencv.hpp>
+#include <map>
+
+#include "cvblob.h"
+
+// Bins of the blob color histogram, 4 levels per channel
+const int BLOB_HIST_BINS = 64;
+
+// Appearance of a motion blob beyond what cvblob gives, for telling
+// blobs apart across frames and cameras
+typedef struct BlobStats {
+    // Pixels carrying the blob's label
+    unsigned int area;
+    // Share of the blob's bbox those pixels cover
+    float density;
+    // Mean abs difference to the bgd over the blob
+    float mean_diff;
+    float mean_luma;
+    float var_luma;
+    // Mean color, gray when there was no color frame
+    float mean_bgr[3];
+    // Normalized histogram: joint B, G, R quantized to 4 levels each
+    // (bin 16 * b + 4 * g + r), or 64 luma levels without color
+    float hist[BLOB_HIST_BINS];
+} BlobStats_t;
+
+// Statistics of all blobs at once in a single pass over the label image,
+// which is only read inside the box covering every blob. Each pixel
+// adds to the accumulator of its label; runs of one label along a row
+// keep the same accumulator, so the per pixel work is a compare and a
+// few adds.
+//
+// labels is the label image (CV_32SC1 view of cvLabel's output), frame
+// the luma and diff the abs difference to the bgd, all of one size.
+// color is the BGR frame, or empty to compute color statistics from
+// luma, which is what YUV sources get: converting their whole frame
+// would cost more than the pass itself.
+void computeBlobStats(const cv::Mat& labels, const cvb::CvBlobs& blobs,
+        const cv::Mat& frame, const cv::Mat& color, const cv::Mat& diff,
+        std::map<cvb::CvLabel, BlobStats_t>* stats);
+
+#endif // BLOB_STATS_H
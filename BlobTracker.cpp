@@ -0,0 +1,198 @@
+#include "BlobTracker.h"
+
+#include <vector>
+#include <math.h>
+
+BlobTracker::BlobTracker(int frame_width, int frame_height) :
+    _frame_width(frame_width),
+    _frame_height(frame_height),
+    _next_id(0),
+    _target_id(-1),
+    _alpha(0.6f),
+    _beta(0.2f),
+    _gate(frame_width / 10.0f),
+    _confirm_hits(3),
+    _max_misses(5) {
+    _grid_cols = (int) ceil(frame_width / _gate) + 1;
+    _grid_rows = (int) ceil(frame_height / _gate) + 1;
+    _cell_head = std::vector<int>(_grid_cols * _grid_rows, -1);
+}
+
+void BlobTracker::predict() {
+    for (size_t i = 0; i < _tracks.size(); i++) {
+        BlobTrack_t& track = _tracks[i];
+        track.x += track.vx;
+        track.y += track.vy;
+        track.bbox.x = (int) (track.x - track.bbox.width / 2.0f);
+        track.bbox.y = (int) (track.y - track.bbox.height / 2.0f);
+    }
+}
+
+void BlobTracker::correct(BlobTrack_t* track, float x, float y) {
+    float rx = x - track->x;
+    float ry = y - track->y;
+    track->x += _alpha * rx;
+    track->y += _alpha * ry;
+    track->vx += _beta * rx;
+    track->vy += _beta * ry;
+}
+
+void BlobTracker::buildGrid() {
+    // Only the cells used last time need clearing
+    for (size_t i = 0; i < _track_cell.size(); i++) {
+        if (_track_cell[i] >= 0) {
+            _cell_head[_track_cell[i]] = -1;
+        }
+    }
+    _track_cell.resize(_tracks.size());
+    _cell_next.resize(_tracks.size());
+
+    for (size_t i = 0; i < _tracks.size(); i++) {
+        int cx = (int) (_tracks[i].x / _gate);
+        int cy = (int) (_tracks[i].y / _gate);
+        if (cx < 0 || cy < 0 || cx >= _grid_cols || cy >= _grid_rows) {
+            _track_cell[i] = -1;
+            continue;
+        }
+        int cell = cy * _grid_cols + cx;
+        _track_cell[i] = cell;
+        _cell_next[i] = _cell_head[cell];
+        _cell_head[cell] = i;
+    }
+}
+
+int BlobTracker::findNearest(float x, float y,
+        const std::vector<bool>& matched) const {
+    int cx = (int) (x / _gate);
+    int cy = (int) (y / _gate);
+    int best = -1;
+    float best_dist2 = _gate * _gate;
+
+    for (int gy = cy - 1; gy <= cy + 1; gy++) {
+        if (gy < 0 || gy >= _grid_rows) {
+            continue;
+        }
+        for (int gx = cx - 1; gx <= cx + 1; gx++) {
+            if (gx < 0 || gx >= _grid_cols) {
+                continue;
+            }
+            for (int t = _cell_head[gy * _grid_cols + gx]; t >= 0;
+                    t = _cell_next[t]) {
+                if (matched[t]) {
+                    continue;
+                }
+                float dx = _tracks[t].x - x;
+                float dy = _tracks[t].y - y;
+                float dist2 = dx * dx + dy * dy;
+                if (dist2 < best_dist2) {
+                    best_dist2 = dist2;
+                    best = t;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+void BlobTracker::update(const cvb::CvBlobs& blobs) {
+    buildGrid();
+
+    size_t num_tracks = _tracks.size();
+    std::vector<bool> matched(num_tracks, false);
+
+    for (cvb::CvBlobs::const_iterator it = blobs.begin();
+            it != blobs.end(); ++it) {
+        const cvb::CvBlob* blob = it->second;
+        float x = (float) blob->centroid.x;
+        float y = (float) blob->centroid.y;
+        cv::Rect bbox(blob->minx, blob->miny,
+                blob->maxx - blob->minx + 1,
+                blob->maxy - blob->miny + 1);
+
+        int t = findNearest(x, y, matched);
+        if (t >= 0) {
+            matched[t] = true;
+            updateTrack(t, cv::Point2f(x, y), bbox, blob->area);
+            _tracks[t].label = blob->label;
+            continue;
+        }
+
+        BlobTrack_t track;
+        track.id = _next_id++;
+        track.x = x;
+        track.y = y;
+        track.vx = 0;
+        track.vy = 0;
+        track.bbox = bbox;
+        track.area = blob->area;
+        track.label = blob->label;
+        track.hits = 1;
+        track.misses = 0;
+        _tracks.push_back(track);
+    }
+
+    for (size_t t = 0; t < num_tracks; t++) {
+        if (!matched[t]) {
+            missTrack(t);
+            // Has no blob in the new label image
+            _tracks[t].label = 0;
+        }
+    }
+
+    // Retire lost tracks, keeping order so indices of the survivors
+    // stay stable relative to each other
+    size_t kept = 0;
+    for (size_t t = 0; t < _tracks.size(); t++) {
+        if (_tracks[t].misses <= _max_misses) {
+            _tracks[kept++] = _tracks[t];
+        }
+    }
+    _tracks.resize(kept);
+}
+
+void BlobTracker::updateTrack(int track_i, const cv::Point2f& centroid,
+        const cv::Rect& bbox, unsigned int area) {
+    BlobTrack_t& track = _tracks[track_i];
+    correct(&track, centroid.x, centroid.y);
+    track.bbox = bbox;
+    track.area = area;
+    track.hits++;
+    track.misses = 0;
+}
+
+void BlobTracker::missTrack(int track_i) {
+    _tracks[track_i].misses++;
+}
+
+cv::Rect BlobTracker::predictedBbox(const BlobTrack_t& track,
+        int margin) const {
+    cv::Rect bbox(track.bbox.x - margin,
+            track.bbox.y - margin,
+            track.bbox.width + 2 * margin,
+            track.bbox.height + 2 * margin);
+    return bbox & cv::Rect(0, 0, _frame_width, _frame_height);
+}
+
+bool BlobTracker::selectTarget(BlobTrack_t* target) {
+    int best = -1;
+    for (size_t t = 0; t < _tracks.size(); t++) {
+        if (!isConfirmed(_tracks[t])) {
+            continue;
+        }
+        if (_tracks[t].id == _target_id) {
+            best = t;
+            break;
+        }
+        if (best < 0 || _tracks[t].hits > _tracks[best].hits) {
+            best = t;
+        }
+    }
+
+    if (best < 0) {
+        _target_id = -1;
+        return false;
+    }
+    _target_id = _tracks[best].id;
+    *target = _tracks[best];
+    return true;
+}
@@ -0,0 +1,96 @@
+#ifndef BLOB_TRACKER_H
+#define BLOB_TRACKER_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "cvblob.h"
+
+typedef struct BlobTrack {
+    int id;
+    // Alpha-beta filtered centroid and per-frame velocity
+    float x;
+    float y;
+    float vx;
+    float vy;
+    // Bounding box of the last associated blob, moved along with the
+    // prediction while coasting
+    cv::Rect bbox;
+    unsigned int area;
+    // Label of the blob in the label image of the last full detection
+    // it was associated in
+    unsigned int label;
+    // Number of frames a blob was associated with this track
+    int hits;
+    // Consecutive frames without an associated blob
+    int misses;
+} BlobTrack_t;
+
+// Gives motion blobs an identity across frames. Each track is predicted
+// with an alpha-beta filter and blobs are associated to the nearest
+// predicted track within a gate. Predicted positions are hashed into a
+// grid with cells of the gate size, so each blob only looks at the 3x3
+// cells around it and association stays linear in the number of blobs.
+class BlobTracker {
+    public:
+        BlobTracker(int frame_width, int frame_height);
+
+        // Advance all tracks by one frame
+        void predict();
+        // Associate a full set of detected blobs with the predicted
+        // tracks, start tracks for unmatched blobs and retire tracks
+        // that were missed too often. Call predict() first.
+        void update(const cvb::CvBlobs& blobs);
+        // Update a single track with a measurement found without a
+        // full detection pass, e.g. inside its predicted bbox
+        void updateTrack(int track_i, const cv::Point2f& centroid,
+                const cv::Rect& bbox, unsigned int area);
+        // Count a predicted track as not seen this frame
+        void missTrack(int track_i);
+
+        const std::vector<BlobTrack_t>& getTracks() const {
+            return _tracks;
+        };
+        // Tracks seen often enough to be trusted
+        bool isConfirmed(const BlobTrack_t& track) const {
+            return track.hits >= _confirm_hits;
+        };
+        // Bbox of the track at its predicted position, grown by margin.
+        // Only meaningful after predict().
+        cv::Rect predictedBbox(const BlobTrack_t& track, int margin) const;
+
+        // Picks the track the PTZ camera should follow. The current
+        // target is kept while it lives, otherwise the confirmed track
+        // with the most hits is chosen.
+        bool selectTarget(BlobTrack_t* target);
+
+    private:
+        void buildGrid();
+        int findNearest(float x, float y, 
+                const std::vector<bool>& matched) const;
+        void correct(BlobTrack_t* track, float x, float y);
+
+        int _frame_width;
+        int _frame_height;
+        std::vector<BlobTrack_t> _tracks;
+        int _next_id;
+        int _target_id;
+
+        // Alpha-beta gains for position and velocity
+        float _alpha;
+        float _beta;
+        // Max distance between a predicted track and a blob
+        float _gate;
+        int _confirm_hits;
+        int _max_misses;
+
+        // Grid hash of predicted track positions. _cell_head holds the
+        // first track index in each cell, _cell_next chains the rest.
+        int _grid_cols;
+        int _grid_rows;
+        std::vector<int> _cell_head;
+        std::vector<int> _cell_next;
+        std::vector<int> _track_cell;
+};
+
+#endif // BLOB_TRACKER_H
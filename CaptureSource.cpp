@@ -0,0 +1,49 @@
+#include "CaptureSource.h"
+
+void CaptureSource::stampCaptureTime(VideoFrame_t* slot) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    slot->capture_time.tv_sec = now.tv_sec;
+    slot->capture_time.tv_usec = now.tv_nsec / 1000;
+}
+
+void CaptureSource::setFps(int fps) {
+    _fps = fps;
+    clock_gettime(CLOCK_MONOTONIC, &_next);
+}
+
+void CaptureSource::pace() {
+    if (_fps <= 0) {
+        return;
+    }
+    // Paced on absolute times, so a late frame doesn't delay the ones
+    // after it
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &_next, NULL);
+    _next.tv_nsec += 1000000000L / _fps;
+    while (_next.tv_nsec >= 1000000000L) {
+        _next.tv_sec++;
+        _next.tv_nsec -= 1000000000L;
+    }
+}
+
+bool getColorFrame(const VideoFrame_t& slot, cv::Mat* dst) {
+    if (slot.color_valid) {
+        *dst = slot.color_frame;
+        return true;
+    }
+
+    switch (slot.pixel_format) {
+        case PIX_FMT_I420:
+            cv::cvtColor(slot.raw, *dst, CV_YUV2BGR_I420);
+            return true;
+        case PIX_FMT_NV12:
+            cv::cvtColor(slot.raw, *dst, CV_YUV2BGR_NV12);
+            return true;
+        case PIX_FMT_YUYV:
+            cv::cvtColor(slot.raw, *dst, CV_YUV2BGR_YUYV);
+            return true;
+        default:
+            cv::cvtColor(slot.frame, *dst, CV_GRAY2BGR);
+            return true;
+    }
+}
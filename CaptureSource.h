@@ -0,0 +1,53 @@
+#ifndef CAPTURE_SOURCE_H
+#define CAPTURE_SOURCE_H
+
+#include <opencv2/opencv.hpp>
+#include <time.h>
+
+#include "video_frame.h"
+
+// Source of webcam frames for the capture loop. grab() takes the next
+// frame from the device or file, retrieve() fills a frame buffer slot
+// with it. Sources that deliver YUV write the Y plane straight into
+// slot->frame and leave color to getColorFrame.
+class CaptureSource {
+    public:
+        CaptureSource(int frame_width, int frame_height) :
+            _frame_width(frame_width),
+            _frame_height(frame_height),
+            _fps(0) {};
+        virtual ~CaptureSource() {};
+
+        virtual bool grab() = 0;
+        virtual bool retrieve(VideoFrame_t* slot) = 0;
+        // Layout of the data this source writes into slot->raw, used
+        // by the frame pool to bind slot storage
+        virtual int pixelFormat() const = 0;
+
+        // Paces grab() at fps frames per second, for sources that
+        // would otherwise deliver frames as fast as they are read; 0
+        // turns pacing off. V4L2 devices pace themselves.
+        void setFps(int fps);
+
+    protected:
+        // Sets capture_time for sources without a device timestamp
+        static void stampCaptureTime(VideoFrame_t* slot);
+        // Waits until the next frame is due when paced
+        void pace();
+
+        int _frame_width;
+        int _frame_height;
+
+    private:
+        int _fps;
+        // When the next frame is due
+        struct timespec _next;
+};
+
+// Color version of the slot's frame. Sources that capture BGR just
+// share color_frame; for YUV sources the conversion is done into dst
+// only now, so frames nobody looks at in color never pay for it.
+// Caller holds a read lock on the slot.
+bool getColorFrame(const VideoFrame_t& slot, cv::Mat* dst);
+
+#endif // CAPTURE_SOURCE_H
@@ -0,0 +1,61 @@
+#include "CaptureSourceOpenCV.h"
+
+#include <iostream>
+#include <stdio.h>
+
+CaptureSourceOpenCV::CaptureSourceOpenCV(int device,
+        int frame_width, int frame_height) :
+    CaptureSource(frame_width, frame_height),
+    _video_cap(device),
+    _file(false) {
+	// Initialize frame width and frame height for frame capture
+    if(!(_video_cap.set(CV_CAP_PROP_FRAME_WIDTH, frame_width) &
+                _video_cap.set(CV_CAP_PROP_FRAME_HEIGHT, frame_height))) {
+		perror("Can not set frame width and height");
+	}
+}
+
+CaptureSourceOpenCV::CaptureSourceOpenCV(const std::string& path,
+        int frame_width, int frame_height) :
+    CaptureSource(frame_width, frame_height),
+    _video_cap(path),
+    _file(true) {
+    if (!_video_cap.isOpened()) {
+        std::cout << "unable to open " << path << std::endl;
+    }
+}
+
+CaptureSourceOpenCV::~CaptureSourceOpenCV() {
+    _video_cap.release();
+}
+
+bool CaptureSourceOpenCV::grab() {
+    pace();
+    return _video_cap.grab();
+}
+
+bool CaptureSourceOpenCV::retrieve(VideoFrame_t* slot) {
+    if (!_file) {
+        if (!_video_cap.retrieve(slot->color_frame)) {
+            return false;
+        }
+    } else {
+        // Files come at their own size, which the slot isn't laid out
+        // for
+        if (!_video_cap.retrieve(_file_frame)) {
+            return false;
+        }
+        if (_file_frame.cols == _frame_width &&
+                _file_frame.rows == _frame_height) {
+            _file_frame.copyTo(slot->color_frame);
+        } else {
+            cv::resize(_file_frame, slot->color_frame,
+                    cv::Size(_frame_width, _frame_height), 0, 0,
+                    cv::INTER_AREA);
+        }
+    }
+    cv::cvtColor(slot->color_frame, slot->frame, CV_BGR2GRAY);
+    slot->color_valid = true;
+    stampCaptureTime(slot);
+    return true;
+}
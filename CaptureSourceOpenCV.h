@@ -0,0 +1,39 @@
+#ifndef CAPTURE_SOURCE_OPENCV_H
+#define CAPTURE_SOURCE_OPENCV_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+#include "CaptureSource.h"
+#include "video_frame.h"
+
+// Webcam capture, or replay of a video file, through cv::VideoCapture.
+// Neither is paced unless a rate is set with setFps.
+// Frames arrive as BGR, so color is always available and luma is
+// converted from it.
+class CaptureSourceOpenCV : public CaptureSource {
+    public:
+        CaptureSourceOpenCV(int device, int frame_width, int frame_height);
+        // Replays the video file at path; frames of another size are
+        // scaled to the frame size.
+        CaptureSourceOpenCV(const std::string& path, int frame_width,
+                int frame_height);
+        virtual ~CaptureSourceOpenCV();
+
+        bool isOpened() const {
+            return _video_cap.isOpened();
+        };
+        virtual bool grab();
+        virtual bool retrieve(VideoFrame_t* slot);
+        virtual int pixelFormat() const {
+            return PIX_FMT_BGR;
+        };
+
+    private:
+        cv::VideoCapture _video_cap;
+        bool _file;
+        // Decoded file frame before scaling, reused
+        cv::Mat _file_frame;
+};
+
+#endif // CAPTURE_SOURCE_OPENCV_H
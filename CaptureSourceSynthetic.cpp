@@ -0,0 +1,22 @@
+#include "CaptureSourceSynthetic.h"
+
+CaptureSourceSynthetic::CaptureSourceSynthetic(
+        const SyntheticSceneParams_t& params, int fps) :
+    CaptureSource(params.width, params.height),
+    _scene(params),
+    _frame_i(0) {
+    setFps(fps);
+}
+
+bool CaptureSourceSynthetic::grab() {
+    pace();
+    _frame_i++;
+    return true;
+}
+
+bool CaptureSourceSynthetic::retrieve(VideoFrame_t* slot) {
+    _scene.render(_frame_i, &slot->frame, &slot->ip_frame);
+    slot->color_valid = false;
+    stampCaptureTime(slot);
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef CAPTURE_SOURCE_SYNTHETIC_H
+#define CAPTURE_SOURCE_SYNTHETIC_H
+
+#include <opencv2/opencv.hpp>
+
+#include "CaptureSource.h"
+#include "SyntheticScene.h"
+#include "video_frame.h"
+
+// Frames of a SyntheticScene at a fixed rate, in place of a webcam.
+// The scene's ip camera view is written into the slot's ip_frame as
+// well, so no ip stream is needed. Frames are gray; color is converted
+// from them on demand.
+class CaptureSourceSynthetic : public CaptureSource {
+    public:
+        // fps 0 renders frames as fast as they are grabbed
+        CaptureSourceSynthetic(const SyntheticSceneParams_t& params,
+                int fps);
+
+        virtual bool grab();
+        virtual bool retrieve(VideoFrame_t* slot);
+        virtual int pixelFormat() const {
+            return PIX_FMT_BGR;
+        };
+
+    private:
+        SyntheticScene _scene;
+        unsigned long _frame_i;
+};
+
+#endif // CAPTURE_SOURCE_SYNTHETIC_H
@@ -0,0 +1,398 @@
+#include "CaptureSourceV4L2.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "Metrics.h"
+
+// Driver buffers requested for streaming
+const static int NUM_BUFFERS = 8;
+// How long grab waits for a frame before trying again
+const static int GRAB_TIMEOUT_MS = 2000;
+// Failed waits for a frame in a row before the device is reopened
+const static int MAX_GRAB_FAILURES = 3;
+// Reopens in a row before grab gives up on the device
+const static int MAX_REOPENS = 3;
+// Time a reset device gets to come back before it is reopened
+const static int REOPEN_DELAY_MS = 1000;
+
+// ioctl that retries when interrupted by a signal
+static int xioctl(int fd, unsigned long request, void* arg) {
+    int rc = 0;
+    do {
+        rc = ioctl(fd, request, arg);
+    } while (rc < 0 && errno == EINTR);
+    return rc;
+}
+
+static unsigned int toFourcc(int pixel_format) {
+    switch (pixel_format) {
+        case PIX_FMT_I420:
+            return V4L2_PIX_FMT_YUV420;
+        case PIX_FMT_NV12:
+            return V4L2_PIX_FMT_NV12;
+        case PIX_FMT_YUYV:
+            return V4L2_PIX_FMT_YUYV;
+        default:
+            return 0;
+    }
+}
+
+CaptureSourceV4L2::CaptureSourceV4L2(const std::string& device,
+        int preferred_format,
+        int frame_width, int frame_height) :
+    CaptureSource(frame_width, frame_height),
+    _device(device),
+    _pixel_format(-1),
+    _bytes_per_line(0),
+    _min_queued(3),
+    _copy_frames(false),
+    _grabbed_index(-1) {
+    if (!openDevice() || !setFormat(preferred_format) ||
+            !startStreaming()) {
+        closeDevice();
+    }
+}
+
+CaptureSourceV4L2::~CaptureSourceV4L2() {
+    // Slots must not point into unmapped driver memory
+    while (!_held.empty()) {
+        _held.front().slot->frame = _held.front().pool_frame;
+        _held.front().slot->raw = _held.front().pool_raw;
+        _held.pop_front();
+    }
+    closeDevice();
+}
+
+bool CaptureSourceV4L2::openDevice() {
+    _fd = open(_device.c_str(), O_RDWR);
+    if (_fd < 0) {
+        perror("unable to open v4l2 device");
+        return false;
+    }
+
+    struct v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (xioctl(_fd, VIDIOC_QUERYCAP, &cap) < 0 ||
+            !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+            !(cap.capabilities & V4L2_CAP_STREAMING)) {
+        perror("v4l2 device does not support streaming capture");
+        return false;
+    }
+    return true;
+}
+
+// The frame pool is laid out for the format the device was first
+// opened with, so it must come back with the same one
+bool CaptureSourceV4L2::reopen() {
+    // Held frames are copied out, their buffers go with the device
+    while (!_held.empty()) {
+        if (!releaseOldest()) {
+            return false;
+        }
+    }
+    closeDevice();
+    usleep(REOPEN_DELAY_MS * 1000);
+
+    int pixel_format = _pixel_format;
+    size_t bytes_per_line = _bytes_per_line;
+    if (!openDevice() || !setFormat(pixel_format)) {
+        closeDevice();
+    } else if (_pixel_format != pixel_format ||
+            _bytes_per_line != bytes_per_line) {
+        std::cout << "v4l2 device came back with another format" <<
+            std::endl;
+        closeDevice();
+    } else if (!startStreaming()) {
+        closeDevice();
+    }
+    _pixel_format = pixel_format;
+    _bytes_per_line = bytes_per_line;
+    return _fd >= 0;
+}
+
+void CaptureSourceV4L2::closeDevice() {
+    if (_fd < 0) {
+        return;
+    }
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(_fd, VIDIOC_STREAMOFF, &type);
+    for (size_t i = 0; i < _buffers.size(); i++) {
+        munmap(_buffers[i].start, _buffers[i].length);
+    }
+    _buffers.clear();
+    close(_fd);
+    _fd = -1;
+}
+
+// Tries the preferred YUV format first, then the other supported ones.
+// The driver must accept the exact frame size.
+bool CaptureSourceV4L2::setFormat(int preferred_format) {
+    int candidates[4] = {preferred_format, PIX_FMT_NV12,
+        PIX_FMT_I420, PIX_FMT_YUYV};
+
+    for (int i = 0; i < 4; i++) {
+        unsigned int fourcc = toFourcc(candidates[i]);
+        if (fourcc == 0) {
+            continue;
+        }
+
+        struct v4l2_format fmt;
+        memset(&fmt, 0, sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = _frame_width;
+        fmt.fmt.pix.height = _frame_height;
+        fmt.fmt.pix.pixelformat = fourcc;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        if (xioctl(_fd, VIDIOC_S_FMT, &fmt) < 0 ||
+                fmt.fmt.pix.pixelformat != fourcc) {
+            continue;
+        }
+        if ((int) fmt.fmt.pix.width != _frame_width ||
+                (int) fmt.fmt.pix.height != _frame_height) {
+            std::cout << "v4l2 device does not support " << _frame_width <<
+                "x" << _frame_height << std::endl;
+            return false;
+        }
+        // OpenCV's I420 conversion can only describe padded rows if
+        // the chroma rows are padded the same way, which V4L2 doesn't do
+        if (candidates[i] == PIX_FMT_I420 &&
+                fmt.fmt.pix.bytesperline != fmt.fmt.pix.width) {
+            continue;
+        }
+
+        _pixel_format = candidates[i];
+        _bytes_per_line = fmt.fmt.pix.bytesperline;
+        return true;
+    }
+
+    std::cout << "v4l2 device offers no usable yuv format" << std::endl;
+    return false;
+}
+
+bool CaptureSourceV4L2::startStreaming() {
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = NUM_BUFFERS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(_fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) {
+        perror("unable to request v4l2 buffers");
+        return false;
+    }
+    _min_queued = std::min(_min_queued, (int) req.count - 1);
+
+    for (unsigned int i = 0; i < req.count; i++) {
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(_fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            perror("unable to query v4l2 buffer");
+            return false;
+        }
+
+        MappedBuffer_t mapped;
+        mapped.length = buf.length;
+        mapped.start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                MAP_SHARED, _fd, buf.m.offset);
+        if (mapped.start == MAP_FAILED) {
+            perror("unable to map v4l2 buffer");
+            return false;
+        }
+        _buffers.push_back(mapped);
+
+        if (!queueBuffer(i)) {
+            return false;
+        }
+    }
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(_fd, VIDIOC_STREAMON, &type) < 0) {
+        perror("unable to start v4l2 streaming");
+        return false;
+    }
+    return true;
+}
+
+bool CaptureSourceV4L2::queueBuffer(int buf_index) {
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = buf_index;
+    if (xioctl(_fd, VIDIOC_QBUF, &buf) < 0) {
+        perror("unable to queue v4l2 buffer");
+        return false;
+    }
+    return true;
+}
+
+void CaptureSourceV4L2::releaseHeld(HeldBuffer_t* held, bool copy) {
+    VideoFrame_t* slot = held->slot;
+    if (copy) {
+        slot->raw.copyTo(held->pool_raw);
+        if (_pixel_format != PIX_FMT_YUYV) {
+            // Planar pool frames are the Y rows of the pool raw plane
+            held->pool_frame = held->pool_raw.rowRange(0, _frame_height);
+        }
+    }
+    slot->raw = held->pool_raw;
+    slot->frame = held->pool_frame;
+    queueBuffer(held->buf_index);
+}
+
+bool CaptureSourceV4L2::grab() {
+    if (_fd < 0) {
+        return false;
+    }
+
+    // A frame grabbed but never retrieved goes straight back
+    if (_grabbed_index >= 0) {
+        queueBuffer(_grabbed_index);
+        _grabbed_index = -1;
+    }
+
+    // Keep enough buffers with the driver. The oldest held frames
+    // are copied out once no consumer has their slot locked.
+    int queued = _buffers.size() - _held.size();
+    while (queued < _min_queued && !_held.empty()) {
+        if (!releaseOldest()) {
+            return false;
+        }
+        queued++;
+    }
+
+    // A device that stopped delivering (a USB hiccup, a reset) is
+    // reopened, and only given up on when that keeps failing
+    int failures = 0;
+    int reopens = 0;
+    while (!dequeue()) {
+        globalMetrics().increment("v4l2.grab_failures");
+        if (_fd >= 0 && ++failures < MAX_GRAB_FAILURES) {
+            continue;
+        }
+        if (reopens == MAX_REOPENS) {
+            std::cout << "giving up on v4l2 device " << _device <<
+                std::endl;
+            return false;
+        }
+        reopens++;
+        failures = 0;
+        globalMetrics().increment("v4l2.reopens");
+        std::cout << "reopening v4l2 device " << _device << std::endl;
+        reopen();
+    }
+    return true;
+}
+
+bool CaptureSourceV4L2::releaseOldest() {
+    HeldBuffer_t& held = _held.front();
+    int rc = 0;
+    if( (rc = pthread_rwlock_wrlock(held.slot->rw_lock)) != 0) {
+        perror("Failed to acquire write lock to release v4l2 buffer.");
+        return false;
+    }
+    releaseHeld(&held, true);
+    if( (rc = pthread_rwlock_unlock(held.slot->rw_lock)) != 0) {
+        perror("Failed to release write lock after releasing v4l2 buffer.");
+    }
+    _held.pop_front();
+    return true;
+}
+
+bool CaptureSourceV4L2::dequeue() {
+    if (_fd < 0) {
+        return false;
+    }
+    struct pollfd pfd;
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+    int ready = 0;
+    do {
+        ready = poll(&pfd, 1, GRAB_TIMEOUT_MS);
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0) {
+        std::cout << "timed out waiting for v4l2 frame" << std::endl;
+        return false;
+    }
+
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(_fd, VIDIOC_DQBUF, &buf) < 0) {
+        perror("unable to dequeue v4l2 buffer");
+        return false;
+    }
+    _grabbed_index = buf.index;
+    _grabbed_time = buf.timestamp;
+    return true;
+}
+
+// Caller holds the slot's write lock
+bool CaptureSourceV4L2::retrieve(VideoFrame_t* slot) {
+    if (_grabbed_index < 0) {
+        return false;
+    }
+
+    // The ring came around to a slot that still wraps a buffer; its
+    // contents are being replaced anyway, so no copy is needed
+    for (std::deque<HeldBuffer_t>::iterator it = _held.begin();
+            it != _held.end(); ++it) {
+        if (it->slot == slot) {
+            releaseHeld(&(*it), false);
+            _held.erase(it);
+            break;
+        }
+    }
+
+    uchar* data = (uchar*) _buffers[_grabbed_index].start;
+    cv::Mat driver_raw = (_pixel_format == PIX_FMT_YUYV) ?
+        cv::Mat(_frame_height, _frame_width, CV_8UC2, data,
+                _bytes_per_line) :
+        cv::Mat(_frame_height + _frame_height / 2, _frame_width, CV_8UC1,
+                data, _bytes_per_line);
+    slot->color_valid = false;
+    slot->capture_time = _grabbed_time;
+
+    if (_copy_frames) {
+        // slot->raw is the pool's plane here, so this copies into it
+        driver_raw.copyTo(slot->raw);
+        if (_pixel_format == PIX_FMT_YUYV) {
+            cv::cvtColor(slot->raw, slot->frame, CV_YUV2GRAY_YUYV);
+        }
+        queueBuffer(_grabbed_index);
+        _grabbed_index = -1;
+        return true;
+    }
+
+    HeldBuffer_t held;
+    held.slot = slot;
+    held.buf_index = _grabbed_index;
+    held.pool_frame = slot->frame;
+    held.pool_raw = slot->raw;
+
+    slot->raw = driver_raw;
+    if (_pixel_format == PIX_FMT_YUYV) {
+        // Packed luma still has to be pulled out into the pool frame
+        cv::cvtColor(slot->raw, slot->frame, CV_YUV2GRAY_YUYV);
+    } else {
+        slot->frame = slot->raw.rowRange(0, _frame_height);
+    }
+
+    _held.push_back(held);
+    _grabbed_index = -1;
+    return true;
+}
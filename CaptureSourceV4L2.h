@@ -0,0 +1,100 @@
+#ifndef CAPTURE_SOURCE_V4L2_H
+#define CAPTURE_SOURCE_V4L2_H
+
+#include <opencv2/opencv.hpp>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "CaptureSource.h"
+#include "video_frame.h"
+
+// Native V4L2 capture with mmap streaming I/O. Frames are dequeued
+// from the driver and wrapped in place as the slot's raw data (and,
+// for planar formats, its frame), so there is no copy out of the
+// driver and slots carry the driver's capture timestamp.
+//
+// The ring is much longer than the driver queue, so a slot only holds
+// on to its driver buffer while it is recent. Before the driver would
+// run low on queued buffers, the oldest held frame is copied into the
+// slot's own frame pool storage under the slot's write lock, which
+// waits for every consumer to release it, and its buffer is re-queued.
+//
+// Frames published on a frame bus are read by other processes from the
+// frame pool, not the driver buffers; with setCopyFrames the whole raw
+// plane is copied into the slot's pool storage as it is retrieved and
+// the buffer goes straight back to the driver.
+class CaptureSourceV4L2 : public CaptureSource {
+    public:
+        CaptureSourceV4L2(const std::string& device,
+                int preferred_format,
+                int frame_width, int frame_height);
+        virtual ~CaptureSourceV4L2();
+
+        bool isOpened() const {
+            return _fd >= 0;
+        };
+
+        // Must be called without holding any frame buffer slot lock.
+        // Reopens the device when it stops delivering frames; false
+        // once that failed a few times in a row.
+        virtual bool grab();
+        virtual bool retrieve(VideoFrame_t* slot);
+        virtual int pixelFormat() const {
+            return _pixel_format;
+        };
+        // Copy each frame's raw plane, luma and chroma, into the
+        // slot's pool storage rather than wrapping the driver buffer
+        void setCopyFrames(bool copy) {
+            _copy_frames = copy;
+        };
+
+    private:
+        typedef struct MappedBuffer {
+            void* start;
+            size_t length;
+        } MappedBuffer_t;
+
+        // A slot currently wrapping a driver buffer, with the slot's
+        // own pool views to put back when it lets go of it
+        typedef struct HeldBuffer {
+            VideoFrame_t* slot;
+            int buf_index;
+            cv::Mat pool_frame;
+            cv::Mat pool_raw;
+        } HeldBuffer_t;
+
+        // Opens the device and checks it can stream
+        bool openDevice();
+        // Closes and opens the device again after it stopped
+        // delivering frames, false if it didn't come back as it was
+        bool reopen();
+        bool setFormat(int preferred_format);
+        bool startStreaming();
+        void closeDevice();
+        bool queueBuffer(int buf_index);
+        // Puts the slot's pool views back, copying the driver data
+        // into them first if copy is set, and re-queues the buffer
+        void releaseHeld(HeldBuffer_t* held, bool copy);
+        // Copies out and releases the oldest held frame once no
+        // consumer has its slot locked
+        bool releaseOldest();
+        // Waits for the next frame and dequeues it as the grabbed one
+        bool dequeue();
+
+        std::string _device;
+        int _fd;
+        int _pixel_format;
+        size_t _bytes_per_line;
+        std::vector<MappedBuffer_t> _buffers;
+        std::deque<HeldBuffer_t> _held;
+        // Buffers that should stay queued with the driver
+        int _min_queued;
+        bool _copy_frames;
+
+        // Buffer dequeued by the last grab, -1 if none
+        int _grabbed_index;
+        struct timeval _grabbed_time;
+};
+
+#endif // CAPTURE_SOURCE_V4L2_H
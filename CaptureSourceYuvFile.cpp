@@ -0,0 +1,120 @@
+#include "CaptureSourceYuvFile.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+CaptureSourceYuvFile::CaptureSourceYuvFile(const std::string& path,
+        int pixel_format, int frame_width, int frame_height) :
+    CaptureSource(frame_width, frame_height),
+    _pixel_format(pixel_format),
+    _eof(false) {
+    _fd = open(path.c_str(), O_RDONLY);
+    if (_fd < 0) {
+        perror("unable to open yuv file");
+    }
+}
+
+CaptureSourceYuvFile::~CaptureSourceYuvFile() {
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+int CaptureSourceYuvFile::parsePixelFormat(const std::string& name) {
+    if (name == "i420") {
+        return PIX_FMT_I420;
+    } else if (name == "nv12") {
+        return PIX_FMT_NV12;
+    } else if (name == "yuyv") {
+        return PIX_FMT_YUYV;
+    }
+    return -1;
+}
+
+bool CaptureSourceYuvFile::grab() {
+    if (_fd < 0 || _eof) {
+        return false;
+    }
+    pace();
+    return true;
+}
+
+void CaptureSourceYuvFile::addRow(uchar* base, size_t len) {
+    struct iovec iov;
+    iov.iov_base = base;
+    iov.iov_len = len;
+    _iov.push_back(iov);
+}
+
+bool CaptureSourceYuvFile::readRows() {
+    for (size_t i = 0; i < _iov.size(); i += IOV_MAX) {
+        int count = std::min((size_t) IOV_MAX, _iov.size() - i);
+        size_t expected = 0;
+        for (int j = 0; j < count; j++) {
+            expected += _iov[i + j].iov_len;
+        }
+        ssize_t n = readv(_fd, &_iov[i], count);
+        if (n < 0 || (size_t) n != expected) {
+            // End of the recording, or a truncated last frame
+            _eof = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+// slot->raw is laid out by the frame pool for this source's format
+bool CaptureSourceYuvFile::retrieve(VideoFrame_t* slot) {
+    if (_fd < 0 || _eof) {
+        return false;
+    }
+
+    int w = _frame_width;
+    int h = _frame_height;
+    cv::Mat& raw = slot->raw;
+    _iov.clear();
+
+    switch (_pixel_format) {
+        case PIX_FMT_I420:
+            for (int y = 0; y < h; y++) {
+                addRow(raw.ptr(y), w);
+            }
+            // Two half width chroma rows share one raw row, which is
+            // where OpenCV's I420 conversion looks for them when the
+            // step is wider than the frame; each pair is one iovec
+            for (int r = 0; r < h / 2; r++) {
+                addRow(raw.ptr(h + r), w);
+            }
+            break;
+        case PIX_FMT_NV12:
+            for (int y = 0; y < h + h / 2; y++) {
+                addRow(raw.ptr(y), w);
+            }
+            break;
+        case PIX_FMT_YUYV:
+            for (int y = 0; y < h; y++) {
+                addRow(raw.ptr(y), 2 * w);
+            }
+            break;
+        default:
+            return false;
+    }
+
+    if (!readRows()) {
+        return false;
+    }
+
+    // Packed luma has to be pulled out of the interleaved data
+    if (_pixel_format == PIX_FMT_YUYV) {
+        cv::cvtColor(raw, slot->frame, CV_YUV2GRAY_YUYV);
+    }
+    slot->color_valid = false;
+    stampCaptureTime(slot);
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef CAPTURE_SOURCE_YUV_FILE_H
+#define CAPTURE_SOURCE_YUV_FILE_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+
+#include "CaptureSource.h"
+#include "video_frame.h"
+
+// Replays a headerless raw YUV file (I420, NV12 or YUYV at the frame
+// size). For the planar formats the file rows are scattered with
+// readv straight into the slot's aligned raw plane, so the Y plane
+// becomes slot->frame without any copy or conversion.
+class CaptureSourceYuvFile : public CaptureSource {
+    public:
+        CaptureSourceYuvFile(const std::string& path, int pixel_format,
+                int frame_width, int frame_height);
+        virtual ~CaptureSourceYuvFile();
+
+        bool isOpened() const {
+            return _fd >= 0;
+        };
+        virtual bool grab();
+        virtual bool retrieve(VideoFrame_t* slot);
+        virtual int pixelFormat() const {
+            return _pixel_format;
+        };
+
+        // Parses "i420", "nv12" or "yuyv", -1 if unknown
+        static int parsePixelFormat(const std::string& name);
+
+    private:
+        void addRow(uchar* base, size_t len);
+        bool readRows();
+
+        int _fd;
+        int _pixel_format;
+        bool _eof;
+        // Destination of each file row for the current slot, reused
+        std::vector<struct iovec> _iov;
+};
+
+#endif // CAPTURE_SOURCE_YUV_FILE_H
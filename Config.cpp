@@ -0,0 +1,124 @@
+#include "Config.h"
+
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+
+SystemConfig::SystemConfig() :
+    ip_stream_address("http://192.168.2.30/video.mjpg"),
+    capture_source("0"),
+    replay_fps(30),
+    capture_fps(30),
+    synthetic_objects(2),
+    synthetic_noise(2.0),
+    synthetic_drift(0.05),
+    synthetic_fps(30),
+    capture_format("i420"),
+    headless(false),
+    display_refresh_ms(30),
+    http_port(0),
+    bgd_model("average"),
+    motion_scale(1),
+    pipeline(false),
+    pipeline_depth(4),
+    latency_budget_ms(0),
+    ip_latency_budget_ms(0),
+    capture_rt_priority(0),
+    jitter_probe_ms(0),
+    batch_threads(0),
+    raw_frames(100),
+    history_mb(0),
+    history_format("jpeg"),
+    bus_only(false),
+    stats_interval(10) {
+}
+
+bool parseConfig(int argc, char** argv, SystemConfig_t* config) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            config->ip_stream_address = arg;
+            continue;
+        }
+
+        std::string name = arg.substr(2);
+        std::string value = "1";
+        std::string::size_type eq = name.find('=');
+        if (eq != std::string::npos) {
+            value = name.substr(eq + 1);
+            name = name.substr(0, eq);
+        }
+
+        if (name == "capture") {
+            config->capture_source = value;
+        } else if (name == "replay-fps") {
+            config->replay_fps = atoi(value.c_str());
+        } else if (name == "capture-fps") {
+            config->capture_fps = atoi(value.c_str());
+        } else if (name == "synthetic-objects") {
+            config->synthetic_objects = atoi(value.c_str());
+        } else if (name == "synthetic-noise") {
+            config->synthetic_noise = atof(value.c_str());
+        } else if (name == "synthetic-drift") {
+            config->synthetic_drift = atof(value.c_str());
+        } else if (name == "synthetic-fps") {
+            config->synthetic_fps = atoi(value.c_str());
+        } else if (name == "capture-format") {
+            config->capture_format = value;
+        } else if (name == "headless") {
+            config->headless = (atoi(value.c_str()) != 0);
+        } else if (name == "display-ms") {
+            config->display_refresh_ms = atoi(value.c_str());
+        } else if (name == "http-port") {
+            config->http_port = atoi(value.c_str());
+        } else if (name == "bgd") {
+            config->bgd_model = value;
+        } else if (name == "bgd-checkpoint") {
+            config->bgd_checkpoint = value;
+        } else if (name == "motion-scale") {
+            config->motion_scale = atoi(value.c_str());
+        } else if (name == "zones") {
+            config->zones = value;
+        } else if (name == "pipeline") {
+            config->pipeline = (atoi(value.c_str()) != 0);
+        } else if (name == "pipeline-depth") {
+            config->pipeline_depth = atoi(value.c_str());
+        } else if (name == "latency-budget-ms") {
+            config->latency_budget_ms = atoi(value.c_str());
+        } else if (name == "ip-latency-budget-ms") {
+            config->ip_latency_budget_ms = atoi(value.c_str());
+        } else if (name == "capture-cpus") {
+            config->capture_cpus = value;
+        } else if (name == "worker-cpus") {
+            config->worker_cpus = value;
+        } else if (name == "capture-rt-priority") {
+            config->capture_rt_priority = atoi(value.c_str());
+        } else if (name == "jitter-probe-ms") {
+            config->jitter_probe_ms = atoi(value.c_str());
+        } else if (name == "batch") {
+            config->batch_input = value;
+        } else if (name == "batch-log") {
+            config->batch_log = value;
+        } else if (name == "batch-threads") {
+            config->batch_threads = atoi(value.c_str());
+        } else if (name == "raw-frames") {
+            config->raw_frames = atoi(value.c_str());
+        } else if (name == "history-mb") {
+            config->history_mb = atoi(value.c_str());
+        } else if (name == "history-format") {
+            config->history_format = value;
+        } else if (name == "bus") {
+            config->bus = value;
+        } else if (name == "bus-only") {
+            config->bus_only = (atoi(value.c_str()) != 0);
+        } else if (name == "attach") {
+            config->attach = value;
+        } else if (name == "stats-interval") {
+            config->stats_interval = atoi(value.c_str());
+        } else {
+            std::cout << "unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
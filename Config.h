@@ -0,0 +1,130 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+
+// Runtime options for the surveillance system. Defaults match the
+// original hardcoded setup; anything can be overridden on the command
+// line with --name=value (flags without a value are set to true).
+typedef struct SystemConfig {
+    SystemConfig();
+
+    // MJPEG stream of the IP camera, or a recorded .mjpg file
+    std::string ip_stream_address;
+
+    // Webcam device index, a /dev/video* device to capture from with
+    // V4L2 directly, a video file or raw .yuv recording to replay, or
+    // "synthetic" for a generated scene that also stands in for the ip
+    // camera
+    std::string capture_source;
+    // Frame rate recordings are replayed at, 0 for as fast as they
+    // decode
+    int replay_fps;
+    // Frame rate a webcam opened through OpenCV is read at, 0 for as
+    // fast as the driver hands out frames. V4L2 devices pace themselves.
+    int capture_fps;
+    // Moving objects, noise sigma, illumination drift and frame rate of
+    // the synthetic scene, see SyntheticScene
+    int synthetic_objects;
+    double synthetic_noise;
+    double synthetic_drift;
+    int synthetic_fps;
+    // Pixel format of a .yuv recording: i420, nv12 or yuyv. Also the
+    // format tried first on a V4L2 device.
+    std::string capture_format;
+
+    // Run without the livefeed window
+    bool headless;
+    // Interval between redraws of the livefeed window
+    int display_refresh_ms;
+    // Port the livefeed is served on as MJPEG over HTTP, also when
+    // headless; 0 disables the server
+    int http_port;
+
+    // Background model: average (mean of a batch of frames, one global
+    // threshold), or running (mean and variance per pixel, with a per
+    // pixel motion threshold) with --bgd=running
+    std::string bgd_model;
+
+    // File the background model is checkpointed to and restored from
+    // at startup; derived from the capture source if empty, "none"
+    // disables checkpoints
+    std::string bgd_checkpoint;
+
+    // Pyramid level divisor motion is detected on (1, 2 or 4)
+    int motion_scale;
+    // File of the zones motion is looked for in, see ZoneMap; the
+    // whole frame if empty
+    std::string zones;
+
+    // Run background update, motion location and feature matching as
+    // a pipeline, each stage on the frame after the next one's, rather
+    // than each on whatever frame is newest; off unless --pipeline
+    bool pipeline;
+    // Frames each queue between pipeline stages holds
+    int pipeline_depth;
+
+    // Latency budgets, in ms from capture, of the webcam stages (bgd
+    // and motion) and of the ip camera stage. Processing degrades in
+    // steps while a stage is over budget, see LoadShedder; 0 leaves a
+    // camera's stages unchecked. Both are 0 unless set, so load
+    // shedding is off; --latency-budget-ms=250 and
+    // --ip-latency-budget-ms=1000 suit a 30 fps webcam next to a
+    // slower ip camera.
+    int latency_budget_ms;
+    int ip_latency_budget_ms;
+
+    // Cores the capture loop is pinned to and the processors run on,
+    // as cpu lists like "0-1,4". Without worker cpus the processors get
+    // every core but the capture ones; empty lists leave the threads
+    // unpinned. The frame buffer is put on the NUMA node of the
+    // workers.
+    std::string capture_cpus;
+    std::string worker_cpus;
+    // SCHED_FIFO priority of the capture loop when permitted, 0 for
+    // normal scheduling
+    int capture_rt_priority;
+    // Period of the probe measuring scheduling jitter on the capture
+    // cores; 0, the default, runs no probe. Opt in with
+    // --jitter-probe-ms=10 when checking the placement.
+    int jitter_probe_ms;
+
+    // Recording (a video file or a directory of segments) to analyze
+    // offline instead of running live; empty for live
+    std::string batch_input;
+    // Event log of the offline analysis, stdout if empty
+    std::string batch_log;
+    // Worker threads of the offline analysis, 0 for all cores
+    int batch_threads;
+
+    // Slots of the frame buffer, the raw frames the processors work on.
+    // With a history the buffer only needs to cover the frames being
+    // processed, so it can be cut well below the default.
+    int raw_frames;
+    // Bytes, in MB, of compressed history kept per camera behind the
+    // frame buffer, see FrameHistory; 0, the default, disables the
+    // history and its compressor threads
+    int history_mb;
+    // Compression of the history: jpeg (color for the webcam) or luma
+    // (lossless gray)
+    std::string history_format;
+
+    // Name of the frame bus the captured frames are published on for
+    // other processes, see FrameBus; empty for none
+    std::string bus;
+    // Only capture and publish on the bus, leaving the processing to
+    // attached processes
+    bool bus_only;
+    // Frame bus to attach to and run the processors on instead of
+    // capturing; empty to capture
+    std::string attach;
+
+    // Seconds between metric dumps to stdout, 0 disables them
+    int stats_interval;
+} SystemConfig_t;
+
+// Parses argv into config. The first positional argument is taken as
+// the ip stream address. Returns false on an unknown option.
+bool parseConfig(int argc, char** argv, SystemConfig_t* config);
+
+#endif // CONFIG_H
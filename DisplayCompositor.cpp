@@ -0,0 +1,184 @@
+#include "DisplayCompositor.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+// Stream names of the panels, in Panel order
+const static char* PANEL_STREAM_NAMES[DisplayCompositor::NUM_PANELS] = {
+    "frame", "mask", "bgd", "pair"
+};
+
+DisplayCompositor::DisplayCompositor(int frame_width, int frame_height,
+        int refresh_ms) :
+    _frame_width(frame_width),
+    _frame_height(frame_height),
+    _refresh_ms(refresh_ms),
+    _window_name("livefeed"),
+    _canvas(cv::Mat(frame_height, 5 * frame_width, CV_8UC1,
+                cv::Scalar(0))),
+    _last_key(-1),
+    _exit_thread(false),
+    _show_window(true),
+    _server(NULL),
+    _composite_stream(-1) {
+    _panels[PANEL_FRAME] = cv::Rect(0, 0, frame_width, frame_height);
+    _panels[PANEL_PROB_MASK] = cv::Rect(frame_width, 0,
+            frame_width, frame_height);
+    _panels[PANEL_BGD] = cv::Rect(2 * frame_width, 0,
+            frame_width, frame_height);
+    _panels[PANEL_PAIR] = cv::Rect(3 * frame_width, 0,
+            2 * frame_width, frame_height);
+
+    int rc = 0;
+    if( (rc = pthread_rwlock_init(&_canvas_lock, NULL)) != 0) {
+        perror("rwlock initialization failed in display compositor constructor.");
+    }
+    if( (rc = pthread_mutex_init(&_state_lock, NULL)) != 0) {
+        perror("mutex initialization failed in display compositor constructor.");
+    }
+}
+
+DisplayCompositor::~DisplayCompositor() {
+    pthread_rwlock_destroy(&_canvas_lock);
+    pthread_mutex_destroy(&_state_lock);
+}
+
+bool DisplayCompositor::writePanel(Panel panel, const cv::Mat& src) {
+    if (src.empty()) {
+        return false;
+    }
+
+    int rc = 0;
+    if( (rc = pthread_rwlock_wrlock(&_canvas_lock)) != 0) {
+        perror("unable to lock on display canvas.");
+        return false;
+    }
+
+    // dst is a view into the canvas, so as long as its size and type
+    // are matched the OpenCV calls below write in place
+    cv::Mat dst = _canvas(_panels[panel]);
+    bool same_size = (src.rows == dst.rows && src.cols == dst.cols);
+    if (src.type() == CV_8UC1) {
+        if (same_size) {
+            src.copyTo(dst);
+        } else {
+            cv::resize(src, dst, dst.size(), 0, 0, cv::INTER_NEAREST);
+        }
+    } else if (same_size) {
+        cv::cvtColor(src, dst, CV_BGR2GRAY);
+    } else {
+        cv::cvtColor(src, _scratch[panel], CV_BGR2GRAY);
+        cv::resize(_scratch[panel], dst, dst.size(), 0, 0,
+                cv::INTER_NEAREST);
+    }
+
+    if( (rc = pthread_rwlock_unlock(&_canvas_lock)) != 0) {
+        perror("unable to unlock on display canvas.");
+        return false;
+    }
+    return true;
+}
+
+bool DisplayCompositor::runInThread() {
+    if (_show_window) {
+        cv::namedWindow(_window_name, 1);
+    }
+
+    int rc = 0;
+    while (!shouldExit()) {
+        if (_server != NULL) {
+            publishStreams();
+        }
+        if (!_show_window) {
+            usleep(_refresh_ms * 1000);
+            continue;
+        }
+
+        if( (rc = pthread_rwlock_rdlock(&_canvas_lock)) != 0) {
+            perror("unable to lock on display canvas.");
+            return false;
+        }
+        // imshow copies into the window's own buffer
+        cv::imshow(_window_name, _canvas);
+        if( (rc = pthread_rwlock_unlock(&_canvas_lock)) != 0) {
+            perror("unable to unlock on display canvas.");
+            return false;
+        }
+
+        int key = cv::waitKey(_refresh_ms);
+        if (key >= 0) {
+            pthread_mutex_lock(&_state_lock);
+            _last_key = key;
+            pthread_mutex_unlock(&_state_lock);
+        }
+    }
+
+    if (_show_window) {
+        cv::destroyWindow(_window_name);
+    }
+    return true;
+}
+
+void DisplayCompositor::setStreamServer(MjpegServer* server) {
+    _server = server;
+    _composite_stream = server->addStream("composite");
+    for (int i = 0; i < NUM_PANELS; i++) {
+        _panel_streams[i] = server->addStream(PANEL_STREAM_NAMES[i]);
+    }
+}
+
+// Each stream is encoded once per refresh however many clients it has,
+// and not at all without any
+void DisplayCompositor::publishStreams() {
+    bool composite = _server->hasClients(_composite_stream);
+    bool panels[NUM_PANELS];
+    bool any = composite;
+    for (int i = 0; i < NUM_PANELS; i++) {
+        panels[i] = _server->hasClients(_panel_streams[i]);
+        any = any || panels[i];
+    }
+    if (!any) {
+        return;
+    }
+
+    int rc = 0;
+    if( (rc = pthread_rwlock_rdlock(&_canvas_lock)) != 0) {
+        perror("unable to lock on display canvas.");
+        return;
+    }
+    _canvas.copyTo(_stream_canvas);
+    if( (rc = pthread_rwlock_unlock(&_canvas_lock)) != 0) {
+        perror("unable to unlock on display canvas.");
+    }
+
+    if (composite) {
+        _server->publish(_composite_stream, _stream_canvas);
+    }
+    for (int i = 0; i < NUM_PANELS; i++) {
+        if (panels[i]) {
+            _server->publish(_panel_streams[i],
+                    _stream_canvas(_panels[i]));
+        }
+    }
+}
+
+void DisplayCompositor::stop() {
+    pthread_mutex_lock(&_state_lock);
+    _exit_thread = true;
+    pthread_mutex_unlock(&_state_lock);
+}
+
+int DisplayCompositor::popKey() {
+    pthread_mutex_lock(&_state_lock);
+    int key = _last_key;
+    _last_key = -1;
+    pthread_mutex_unlock(&_state_lock);
+    return key;
+}
+
+bool DisplayCompositor::shouldExit() {
+    pthread_mutex_lock(&_state_lock);
+    bool exit_thread = _exit_thread;
+    pthread_mutex_unlock(&_state_lock);
+    return exit_thread;
+}
@@ -0,0 +1,83 @@
+#ifndef DISPLAY_COMPOSITOR_H
+#define DISPLAY_COMPOSITOR_H
+
+#include <opencv2/opencv.hpp>
+#include <pthread.h>
+#include <string>
+
+#include "MjpegServer.h"
+
+// Owns the livefeed canvas. The canvas is allocated once with a fixed
+// ROI per panel; producers write their latest snapshot straight into
+// their panel and the display thread shows the canvas at its own rate,
+// independent of capture and processing. The canvas and each panel can
+// also be served as MJPEG streams, with or without the window.
+class DisplayCompositor {
+    public:
+        enum Panel {
+            PANEL_FRAME = 0,
+            PANEL_PROB_MASK,
+            PANEL_BGD,
+            // Webcam/ip camera pair annotated with feature matches,
+            // twice the width of the other panels
+            PANEL_PAIR,
+            NUM_PANELS
+        };
+
+        DisplayCompositor(int frame_width, int frame_height,
+                int refresh_ms);
+        ~DisplayCompositor();
+
+        // Copy src into the panel. Grayscale sources of the panel size
+        // are copied directly; anything else is converted and/or
+        // resized into the panel without reallocating the canvas.
+        bool writePanel(Panel panel, const cv::Mat& src);
+
+        // Shows the canvas every _refresh_ms until stop() is called.
+        // All highgui calls happen on this thread.
+        bool runInThread();
+        void stop();
+
+        // Returns the last key pressed in the window, or -1
+        int popKey();
+
+        // Serve the canvas as /composite and each panel under its own
+        // name on server. Call before the server is started.
+        void setStreamServer(MjpegServer* server);
+        // Without the window the thread only feeds the stream server
+        void setShowWindow(bool show_window) {
+            _show_window = show_window;
+        };
+
+    private:
+        bool shouldExit();
+        // Publishes the canvas and panels anyone is watching
+        void publishStreams();
+
+        int _frame_width;
+        int _frame_height;
+        int _refresh_ms;
+        std::string _window_name;
+
+        cv::Mat _canvas;
+        cv::Rect _panels[NUM_PANELS];
+        // Scratch for sources that need both conversion and resize
+        cv::Mat _scratch[NUM_PANELS];
+        // Write locks are taken per panel write, the display thread
+        // reads the whole canvas
+        pthread_rwlock_t _canvas_lock;
+
+        // Protects _last_key and _exit_thread
+        pthread_mutex_t _state_lock;
+        int _last_key;
+        bool _exit_thread;
+
+        bool _show_window;
+        MjpegServer* _server;
+        int _composite_stream;
+        int _panel_streams[NUM_PANELS];
+        // Copy of the canvas streams are encoded from, outside the lock
+        cv::Mat _stream_canvas;
+};
+
+#endif // DISPLAY_COMPOSITOR_H
@@ -0,0 +1,291 @@
+#include "FrameBus.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Metrics.h"
+
+const static char BUS_MAGIC[8] = {'F', 'R', 'M', 'B', 'U', 'S', 0, 0};
+const static uint32_t BUS_FORMAT_VERSION = 1;
+const static size_t PAGE_SIZE_BYTES = 4096;
+
+// Start of the segment, followed by the slot table and then the arena
+// on a page boundary
+struct FrameBus::Header {
+    char magic[8];
+    uint32_t version;
+    // Set by the writer on a clean exit
+    volatile uint32_t closed;
+    int32_t writer_pid;
+    FrameBusLayout_t layout;
+    uint64_t arena_offset;
+    uint64_t arena_size;
+    // Capture sequence number of the last published frame
+    volatile uint64_t head;
+    // Bumped on every publish; readers wait on it
+    volatile int32_t futex;
+    // Readers waiting on futex, so the writer can skip the wake
+    volatile int32_t waiters;
+};
+
+// One cache line per slot, so the writer publishing one slot doesn't
+// bounce the line readers are checking another one on
+struct FrameBus::Slot {
+    // Odd while the slot is written, 2 * seq once frame seq is in it
+    volatile uint64_t seq;
+    uint64_t last_change_seq;
+    uint64_t ip_last_change_seq;
+    int64_t capture_sec;
+    int64_t capture_usec;
+    int64_t timestamp;
+    char pad[16];
+};
+
+static long futex(volatile int32_t* addr, int op, int32_t val,
+        const struct timespec* timeout) {
+    return syscall(SYS_futex, (int32_t*) addr, op, val, timeout, NULL, 0);
+}
+
+FrameBus::FrameBus() :
+    _owner(false),
+    _mem(NULL),
+    _mem_size(0),
+    _header(NULL),
+    _slots(NULL),
+    _arena(NULL) {
+}
+
+FrameBus::~FrameBus() {
+    if (_mem == NULL) {
+        return;
+    }
+    if (_owner) {
+        close();
+        shm_unlink(("/" + _name).c_str());
+    }
+    munmap(_mem, _mem_size);
+}
+
+bool FrameBus::map(int fd, size_t size) {
+    // MAP_POPULATE so the writer doesn't fault the arena in frame by
+    // frame
+    _mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (_mem == MAP_FAILED) {
+        perror("unable to map frame bus");
+        _mem = NULL;
+        return false;
+    }
+    _mem_size = size;
+    _header = (Header*) _mem;
+    _slots = (Slot*) ((char*) _mem + sizeof(Header));
+    return true;
+}
+
+bool FrameBus::create(const std::string& name,
+        const FrameBusLayout_t& layout, size_t arena_size) {
+    _name = name;
+    _skipped_metric = "bus." + name + ".skipped";
+    std::string path = "/" + name;
+    int fd = shm_open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror(path.c_str());
+        return false;
+    }
+    size_t table = sizeof(Header) + layout.num_slots * sizeof(Slot);
+    size_t offset = (table + PAGE_SIZE_BYTES - 1) / PAGE_SIZE_BYTES *
+        PAGE_SIZE_BYTES;
+    if (ftruncate(fd, offset + arena_size) != 0) {
+        perror("unable to size frame bus");
+        ::close(fd);
+        shm_unlink(path.c_str());
+        return false;
+    }
+    if (!map(fd, offset + arena_size)) {
+        shm_unlink(path.c_str());
+        return false;
+    }
+    _owner = true;
+
+    memset(_mem, 0, offset);
+    _header->version = BUS_FORMAT_VERSION;
+    _header->writer_pid = getpid();
+    _header->layout = layout;
+    _header->arena_offset = offset;
+    _header->arena_size = arena_size;
+    _arena = (char*) _mem + offset;
+    // Readers only accept the segment once the magic is there
+    __sync_synchronize();
+    memcpy(_header->magic, BUS_MAGIC, sizeof(BUS_MAGIC));
+    return true;
+}
+
+bool FrameBus::attach(const std::string& name) {
+    _name = name;
+    _skipped_metric = "bus." + name + ".skipped";
+    std::string path = "/" + name;
+    // Read-write: readers register on the futex in the header
+    int fd = shm_open(path.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        perror(path.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(Header)) {
+        std::cout << path << " is not a frame bus" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    if (!map(fd, st.st_size)) {
+        return false;
+    }
+
+    if (memcmp(_header->magic, BUS_MAGIC, sizeof(BUS_MAGIC)) != 0 ||
+            _header->version != BUS_FORMAT_VERSION ||
+            _header->arena_offset + _header->arena_size > _mem_size) {
+        std::cout << path << " is not a frame bus of this version" <<
+            std::endl;
+        munmap(_mem, _mem_size);
+        _mem = NULL;
+        return false;
+    }
+    _arena = (char*) _mem + _header->arena_offset;
+    return true;
+}
+
+size_t FrameBus::arenaSize() const {
+    return _header->arena_size;
+}
+
+const FrameBusLayout_t& FrameBus::layout() const {
+    return _header->layout;
+}
+
+bool FrameBus::beginWrite(int slot, unsigned long seq) {
+    int num_slots = _header->layout.num_slots;
+    if (seq == 0 || slot != (int) ((seq - 1) % num_slots)) {
+        std::cout << "frame " << seq << " written out of order to slot " <<
+            slot << std::endl;
+        return false;
+    }
+    _slots[slot].seq = 2 * (uint64_t) seq - 1;
+    // Readers must see the slot as busy before any pixel changes
+    __sync_synchronize();
+    return true;
+}
+
+void FrameBus::publish(const FrameBusFrame_t& frame) {
+    Slot& slot = _slots[frame.slot];
+    slot.last_change_seq = frame.last_change_seq;
+    slot.ip_last_change_seq = frame.ip_last_change_seq;
+    slot.capture_sec = frame.capture_time.tv_sec;
+    slot.capture_usec = frame.capture_time.tv_usec;
+    slot.timestamp = frame.timestamp;
+    __sync_synchronize();
+    slot.seq = 2 * (uint64_t) frame.seq;
+    _header->head = frame.seq;
+    // Full barrier: a reader that registered before this sees the new
+    // futex value or is woken below
+    __sync_add_and_fetch(&_header->futex, 1);
+    if (_header->waiters > 0) {
+        futex(&_header->futex, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+void FrameBus::close() {
+    _header->closed = 1;
+    __sync_add_and_fetch(&_header->futex, 1);
+    futex(&_header->futex, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+bool FrameBus::isOpen() const {
+    if (_header->closed) {
+        return false;
+    }
+    return kill(_header->writer_pid, 0) == 0 || errno == EPERM;
+}
+
+bool FrameBus::next(unsigned long after_seq, FrameBusFrame_t* frame,
+        int timeout_ms) {
+    const int num_slots = _header->layout.num_slots;
+    const unsigned long max_lag = num_slots / 2;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    for (;;) {
+        __sync_synchronize();
+        unsigned long head = _header->head;
+        if (head > after_seq) {
+            unsigned long seq = after_seq + 1;
+            if (head - seq > max_lag) {
+                globalMetrics().increment(_skipped_metric,
+                        head - max_lag - seq);
+                seq = head - max_lag;
+            }
+            const Slot& slot = _slots[(seq - 1) % num_slots];
+            uint64_t before = slot.seq;
+            __sync_synchronize();
+            frame->slot = (seq - 1) % num_slots;
+            frame->seq = seq;
+            frame->last_change_seq = slot.last_change_seq;
+            frame->ip_last_change_seq = slot.ip_last_change_seq;
+            frame->capture_time.tv_sec = slot.capture_sec;
+            frame->capture_time.tv_usec = slot.capture_usec;
+            frame->timestamp = slot.timestamp;
+            __sync_synchronize();
+            if (before == 2 * (uint64_t) seq && slot.seq == before) {
+                return true;
+            }
+            // Lapped by the writer while reading, start over from the
+            // new head
+            after_seq = seq;
+            continue;
+        }
+
+        if (!isOpen()) {
+            return false;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec left;
+        left.tv_sec = deadline.tv_sec - now.tv_sec;
+        left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (left.tv_nsec < 0) {
+            left.tv_sec--;
+            left.tv_nsec += 1000000000L;
+        }
+        if (left.tv_sec < 0) {
+            return false;
+        }
+
+        __sync_add_and_fetch(&_header->waiters, 1);
+        int32_t value = _header->futex;
+        if (_header->head <= after_seq && !_header->closed) {
+            futex(&_header->futex, FUTEX_WAIT, value, &left);
+        }
+        __sync_sub_and_fetch(&_header->waiters, 1);
+    }
+}
+
+bool FrameBus::isCurrent(int slot, unsigned long seq) const {
+    __sync_synchronize();
+    return _slots[slot].seq == 2 * (uint64_t) seq;
+}
@@ -0,0 +1,101 @@
+#ifndef FRAME_BUS_H
+#define FRAME_BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <sys/time.h>
+#include <sys/types.h>
+
+// Layout of the frame pool behind a bus, everything an attaching
+// process needs to lay out the same FramePool over the shared arena
+typedef struct FrameBusLayout {
+    int num_slots;
+    int pixel_format;
+    int frame_width;
+    int frame_height;
+    int ip_width;
+    int ip_height;
+} FrameBusLayout_t;
+
+// Frame published on a bus, as seen by a reader
+typedef struct FrameBusFrame {
+    int slot;
+    unsigned long seq;
+    unsigned long last_change_seq;
+    unsigned long ip_last_change_seq;
+    struct timeval capture_time;
+    time_t timestamp;
+} FrameBusFrame_t;
+
+// Frame buffer shared between processes. The capture process puts its
+// frame pool arena in a named POSIX shared memory segment, next to a
+// table with the sequence number of each slot; processes running the
+// processors map the same segment and read the frames in place, so
+// nothing is copied. A crash in one of them leaves capture and the
+// others running, and each can be restarted on its own.
+//
+// The writer never waits on readers. Each slot's sequence number works
+// as a seqlock: it is odd while the slot is written and twice the
+// frame's capture sequence number once it is published. Readers check
+// with isCurrent after using a frame whether it was overwritten
+// meanwhile. Readers wait for new frames on a futex in the segment,
+// which the writer only wakes when someone is waiting, so publishing
+// is a few stores and no system call.
+class FrameBus {
+    public:
+        FrameBus();
+        ~FrameBus();
+
+        // Writer: creates the segment /name with room for an arena of
+        // arena_size bytes, replacing any stale one
+        bool create(const std::string& name, const FrameBusLayout_t& layout,
+                size_t arena_size);
+        // Reader: maps the segment a writer created
+        bool attach(const std::string& name);
+
+        void* arena() const {
+            return _arena;
+        };
+        size_t arenaSize() const;
+        const FrameBusLayout_t& layout() const;
+
+        // Writer: marks slot as being written with frame seq. Frames
+        // must be written in slot order, seq s into slot
+        // (s - 1) % num_slots, which is how readers find them.
+        bool beginWrite(int slot, unsigned long seq);
+        // Writer: publishes the frame beginWrite started
+        void publish(const FrameBusFrame_t& frame);
+        // Writer: tells readers no more frames will come
+        void close();
+
+        // Reader: waits up to timeout_ms for the first frame after
+        // after_seq. A reader that fell more than half the ring behind
+        // skips ahead to stay clear of the writer. False on timeout,
+        // or once the writer closed the bus or died.
+        bool next(unsigned long after_seq, FrameBusFrame_t* frame,
+                int timeout_ms);
+        // Reader: whether slot still holds frame seq
+        bool isCurrent(int slot, unsigned long seq) const;
+        // Reader: false once the writer closed the bus or died
+        bool isOpen() const;
+
+    private:
+        struct Header;
+        struct Slot;
+
+        bool map(int fd, size_t size);
+
+        std::string _name;
+        bool _owner;
+        void* _mem;
+        size_t _mem_size;
+        Header* _header;
+        Slot* _slots;
+        void* _arena;
+
+        // Metric names, built once
+        std::string _skipped_metric;
+};
+
+#endif // FRAME_BUS_H
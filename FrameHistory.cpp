@@ -0,0 +1,211 @@
+#include "FrameHistory.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "CaptureSource.h"
+#include "Metrics.h"
+
+FrameHistory::FrameHistory(const std::string& name,
+        std::vector<VideoFrame_t>* frame_buffer,
+        Camera camera, Format format,
+        size_t budget, size_t queue_length) :
+    _name(name),
+    _frame_buffer(frame_buffer),
+    _camera(camera),
+    _format(format),
+    _quality(90),
+    _queue("history." + name, queue_length),
+    _started(false),
+    _pool(budget),
+    _head(0),
+    _bytes(0),
+    _frames_metric("history." + name + ".frames"),
+    _bytes_metric("history." + name + ".bytes"),
+    _evicted_metric("history." + name + ".evicted"),
+    _missed_metric("history." + name + ".missed") {
+    int rc = 0;
+    if( (rc = pthread_mutex_init(&_lock, NULL)) != 0) {
+        perror("mutex initialization failed in frame history constructor.");
+    }
+}
+
+FrameHistory::~FrameHistory() {
+    stop();
+    pthread_mutex_destroy(&_lock);
+}
+
+bool FrameHistory::start() {
+    if (pthread_create(&_thread, NULL, &compressThread, this)) {
+        perror("Could not create frame history thread.");
+        return false;
+    }
+    _started = true;
+    return true;
+}
+
+void FrameHistory::stop() {
+    if (!_started) {
+        return;
+    }
+    _queue.close();
+    pthread_join(_thread, NULL);
+    _started = false;
+}
+
+void FrameHistory::add(int slot, unsigned long seq) {
+    FrameToken_t token;
+    token.slot = slot;
+    token.seq = seq;
+    _queue.tryPush(token);
+}
+
+void* FrameHistory::compressThread(void* arg) {
+    ((FrameHistory*) arg)->compressLoop();
+    return NULL;
+}
+
+void FrameHistory::compressLoop() {
+    FrameToken_t token;
+    while (_queue.pop(&token)) {
+        struct timeval capture_time;
+        if (!encode(token, &capture_time)) {
+            globalMetrics().increment(_missed_metric);
+            continue;
+        }
+        store(token.seq, capture_time);
+    }
+}
+
+bool FrameHistory::encode(const FrameToken_t& token,
+        struct timeval* capture_time) {
+    VideoFrame_t& slot = (*_frame_buffer)[token.slot];
+    int rc = 0;
+    if( (rc = pthread_rwlock_rdlock(slot.rw_lock)) != 0) {
+        perror("unable to lock on frame to compress.");
+        return false;
+    }
+
+    // Encoded straight from the slot; the capture loop only gets back
+    // to it once the whole buffer has gone round
+    bool ok = (slot.seq == token.seq);
+    if (ok) {
+        *capture_time = slot.capture_time;
+        std::vector<int> params;
+        if (_format == HISTORY_LUMA) {
+            // Fastest zlib level, the pool trades size for compressor
+            // time
+            params.push_back(CV_IMWRITE_PNG_COMPRESSION);
+            params.push_back(1);
+            const cv::Mat& luma = (_camera == HISTORY_WEBCAM) ?
+                slot.frame : slot.ip_frame;
+            ok = cv::imencode(".png", luma, _encoded, params);
+        } else {
+            params.push_back(CV_IMWRITE_JPEG_QUALITY);
+            params.push_back(_quality);
+            if (_camera == HISTORY_WEBCAM) {
+                getColorFrame(slot, &_color);
+                ok = cv::imencode(".jpg", _color, _encoded, params);
+            } else {
+                // The ip frame is only ever decoded to luma
+                ok = cv::imencode(".jpg", slot.ip_frame, _encoded, params);
+            }
+        }
+    }
+
+    if( (rc = pthread_rwlock_unlock(slot.rw_lock)) != 0) {
+        perror("unable to unlock on frame to compress.");
+    }
+    return ok;
+}
+
+void FrameHistory::store(unsigned long seq,
+        const struct timeval& capture_time) {
+    size_t size = _encoded.size();
+    if (size == 0 || size > _pool.size()) {
+        globalMetrics().increment(_missed_metric);
+        return;
+    }
+
+    pthread_mutex_lock(&_lock);
+    if (_head + size > _pool.size()) {
+        // The entries between the head and the end of the pool are
+        // the oldest ones; they go first so the oldest entry stays in
+        // front
+        while (!_entries.empty() && _entries.front().offset >= _head) {
+            _bytes -= _entries.front().size;
+            _entries.pop_front();
+            globalMetrics().increment(_evicted_metric);
+        }
+        _head = 0;
+    }
+    while (!_entries.empty() && _entries.front().offset >= _head &&
+            _entries.front().offset < _head + size) {
+        _bytes -= _entries.front().size;
+        _entries.pop_front();
+        globalMetrics().increment(_evicted_metric);
+    }
+
+    memcpy(&_pool[_head], &_encoded[0], size);
+    Entry_t entry;
+    entry.seq = seq;
+    entry.capture_time = capture_time;
+    entry.offset = _head;
+    entry.size = size;
+    _entries.push_back(entry);
+    _head += size;
+    _bytes += size;
+    publishStats();
+    pthread_mutex_unlock(&_lock);
+}
+
+bool FrameHistory::get(unsigned long seq, cv::Mat* dst,
+        struct timeval* capture_time) {
+    std::vector<unsigned char> data;
+    pthread_mutex_lock(&_lock);
+    // Sequence numbers increase along the entries
+    size_t lo = 0;
+    size_t hi = _entries.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (_entries[mid].seq < seq) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    bool found = (lo < _entries.size() && _entries[lo].seq == seq);
+    if (found) {
+        const Entry_t& entry = _entries[lo];
+        data.assign(_pool.begin() + entry.offset,
+                _pool.begin() + entry.offset + entry.size);
+        if (capture_time != NULL) {
+            *capture_time = entry.capture_time;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    if (!found) {
+        return false;
+    }
+
+    // Decoded outside the lock so the compressor isn't held up
+    *dst = cv::imdecode(data, (_format == HISTORY_LUMA ||
+                _camera == HISTORY_IP) ? 0 : 1);
+    return !dst->empty();
+}
+
+bool FrameHistory::range(unsigned long* oldest, unsigned long* newest) {
+    pthread_mutex_lock(&_lock);
+    bool found = !_entries.empty();
+    if (found) {
+        *oldest = _entries.front().seq;
+        *newest = _entries.back().seq;
+    }
+    pthread_mutex_unlock(&_lock);
+    return found;
+}
+
+void FrameHistory::publishStats() {
+    globalMetrics().set(_frames_metric, _entries.size());
+    globalMetrics().set(_bytes_metric, _bytes);
+}
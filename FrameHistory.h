@@ -0,0 +1,115 @@
+#ifndef FRAME_HISTORY_H
+#define FRAME_HISTORY_H
+
+#include <opencv2/opencv.hpp>
+#include <deque>
+#include <pthread.h>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+#include "video_frame.h"
+#include "FrameQueue.h"
+
+// Compressed history of one camera behind the frame buffer. The buffer
+// only needs to hold the few frames the processors are working on; a
+// background thread compresses every frame before its slot is reused
+// into a fixed size pool, where it stays until newer frames need the
+// room. Frames are only decoded again on demand, e.g. for event
+// pre-roll. Exports history.<name>.frames and .bytes, .evicted for
+// frames pushed out of the pool, and .missed for frames whose slot was
+// reused before they could be compressed.
+class FrameHistory {
+    public:
+        enum Camera {
+            HISTORY_WEBCAM = 0,
+            HISTORY_IP
+        };
+        enum Format {
+            // Color JPEG of the webcam, gray JPEG of the ip camera
+            HISTORY_JPEG = 0,
+            // Lossless PNG of the luma plane
+            HISTORY_LUMA
+        };
+
+        // budget is the size of the pool in bytes. queue_length frames
+        // may wait for compression, which has to stay well below the
+        // frame buffer length.
+        FrameHistory(const std::string& name,
+                std::vector<VideoFrame_t>* frame_buffer,
+                Camera camera, Format format,
+                size_t budget, size_t queue_length);
+        ~FrameHistory();
+
+        bool start();
+        // Compresses what is queued and stops the thread
+        void stop();
+
+        // Queues the frame in slot for compression, called by the
+        // capture loop after releasing the slot. Never waits; the
+        // frame is dropped if the compressor is behind.
+        void add(int slot, unsigned long seq);
+
+        // Decodes frame seq, false if it isn't held
+        bool get(unsigned long seq, cv::Mat* dst,
+                struct timeval* capture_time);
+        // Oldest and newest frame held, false if there is none
+        bool range(unsigned long* oldest, unsigned long* newest);
+
+        // JPEG quality, 90 by default
+        void setQuality(int quality) {
+            _quality = quality;
+        };
+
+    private:
+        typedef struct Entry {
+            unsigned long seq;
+            struct timeval capture_time;
+            // Position of the compressed frame in _pool
+            size_t offset;
+            size_t size;
+        } Entry_t;
+
+        static void* compressThread(void* arg);
+        void compressLoop();
+        // Encodes the frame in token's slot into _encoded, false if
+        // the slot was reused
+        bool encode(const FrameToken_t& token, struct timeval* capture_time);
+        // Copies _encoded into the pool, evicting the oldest frames it
+        // overlaps
+        void store(unsigned long seq, const struct timeval& capture_time);
+        // Called with _lock held
+        void publishStats();
+
+        std::string _name;
+        std::vector<VideoFrame_t>* _frame_buffer;
+        Camera _camera;
+        Format _format;
+        int _quality;
+
+        FrameQueue _queue;
+        pthread_t _thread;
+        bool _started;
+
+        // Scratch of the compressor thread
+        cv::Mat _color;
+        std::vector<unsigned char> _encoded;
+
+        // Ring of compressed frames. Entries are in capture order and
+        // laid out in the pool in that order, wrapping to its start
+        // when a frame doesn't fit at the end.
+        std::vector<unsigned char> _pool;
+        size_t _head;
+        std::deque<Entry_t> _entries;
+        size_t _bytes;
+        // Guards the pool and the entries
+        pthread_mutex_t _lock;
+
+        // Metric names, built once
+        std::string _frames_metric;
+        std::string _bytes_metric;
+        std::string _evicted_metric;
+        std::string _missed_metric;
+};
+
+#endif // FRAME_HISTORY_H
@@ -0,0 +1,152 @@
+#include "FramePool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+const static size_t ALIGNMENT = 64;
+const static size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+FramePool::FramePool(int num_slots,
+        int pixel_format,
+        int frame_width, int frame_height,
+        int ip_width, int ip_height) :
+    _num_slots(num_slots),
+    _pixel_format(pixel_format),
+    _frame_width(frame_width),
+    _frame_height(frame_height),
+    _ip_width(ip_width),
+    _ip_height(ip_height),
+    _arena(NULL),
+    _arena_size(0),
+    _huge_pages(false),
+    _owns_arena(false) {
+    bool planar = (pixel_format == PIX_FMT_I420 ||
+            pixel_format == PIX_FMT_NV12);
+    bool packed = (pixel_format == PIX_FMT_YUYV);
+
+    _frame_step = alignedStep(frame_width);
+    _color_step = alignedStep(3 * frame_width);
+    _ip_step = alignedStep(ip_width);
+    _color_ip_step = alignedStep(3 * ip_width);
+    if (planar) {
+        _raw_step = _frame_step;
+        _raw_rows = frame_height + frame_height / 2;
+    } else if (packed) {
+        _raw_step = alignedStep(2 * frame_width);
+        _raw_rows = frame_height;
+    } else {
+        _raw_step = 0;
+        _raw_rows = 0;
+    }
+
+    size_t offset = 0;
+    _raw_offset = offset;
+    offset += _raw_step * _raw_rows;
+    // Planar frames are the Y rows of the raw plane
+    _frame_offset = planar ? _raw_offset : offset;
+    offset += planar ? 0 : _frame_step * frame_height;
+    // YUV sources convert to color on demand into the caller's buffer
+    _color_offset = offset;
+    offset += (planar || packed) ? 0 : _color_step * frame_height;
+    _ip_offset = offset;
+    offset += _ip_step * ip_height;
+    _color_ip_offset = offset;
+    offset += _color_ip_step * ip_height;
+    _slot_size = offset;
+}
+
+FramePool::~FramePool() {
+    if (_arena != NULL && _owns_arena) {
+        munmap(_arena, _arena_size);
+    }
+}
+
+size_t FramePool::alignedStep(size_t row_bytes) {
+    return (row_bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+bool FramePool::allocate() {
+    size_t size = _slot_size * _num_slots;
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages only exist if the admin reserved them
+    _arena_size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE *
+        HUGE_PAGE_SIZE;
+    _arena = mmap(NULL, _arena_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+            -1, 0);
+    if (_arena != MAP_FAILED) {
+        _huge_pages = true;
+        _owns_arena = true;
+        return true;
+    }
+#endif
+
+    // Fall back to normal pages, asking for transparent huge pages.
+    // The advice only applies to pages faulted in after it, so the
+    // arena is mapped empty, advised, and only then faulted in, now
+    // rather than on first capture.
+    _arena_size = size;
+    _arena = mmap(NULL, _arena_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (_arena == MAP_FAILED) {
+        perror("unable to allocate frame pool arena");
+        _arena = NULL;
+        _arena_size = 0;
+        return false;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(_arena, _arena_size, MADV_HUGEPAGE);
+#endif
+    bool populated = false;
+#ifdef MADV_POPULATE_WRITE
+    // Linux 5.14 and later; older kernels reject it
+    populated = madvise(_arena, _arena_size, MADV_POPULATE_WRITE) == 0;
+#endif
+    if (!populated) {
+        memset(_arena, 0, _arena_size);
+    }
+    _owns_arena = true;
+    return true;
+}
+
+void FramePool::useArena(void* arena, size_t size) {
+    _arena = arena;
+    _arena_size = size;
+    _huge_pages = false;
+    _owns_arena = false;
+}
+
+void FramePool::bindSlot(int slot_i, VideoFrame_t* slot, bool clear) {
+    uchar* base = (uchar*) _arena + slot_i * _slot_size;
+
+    slot->pixel_format = _pixel_format;
+    slot->color_valid = false;
+    // OpenCV's packed YUV conversions take two channels per pixel
+    if (_pixel_format == PIX_FMT_YUYV) {
+        slot->raw = cv::Mat(_raw_rows, _frame_width, CV_8UC2,
+                base + _raw_offset, _raw_step);
+    } else if (_raw_rows > 0) {
+        slot->raw = cv::Mat(_raw_rows, _frame_width, CV_8UC1,
+                base + _raw_offset, _raw_step);
+    }
+    slot->frame = cv::Mat(_frame_height, _frame_width, CV_8UC1,
+            base + _frame_offset, _frame_step);
+    if (_pixel_format == PIX_FMT_BGR) {
+        slot->color_frame = cv::Mat(_frame_height, _frame_width, CV_8UC3,
+                base + _color_offset, _color_step);
+    }
+    slot->ip_frame = cv::Mat(_ip_height, _ip_width, CV_8UC1,
+            base + _ip_offset, _ip_step);
+    slot->color_ip_frame = cv::Mat(_ip_height, _ip_width, CV_8UC3,
+            base + _color_ip_offset, _color_ip_step);
+
+    if (clear) {
+        if (_raw_rows > 0) {
+            slot->raw.setTo(cv::Scalar(0));
+        }
+        slot->frame.setTo(cv::Scalar(0));
+        slot->ip_frame.setTo(cv::Scalar(0));
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <opencv2/opencv.hpp>
+#include <stddef.h>
+
+#include "video_frame.h"
+
+// Owns the pixel storage of every frame buffer slot. All planes are
+// carved out of a single arena allocated up front (backed by huge pages
+// when the system has them reserved), with every row starting on a
+// 64 byte boundary for the SIMD kernels. Slots get fixed cv::Mat views
+// into the arena, so as long as captures keep the configured size and
+// type, writing a frame never touches the heap.
+//
+// The slot layout follows the capture source's pixel format: BGR
+// sources get a color plane, planar YUV sources get a raw plane whose
+// Y rows double as the frame, packed YUV gets both a raw and a frame
+// plane.
+class FramePool {
+    public:
+        FramePool(int num_slots,
+                int pixel_format,
+                int frame_width, int frame_height,
+                int ip_width, int ip_height);
+        ~FramePool();
+
+        bool allocate();
+        // Uses arena, at least requiredSize() bytes owned by the
+        // caller, instead of allocating one; e.g. a FrameBus segment
+        void useArena(void* arena, size_t size);
+        size_t requiredSize() const {
+            return _slot_size * _num_slots;
+        };
+        // Points the slot's Mats at its storage in the arena. Processes
+        // attached to an arena another one writes don't clear it.
+        void bindSlot(int slot_i, VideoFrame_t* slot, bool clear = true);
+
+        void* arena() const {
+            return _arena;
+        };
+        size_t arenaSize() const {
+            return _arena_size;
+        };
+        bool usesHugePages() const {
+            return _huge_pages;
+        };
+
+    private:
+        // Row stride rounded up to the alignment
+        static size_t alignedStep(size_t row_bytes);
+
+        int _num_slots;
+        int _pixel_format;
+        int _frame_width;
+        int _frame_height;
+        int _ip_width;
+        int _ip_height;
+
+        // Row strides and byte offsets of each plane within a slot.
+        // Offsets of planes a format doesn't use are unused.
+        size_t _frame_step;
+        size_t _raw_step;
+        size_t _raw_rows;
+        size_t _color_step;
+        size_t _ip_step;
+        size_t _color_ip_step;
+        size_t _frame_offset;
+        size_t _raw_offset;
+        size_t _color_offset;
+        size_t _ip_offset;
+        size_t _color_ip_offset;
+        size_t _slot_size;
+
+        void* _arena;
+        size_t _arena_size;
+        bool _huge_pages;
+        // Whether _arena was mapped by allocate
+        bool _owns_arena;
+};
+
+#endif // FRAME_POOL_H
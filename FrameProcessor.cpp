@@ -1,6 +1,10 @@
 #include "FrameProcessor.h"
+#include "FrameBus.h"
 
 bool FrameProcessor::runInThread() {
+    if (_in_queue != NULL) {
+        return runPipelined();
+    }
 
     // TODO: add some means of signaling thread to exit 
     // Loop 
@@ -71,6 +75,7 @@ bool FrameProcessor::runInThread() {
                 inc_cur_frame = true;
                 process_frame = true;
                 processFrame();
+                reportLatency(frame_1);
             }
 
             if( (rc1 = pthread_rwlock_unlock(frame_1.rw_lock)) > 0) {
@@ -97,39 +102,128 @@ bool FrameProcessor::runInThread() {
     return false;
 }
 
-// TODO: do all frame processors need a means to get a background
-// only background frame processors. 
-// Host is responsible for locking on bgd_dest
-// TODO rework such that there is potentially one bgd frame shared 
-// by all? not sure if this makes more sense?
-bool FrameProcessor::getBgd(cv::Mat* bgd_dest) {
+// Pipeline stage loop. Only the token's slot is read locked while
+// processFrame runs. The first stage pins the store's bgd to the token
+// after processing, so the frame carries the bgd that includes its
+// own update; later stages see that one through getBgd. Closing the
+// input queue ends the stage, which then closes its output queue so
+// the shutdown drains down the pipeline.
+bool FrameProcessor::runPipelined() {
     int rc = 0;
-    if ( (rc = pthread_rwlock_rdlock(&_bgd_lock)) != 0) {
-        perror("unable to obtain read lock in getBgd");
+    FrameToken_t token;
+    while (_in_queue->pop(&token)) {
+        VideoFrame_t& frame = (*_frame_buffer)[token.slot];
+        if( (rc = pthread_rwlock_rdlock(frame.rw_lock)) > 0) {
+            perror("Unable to acquire read lock in pipeline stage");
+            return false;
+        }
+
+        // The capture loop got around the buffer to this slot again,
+        // which only happens if the queues hold more frames than the
+        // buffer has slots
+        _cur_frame_i = token.slot;
+        _cur_seq = token.seq;
+        bool current = (frame.seq == token.seq) && frameIntact();
+        if (current) {
+            if (token.bgd_pinned) {
+                _bgd_pinned = true;
+                _pinned_bgd = token.bgd;
+                _pinned_thresh = token.thresh;
+                _pinned_bgd_version = token.bgd_version;
+            }
+            processFrame();
+            // On a bus the writer may have overwritten the slot while
+            // the frame was processed, so what was read of it is torn
+            if (!frameIntact()) {
+                globalMetrics().increment("bus.torn_frames");
+                discardFrame();
+                current = false;
+            } else {
+                reportLatency(frame);
+                if (!token.bgd_pinned && _bgd_store != NULL) {
+                    _bgd_store->get(&token.bgd, &token.thresh,
+                            &token.bgd_version);
+                    token.bgd_pinned = true;
+                }
+            }
+        } else {
+            globalMetrics().increment("pipeline.stale_frames");
+        }
+        _bgd_pinned = false;
+        _pinned_bgd.release();
+        _pinned_thresh.release();
+
+        if( (rc = pthread_rwlock_unlock(frame.rw_lock)) > 0) {
+            perror("Unable to release read lock in pipeline stage");
+            return false;
+        }
+
+        if (current && _out_queue != NULL) {
+            _out_queue->push(token);
+        }
     }
-
-    _bgd.copyTo(*bgd_dest);
-
-    if ( (rc = pthread_rwlock_unlock(&_bgd_lock)) != 0) {
-        perror("unable to release read lock in getBgd");
+    if (_out_queue != NULL) {
+        _out_queue->close();
     }
     return true;
 }
 
-// Set the bgd to the frame provided as an argument
-bool FrameProcessor::setBgd(const cv::Mat& bgd) {
-    if(pthread_rwlock_wrlock(&_bgd_lock) != 0) {
-        perror("could not obtain bgd write lock to set bgd");
-        return false;
-    } 
+bool FrameProcessor::frameIntact() const {
+    return _frame_bus == NULL ||
+        _frame_bus->isCurrent(_cur_frame_i, _cur_seq);
+}
 
-    bgd.copyTo(_bgd);
-    std::cout << "New bgd set" << std::endl;
+bool FrameProcessor::getBgd(cv::Mat* bgd, unsigned int* version) {
+    return getBgd(bgd, NULL, version);
+}
 
-    if(pthread_rwlock_unlock(&_bgd_lock) != 0) {
-        perror("could not release write lock to set bgd");
+bool FrameProcessor::getBgd(cv::Mat* bgd, cv::Mat* thresh,
+        unsigned int* version) {
+    if (_bgd_pinned) {
+        *bgd = _pinned_bgd;
+        if (thresh != NULL) {
+            *thresh = _pinned_thresh;
+        }
+        if (version != NULL) {
+            *version = _pinned_bgd_version;
+        }
+        return true;
+    }
+    if (_bgd_store == NULL) {
+        std::cout << "frame processor has no background store" << std::endl;
         return false;
-    } 
-    return true;
+    }
+    return _bgd_store->get(bgd, thresh, version);
 }
 
+unsigned int FrameProcessor::getBgdVersion() {
+    return (_bgd_store != NULL) ? _bgd_store->version() : 0;
+}
+
+void FrameProcessor::recordFrame(const std::string& name, bool skipped) {
+    _frames_seen++;
+    if (skipped) {
+        _frames_skipped++;
+    }
+    Metrics& metrics = globalMetrics();
+    metrics.increment(name + ".frames");
+    if (skipped) {
+        metrics.increment(name + ".skipped");
+    }
+    metrics.set(name + ".skip_rate", 
+            (double) _frames_skipped / _frames_seen);
+}
+
+// Publishes the frame provided as an argument as the new bgd for all
+// processors sharing the store
+bool FrameProcessor::setBgd(const cv::Mat& bgd) {
+    return setBgd(bgd, cv::Mat());
+}
+
+bool FrameProcessor::setBgd(const cv::Mat& bgd, const cv::Mat& thresh) {
+    if (_bgd_store == NULL) {
+        std::cout << "frame processor has no background store" << std::endl;
+        return false;
+    }
+    return _bgd_store->set(bgd, thresh);
+}
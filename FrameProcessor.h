@@ -5,6 +5,13 @@
 #include <vector>
 
 #include "video_frame.h"
+#include "BackgroundStore.h"
+#include "FrameQueue.h"
+#include "DisplayCompositor.h"
+#include "Metrics.h"
+#include "LoadShedder.h"
+
+class FrameBus;
 
 class FrameProcessor {
     public:
@@ -16,25 +23,70 @@ class FrameProcessor {
             _buffer_length(buffer_length),
             _frame_width(frame_width),
             _frame_height(frame_height),
-            _bgd(cv::Mat(frame_height, 
-                        frame_width, 
-                        CV_8UC1, 
-                        cv::Scalar(0))), 
-            _cur_frame_i(0) {
-                int rc = 0;
-                if( (rc = pthread_rwlock_init(&_bgd_lock, NULL)) != 0) {
-                    perror("rwlock initialization failed in FrameProcessor constructor.");
-                }
-            }; 
-
-        ~FrameProcessor() {
-            pthread_rwlock_destroy(&_bgd_lock);
-        };
+            _cur_frame_i(0),
+            _bgd_store(NULL),
+            _compositor(NULL),
+            _in_queue(NULL),
+            _out_queue(NULL),
+            _bgd_pinned(false),
+            _pinned_bgd_version(0),
+            _load_shedder(NULL),
+            _shed_stage(LoadShedder::STAGE_BGD),
+            _frames_seen(0),
+            _frames_skipped(0),
+            _frame_bus(NULL),
+            _cur_seq(0) {}; 
+
+        virtual ~FrameProcessor() {};
 
         virtual bool runInThread();
         virtual bool processFrame() = 0;
-        bool getBgd(cv::Mat* bgd_buffer);
+        // Runs the processor as a pipeline stage: frames come from in
+        // rather than from scanning the frame buffer, and go on to out
+        // (NULL for the last stage) once processed. Must be set before
+        // the processor is started.
+        void setPipelineQueues(FrameQueue* in, FrameQueue* out) {
+            _in_queue = in;
+            _out_queue = out;
+        };
+        // Shares the current bgd, read only; see BackgroundStore::get.
+        // In a pipeline this is the bgd pinned to the frame being
+        // processed.
+        bool getBgd(cv::Mat* bgd, unsigned int* version = NULL);
+        // Also shares the bgd's per pixel threshold, empty if it has
+        // none
+        bool getBgd(cv::Mat* bgd, cv::Mat* thresh, unsigned int* version);
         bool setBgd(const cv::Mat& bgd);
+        bool setBgd(const cv::Mat& bgd, const cv::Mat& thresh);
+        // Incremented on every setBgd by any processor sharing the store
+        unsigned int getBgdVersion();
+        // Background shared with the other processors, must be set
+        // before the processor is started
+        void setBackgroundStore(BackgroundStore* bgd_store) {
+            _bgd_store = bgd_store;
+        };
+        // Compositor to write display snapshots into, NULL when
+        // running headless
+        void setCompositor(DisplayCompositor* compositor) {
+            _compositor = compositor;
+        };
+        // Controller the processor reports its latency to as stage and
+        // takes its quality level from, NULL to always run at full
+        // quality. Must be set before the processor is started.
+        void setLoadShedder(LoadShedder* load_shedder,
+                LoadShedder::Stage stage) {
+            _load_shedder = load_shedder;
+            _shed_stage = stage;
+        };
+        // Bus the frame buffer's pixels are read from in place, NULL
+        // when capture fills the buffer in this process. The writer
+        // does not wait for readers, so a frame overwritten while a
+        // stage processed it is dropped from the pipeline and the
+        // stage's discardFrame is called. Must be set before the
+        // processor is started.
+        void setFrameBus(const FrameBus* frame_bus) {
+            _frame_bus = frame_bus;
+        };
     protected:
         // Buffer of video frames that are being updated by the main thread
         std::vector<VideoFrame_t>* _frame_buffer;
@@ -43,13 +95,54 @@ class FrameProcessor {
         // Width and height of frames in the buffer
         int _frame_width;
         int _frame_height;
-        // Frame with the bgd data
-        cv::Mat _bgd;
-        // RW lock for the bgd to ensure concurrency between processing
-        // new frames into the bgd and asking for the bgd
-        pthread_rwlock_t _bgd_lock;
         // Index of the current frame being processed by the capturer
         // within the videoframe buffer
         int _cur_frame_i;
+        BackgroundStore* _bgd_store;
+        DisplayCompositor* _compositor;
+
+        // Stage loop of runInThread when queues are set
+        bool runPipelined();
+        FrameQueue* _in_queue;
+        FrameQueue* _out_queue;
+        // Bgd of the frame token being processed, returned by getBgd
+        // instead of the store's current one
+        bool _bgd_pinned;
+        cv::Mat _pinned_bgd;
+        cv::Mat _pinned_thresh;
+        unsigned int _pinned_bgd_version;
+
+        // Load shedding level to process the current frame at, see
+        // LoadShedder::Level
+        int shedLevel() const {
+            return (_load_shedder != NULL) ?
+                _load_shedder->level() : LoadShedder::SHED_NONE;
+        };
+        // Reports the latency of the frame just processed
+        void reportLatency(const VideoFrame_t& frame) {
+            if (_load_shedder != NULL) {
+                _load_shedder->report(_shed_stage, frame.capture_time);
+            }
+        };
+        LoadShedder* _load_shedder;
+        LoadShedder::Stage _shed_stage;
+
+        // Counts a frame under name.frames / name.skipped and publishes
+        // name.skip_rate
+        void recordFrame(const std::string& name, bool skipped);
+        long _frames_seen;
+        long _frames_skipped;
+
+        // Whether the current frame's pixels are still the ones it was
+        // captured with, always true without a bus. Stages that keep
+        // what they read, or act on it, check this first.
+        bool frameIntact() const;
+        // Called in place of forwarding a frame that was overwritten on
+        // the bus while processFrame ran; undoes what processFrame kept
+        // of it
+        virtual void discardFrame() {};
+        const FrameBus* _frame_bus;
+        // Sequence number of the frame being processed
+        unsigned long _cur_seq;
 };
 #endif
@@ -0,0 +1,99 @@
+#include "FrameQueue.h"
+#include "Metrics.h"
+
+#include <stdio.h>
+
+FrameQueue::FrameQueue(const std::string& name, size_t capacity) :
+    _capacity(capacity),
+    _max_depth(0),
+    _closed(false),
+    _depth_metric("pipeline." + name + ".depth"),
+    _max_depth_metric("pipeline." + name + ".max_depth"),
+    _dropped_metric("pipeline." + name + ".dropped") {
+    int rc = 0;
+    if( (rc = pthread_mutex_init(&_lock, NULL)) != 0) {
+        perror("mutex initialization failed in frame queue constructor.");
+    }
+    if( (rc = pthread_cond_init(&_not_empty, NULL)) != 0) {
+        perror("cond initialization failed in frame queue constructor.");
+    }
+    if( (rc = pthread_cond_init(&_not_full, NULL)) != 0) {
+        perror("cond initialization failed in frame queue constructor.");
+    }
+}
+
+FrameQueue::~FrameQueue() {
+    pthread_cond_destroy(&_not_full);
+    pthread_cond_destroy(&_not_empty);
+    pthread_mutex_destroy(&_lock);
+}
+
+bool FrameQueue::push(const FrameToken_t& token) {
+    pthread_mutex_lock(&_lock);
+    while (!_closed && _tokens.size() >= _capacity) {
+        pthread_cond_wait(&_not_full, &_lock);
+    }
+    if (_closed) {
+        pthread_mutex_unlock(&_lock);
+        return false;
+    }
+    _tokens.push_back(token);
+    publishDepth();
+    pthread_cond_signal(&_not_empty);
+    pthread_mutex_unlock(&_lock);
+    return true;
+}
+
+bool FrameQueue::tryPush(const FrameToken_t& token) {
+    pthread_mutex_lock(&_lock);
+    if (_closed || _tokens.size() >= _capacity) {
+        pthread_mutex_unlock(&_lock);
+        globalMetrics().increment(_dropped_metric);
+        return false;
+    }
+    _tokens.push_back(token);
+    publishDepth();
+    pthread_cond_signal(&_not_empty);
+    pthread_mutex_unlock(&_lock);
+    return true;
+}
+
+bool FrameQueue::pop(FrameToken_t* token) {
+    pthread_mutex_lock(&_lock);
+    while (!_closed && _tokens.empty()) {
+        pthread_cond_wait(&_not_empty, &_lock);
+    }
+    if (_tokens.empty()) {
+        pthread_mutex_unlock(&_lock);
+        return false;
+    }
+    *token = _tokens.front();
+    _tokens.pop_front();
+    publishDepth();
+    pthread_cond_signal(&_not_full);
+    pthread_mutex_unlock(&_lock);
+    return true;
+}
+
+void FrameQueue::close() {
+    pthread_mutex_lock(&_lock);
+    _closed = true;
+    pthread_cond_broadcast(&_not_empty);
+    pthread_cond_broadcast(&_not_full);
+    pthread_mutex_unlock(&_lock);
+}
+
+size_t FrameQueue::depth() {
+    pthread_mutex_lock(&_lock);
+    size_t depth = _tokens.size();
+    pthread_mutex_unlock(&_lock);
+    return depth;
+}
+
+void FrameQueue::publishDepth() {
+    if (_tokens.size() > _max_depth) {
+        _max_depth = _tokens.size();
+        globalMetrics().set(_max_depth_metric, _max_depth);
+    }
+    globalMetrics().set(_depth_metric, _tokens.size());
+}
@@ -0,0 +1,68 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <opencv2/opencv.hpp>
+#include <deque>
+#include <pthread.h>
+#include <string>
+
+// A frame handed from one pipeline stage to the next. The slot is
+// identified by index and capture sequence number, so a stage can tell
+// if the capture loop reused it in the meantime. The first stage pins
+// the bgd it left the frame with; every later stage works against that
+// same version, whatever has been published since.
+typedef struct FrameToken {
+    FrameToken() :
+        slot(0),
+        seq(0),
+        bgd_pinned(false),
+        bgd_version(0) {};
+
+    int slot;
+    unsigned long seq;
+    bool bgd_pinned;
+    // Shared, read only headers, see BackgroundStore::get
+    cv::Mat bgd;
+    cv::Mat thresh;
+    unsigned int bgd_version;
+} FrameToken_t;
+
+// Bounded FIFO of frame tokens between two pipeline stages. Exports
+// pipeline.<name>.depth and .max_depth, and .dropped for tokens
+// refused by tryPush.
+class FrameQueue {
+    public:
+        FrameQueue(const std::string& name, size_t capacity);
+        ~FrameQueue();
+
+        // Waits for room; false if the queue was closed
+        bool push(const FrameToken_t& token);
+        // Drops the token and returns false when the queue is full,
+        // for the capture loop, which must not wait on the stages
+        bool tryPush(const FrameToken_t& token);
+        // Waits for a token; false once the queue is closed and drained
+        bool pop(FrameToken_t* token);
+        // Wakes everyone up; pushes fail from now on and pops once the
+        // remaining tokens are gone
+        void close();
+        size_t depth();
+
+    private:
+        // Called with _lock held
+        void publishDepth();
+
+        std::deque<FrameToken_t> _tokens;
+        size_t _capacity;
+        size_t _max_depth;
+        bool _closed;
+        // Metric names, built once
+        std::string _depth_metric;
+        std::string _max_depth_metric;
+        std::string _dropped_metric;
+
+        pthread_mutex_t _lock;
+        pthread_cond_t _not_empty;
+        pthread_cond_t _not_full;
+};
+
+#endif // FRAME_QUEUE_H
@@ -22,120 +22,107 @@ using namespace cv;
 // When process frame is called, this thread holds rd locks on
 // _cur_frame_i and _cur_frame_i + 1
 bool IPCamProcessor::processFrame() {
-    cv::Mat img_1 = (*_frame_buffer)[_cur_frame_i].color_frame;
-    cv::Mat img_2 = (*_frame_buffer)[_cur_frame_i].color_ip_frame;
-
-    // annotate pair with feature point matches and convert to
-    // grayscale
-    //-- Step 1: Detect the keypoints using SURF Detector
-    int minHessian = 400;
-
-    SurfFeatureDetector detector( minHessian );
-
-    std::vector<KeyPoint> keypoints_1, keypoints_2;
-
-    detector.detect( img_1, keypoints_1 );
-    detector.detect( img_2, keypoints_2 );
-
-    //-- Step 2: Calculate descriptors (feature vectors)
-    SurfDescriptorExtractor extractor;
-
-    Mat descriptors_1, descriptors_2;
-
-    extractor.compute( img_1, keypoints_1, descriptors_1 );
-    extractor.compute( img_2, keypoints_2, descriptors_2 );
-
-    //-- Step 3: Matching descriptor vectors using FLANN matcher
-    FlannBasedMatcher matcher;
-    std::vector< DMatch > matches;
-    matcher.match( descriptors_1, descriptors_2, matches );
-
-    double max_dist = 0; double min_dist = 100;
-
-    //-- Quick calculation of max and min distances between keypoints
-    for( int i = 0; i < descriptors_1.rows; i++ )
-    { double dist = matches[i].distance;
-        if( dist < min_dist ) min_dist = dist;
-        if( dist > max_dist ) max_dist = dist;
+    VideoFrame_t& this_frame = (*_frame_buffer)[_cur_frame_i];
+    int shed_level = shedLevel();
+    // Correlation is the first thing given up entirely under load; the
+    // target is found with SURF again once it resumes
+    if (shed_level >= LoadShedder::SHED_IPCAM_PAUSE) {
+        _have_result = false;
+        _tracking = false;
+        recordFrame("ipcam", true);
+        globalMetrics().increment("ipcam.paused_frames");
+        return true;
     }
-
-    // printf("-- Max dist : %f \n", max_dist );
-    // printf("-- Min dist : %f \n", min_dist );
-
-    //-- Draw only "good" matches (i.e. whose distance is less than 2*min_dist )
-    //-- PS.- radiusMatch can also be used here.
-    std::vector< DMatch > good_matches;
-
-    for( int i = 0; i < descriptors_1.rows; i++ )
-    { if( matches[i].distance < 2.5*min_dist )
-        { good_matches.push_back( matches[i]); }
+    // Neither camera saw a change since the last matched pair, so the
+    // matches and the annotated pair would come out the same
+    if (_have_result &&
+            this_frame.last_change_seq <= _result_seq &&
+            this_frame.ip_last_change_seq <= _result_seq) {
+        recordFrame("ipcam", true);
+        return true;
     }
-
-    //-- Draw only "good" matches
-    Mat img_matches;
-    drawMatches( img_1, keypoints_1, img_2, keypoints_2,
-            good_matches, img_matches, Scalar::all(-1), Scalar::all(-1),
-            vector<char>(), DrawMatchesFlags::NOT_DRAW_SINGLE_POINTS );
-
-    cvtColor(img_matches, img_matches, CV_BGR2GRAY);
-  
-   /* 
-    //-- Localize the object
-    std::vector<Point2f> obj;
-    std::vector<Point2f> scene;
-
-    for( int i = 0; i < good_matches.size(); i++ ) {
-        //-- Get the keypoints from the good matches
-        obj.push_back( keypoints_1[ good_matches[i].queryIdx ].pt );
-        scene.push_back( keypoints_2[ good_matches[i].trainIdx ].pt );
+    recordFrame("ipcam", false);
+    _have_result = true;
+    _result_seq = this_frame.seq;
+
+    cv::Mat img_1 = (*_frame_buffer)[_cur_frame_i].frame;
+    cv::Mat img_2 = (*_frame_buffer)[_cur_frame_i].ip_frame;
+
+    // Steer toward the tracked target only, rather than toward
+    // whichever blob happens to come last
+    BlobTrack_t target;
+    unsigned long detection_seq = 0;
+    bool have_target = _motion_loc_blob_thresh->getTargetTrack(&target,
+            &detection_seq);
+    // A coasting target's bbox follows the prediction and can run off
+    // the frame; keep only the part inside, and let the target go once
+    // nothing is left
+    if (have_target) {
+        target.bbox &= cv::Rect(0, 0, _frame_width, _frame_height);
+        if (target.bbox.area() == 0) {
+            have_target = false;
+            globalMetrics().increment("ipcam.target_left_frame");
+        }
+    }
+    // Blob labels restart with every detection, so the target's label
+    // and the label image only name blobs of this frame when motion ran
+    // its last full detection on it; motion may be ahead by the queue
+    // depth or have skipped this frame
+    if (detection_seq != this_frame.seq) {
+        detection_seq = 0;
     }
 
-    if (good_matches.size() > 3) {
-        _H = findHomography( obj, scene, CV_RANSAC );    
-    } */
-
-    // getting access to motion blobs in right location 
-    cvb::CvBlobs motion_blobs; 
-    _motion_loc_blob_thresh->getLastMotionBlobs(&motion_blobs);
+    // Once SURF has located the target in the ip frame, follow it there
+    // with the much cheaper template match; SURF runs again when the
+    // match is lost, the camera moved or the refresh interval is up
+    cv::Mat img_matches;
+    cv::Point ip_pt;
+    bool located = false;
+    int refresh_interval = (shed_level >= LoadShedder::SHED_SURF_RATE) ?
+        _shed_refresh_factor * _refresh_interval : _refresh_interval;
+    // The template belongs to one track; when that track died or
+    // another one became the target it shows the wrong object
+    if (!have_target || target.id != _track_id) {
+        _tracking = false;
+    }
+    if (_tracking &&
+            _frames_since_refresh < refresh_interval &&
+            trackTemplate(img_2, &ip_pt)) {
+        located = true;
+        _frames_since_refresh++;
+        globalMetrics().increment("ipcam.template_frames");
+        drawPair(img_1, img_2, &img_matches);
+    } else {
+        _tracking = false;
+        located = matchFeatures(img_1, img_2,
+                have_target ? &target : NULL, detection_seq, &ip_pt,
+                &img_matches);
+        globalMetrics().increment("ipcam.surf_frames");
+        if (located && have_target) {
+            startTracking(img_2, ip_pt, target.id);
+        }
+    }
+    // A frame capture overwrote meanwhile must not steer the camera;
+    // the pipeline drops it and discardFrame undoes the rest
+    if (!frameIntact()) {
+        return true;
+    }
 
     int minx = 0;
     int miny = 0;
     int maxx = 0;
     int maxy = 0;
 
-    for (cvb::CvBlobs::const_iterator it=motion_blobs.begin(); it!=motion_blobs.end(); ++it)
+    if (have_target)
     {
-        //std::cout << "Blob #" << it->second->label << 
-        //    ": Area=" << it->second->area << std::endl;
-        minx = (int) it->second->minx;
-        miny = (int) it->second->miny;
-        maxx = (int) it->second->maxx;
-        maxy = (int) it->second->maxy;
+        minx = target.bbox.x;
+        miny = target.bbox.y;
+        maxx = target.bbox.x + target.bbox.width - 1;
+        maxy = target.bbox.y + target.bbox.height - 1;
         
-        int ip_centerx = 0;
-        int ip_centery = 0;
-
-        int count = 0; 
-       
-       // Iterate over good matches and take the locations of the ones 
-       // look up their location in the ip camera frame 
-        for (int i = 0; i < good_matches.size(); i++) {
-            int img_idx_1 = good_matches[i].queryIdx;
-            cv::Point frame_pt =  keypoints_1[img_idx_1].pt;
-       
-            if(frame_pt.x > minx && frame_pt.x < maxx &&
-                    frame_pt.y > miny && frame_pt.y < maxy) {
-                count++;
-                int img_idx_2 = good_matches[i].trainIdx;
-                cv::Point ip_frame_pt =  keypoints_2[img_idx_2].pt;
-
-                ip_centerx += ip_frame_pt.x;
-                ip_centery += ip_frame_pt.y;
-            }
-        }
-        if (count > 0)  {
-            ip_centerx = ip_centerx/count;
-            ip_centery = ip_centery/count;
+        if (located)  {
+            int ip_centerx = ip_pt.x;
+            int ip_centery = ip_pt.y;
             if (ip_centerx > _ip_center_x) 
                 _ip_center_x = min(_ip_center_x + _ip_center_step, ip_centerx);
             else
@@ -154,7 +141,8 @@ bool IPCamProcessor::processFrame() {
 
 // http://192.168.2.30/cgi-bin/camctrl/camctrl.cgi?&move=home
         // Want to move camera to re center
-        if (abs(_ip_center_x - _frame_width/2) > _ip_radius && _ip_moving_x_ctr == 0) {
+        if (_ptz_control &&
+                abs(_ip_center_x - _frame_width/2) > _ip_radius && _ip_moving_x_ctr == 0) {
             cURLpp::Easy myRequest;
             std::stringstream result;
             if(_ip_center_x - _frame_width/2 < 0) {
@@ -168,8 +156,11 @@ bool IPCamProcessor::processFrame() {
             myRequest.setOpt(cURLpp::Options::WriteStream(&result));
             myRequest.perform();                    
             _ip_moving_x_ctr = _ip_ctr;
+            // The view shifts, so the template's location is stale
+            _tracking = false;
 
-        } else if (abs(_ip_center_y - _frame_height/2) > _ip_radius && _ip_moving_y_ctr == 0) {
+        } else if (_ptz_control &&
+                abs(_ip_center_y - _frame_height/2) > _ip_radius && _ip_moving_y_ctr == 0) {
             cURLpp::Easy myRequest;
             std::stringstream result;
             if(_ip_center_y - _frame_height/2 < 0) {
@@ -182,6 +173,7 @@ bool IPCamProcessor::processFrame() {
             myRequest.setOpt(cURLpp::Options::WriteStream(&result));
             myRequest.perform();                    
             _ip_moving_y_ctr = _ip_ctr;
+            _tracking = false;
         }
         
         cv::circle(img_matches, cv::Point(_ip_center_x + _frame_width,
@@ -201,13 +193,250 @@ bool IPCamProcessor::processFrame() {
     }
 
     img_matches.copyTo(_last_pair);
+    if (_compositor != NULL) {
+        _compositor->writePanel(DisplayCompositor::PANEL_PAIR, img_matches);
+    }
+
+    if( (rc = pthread_rwlock_unlock(&_last_pair_lock)) != 0) {
+        perror("unable to unlock on last pair.");
+    }
+    return true;
+}
+
+void IPCamProcessor::discardFrame() {
+    _have_result = false;
+    _tracking = false;
+    int rc = 0;
+    if( (rc = pthread_rwlock_wrlock(&_last_pair_lock)) != 0) {
+        perror("unable to lock on last pair.");
+    }
+    _blob_ip_pts.clear();
+    if( (rc = pthread_rwlock_unlock(&_last_pair_lock)) != 0) {
+        perror("unable to unlock on last pair.");
+    }
+}
+
+bool IPCamProcessor::getBlobCorrespondences(
+        std::map<cvb::CvLabel, cv::Point>* ip_pts) {
+    int rc = 0;
+    if( (rc = pthread_rwlock_rdlock(&_last_pair_lock)) != 0) {
+        perror("unable to lock on last pair.");
+    }
+    *ip_pts = _blob_ip_pts;
+    if( (rc = pthread_rwlock_unlock(&_last_pair_lock)) != 0) {
+        perror("unable to unlock on last pair.");
+    }
+    return true;
+}
+
+// Runs SURF on both frames and matches the descriptors with FLANN
+bool IPCamProcessor::matchFeatures(const cv::Mat& frame,
+        const cv::Mat& ip_frame, const BlobTrack_t* target,
+        unsigned long detection_seq, cv::Point* ip_pt, cv::Mat* pair) {
+    // annotate pair with feature point matches and convert to
+    // grayscale
+    //-- Step 1: Detect the keypoints using SURF Detector
+    int minHessian = 400;
+
+    SurfFeatureDetector detector( minHessian );
+
+    std::vector<KeyPoint> keypoints_1, keypoints_2;
+
+    detector.detect( frame, keypoints_1 );
+    detector.detect( ip_frame, keypoints_2 );
+
+    //-- Step 2: Calculate descriptors (feature vectors)
+    SurfDescriptorExtractor extractor;
+
+    Mat descriptors_1, descriptors_2;
+
+    extractor.compute( frame, keypoints_1, descriptors_1 );
+    extractor.compute( ip_frame, keypoints_2, descriptors_2 );
+
+    //-- Step 3: Matching descriptor vectors using FLANN matcher
+    FlannBasedMatcher matcher;
+    std::vector< DMatch > matches;
+    matcher.match( descriptors_1, descriptors_2, matches );
+
+    double max_dist = 0; double min_dist = 100;
+
+    //-- Quick calculation of max and min distances between keypoints
+    for( int i = 0; i < descriptors_1.rows; i++ )
+    { double dist = matches[i].distance;
+        if( dist < min_dist ) min_dist = dist;
+        if( dist > max_dist ) max_dist = dist;
+    }
+
+    // printf("-- Max dist : %f \n", max_dist );
+    // printf("-- Min dist : %f \n", min_dist );
+
+    //-- Draw only "good" matches (i.e. whose distance is less than 2*min_dist )
+    //-- PS.- radiusMatch can also be used here.
+    std::vector< DMatch > good_matches;
+
+    for( int i = 0; i < descriptors_1.rows; i++ )
+    { if( matches[i].distance < 2.5*min_dist )
+        { good_matches.push_back( matches[i]); }
+    }
+
+    //-- Draw only "good" matches
+    drawMatches( frame, keypoints_1, ip_frame, keypoints_2,
+            good_matches, *pair, Scalar::all(-1), Scalar::all(-1),
+            vector<char>(), DrawMatchesFlags::NOT_DRAW_SINGLE_POINTS );
+
+    cvtColor(*pair, *pair, CV_BGR2GRAY);
+  
+   /* 
+    //-- Localize the object
+    std::vector<Point2f> obj;
+    std::vector<Point2f> scene;
+
+    for( int i = 0; i < good_matches.size(); i++ ) {
+        //-- Get the keypoints from the good matches
+        obj.push_back( keypoints_1[ good_matches[i].queryIdx ].pt );
+        scene.push_back( keypoints_2[ good_matches[i].trainIdx ].pt );
+    }
+
+    if (good_matches.size() > 3) {
+        _H = findHomography( obj, scene, CV_RANSAC );    
+    } */
+
+    // Bucket the good matches by the motion blob under their webcam
+    // keypoint, one label lookup each. Without a detection on this
+    // frame, or once motion replaced it, no match has a blob.
+    std::vector<cv::Point2f> frame_pts(good_matches.size());
+    for (size_t i = 0; i < good_matches.size(); i++) {
+        frame_pts[i] = keypoints_1[good_matches[i].queryIdx].pt;
+    }
+    std::vector<cvb::CvLabel> labels;
+    bool bucketed = _motion_loc_blob_thresh->labelsAt(frame_pts,
+            detection_seq, &labels);
+
+    std::map<cvb::CvLabel, cv::Point2f> sums;
+    std::map<cvb::CvLabel, int> counts;
+    for (size_t i = 0; i < good_matches.size(); i++) {
+        if (labels[i] == 0) {
+            continue;
+        }
+        sums[labels[i]] += keypoints_2[good_matches[i].trainIdx].pt;
+        counts[labels[i]]++;
+    }
+    std::map<cvb::CvLabel, cv::Point> blob_ip_pts;
+    for (std::map<cvb::CvLabel, int>::const_iterator it = counts.begin();
+            it != counts.end(); ++it) {
+        cv::Point2f sum = sums[it->first];
+        blob_ip_pts[it->first] = cv::Point(sum.x / it->second,
+                sum.y / it->second);
+    }
 
+    int rc = 0;
+    if( (rc = pthread_rwlock_wrlock(&_last_pair_lock)) != 0) {
+        perror("unable to lock on last pair.");
+    }
+    _blob_ip_pts = blob_ip_pts;
     if( (rc = pthread_rwlock_unlock(&_last_pair_lock)) != 0) {
         perror("unable to unlock on last pair.");
     }
+
+    if (target == NULL) {
+        return false;
+    }
+    std::map<cvb::CvLabel, cv::Point>::const_iterator found =
+        blob_ip_pts.find(target->label);
+    if (bucketed && target->label != 0 && found != blob_ip_pts.end()) {
+        *ip_pt = found->second;
+        return true;
+    }
+
+    // The target has no blob in a label image of this frame (it was
+    // only confirmed inside its predicted bbox, or detected on another
+    // frame), so fall back to the matches inside its bbox
+    int minx = target->bbox.x;
+    int miny = target->bbox.y;
+    int maxx = target->bbox.x + target->bbox.width - 1;
+    int maxy = target->bbox.y + target->bbox.height - 1;
+
+    int ip_centerx = 0;
+    int ip_centery = 0;
+
+    int count = 0; 
+
+    for (int i = 0; i < good_matches.size(); i++) {
+        cv::Point frame_pt = frame_pts[i];
+       
+        if(frame_pt.x > minx && frame_pt.x < maxx &&
+                frame_pt.y > miny && frame_pt.y < maxy) {
+            count++;
+            int img_idx_2 = good_matches[i].trainIdx;
+            cv::Point ip_frame_pt =  keypoints_2[img_idx_2].pt;
+
+            ip_centerx += ip_frame_pt.x;
+            ip_centery += ip_frame_pt.y;
+        }
+    }
+    if (count == 0) {
+        return false;
+    }
+    *ip_pt = cv::Point(ip_centerx/count, ip_centery/count);
     return true;
 }
 
+void IPCamProcessor::startTracking(const cv::Mat& ip_frame,
+        const cv::Point& ip_pt, int target_id) {
+    cv::Rect box(ip_pt.x - _template_size/2, ip_pt.y - _template_size/2,
+            _template_size, _template_size);
+    // Too close to the edge for a full template, leave it to SURF
+    if (box.x < 0 || box.y < 0 ||
+            box.x + box.width > ip_frame.cols ||
+            box.y + box.height > ip_frame.rows) {
+        return;
+    }
+    ip_frame(box).copyTo(_template);
+    _track_pt = ip_pt;
+    _track_id = target_id;
+    _tracking = true;
+    _frames_since_refresh = 0;
+}
+
+bool IPCamProcessor::trackTemplate(const cv::Mat& ip_frame,
+        cv::Point* ip_pt) {
+    cv::Rect window = cv::Rect(
+            _track_pt.x - _template_size/2 - _search_margin,
+            _track_pt.y - _template_size/2 - _search_margin,
+            _template_size + 2*_search_margin,
+            _template_size + 2*_search_margin) &
+        cv::Rect(0, 0, ip_frame.cols, ip_frame.rows);
+    if (window.width < _template.cols || window.height < _template.rows) {
+        return false;
+    }
+
+    cv::matchTemplate(ip_frame(window), _template, _match_scores,
+            CV_TM_CCOEFF_NORMED);
+    double best = 0;
+    cv::Point best_loc;
+    cv::minMaxLoc(_match_scores, NULL, &best, NULL, &best_loc);
+    if (best < _min_track_score) {
+        return false;
+    }
+
+    _track_pt = window.tl() + best_loc +
+        cv::Point(_template.cols/2, _template.rows/2);
+    *ip_pt = _track_pt;
+    return true;
+}
+
+void IPCamProcessor::drawPair(const cv::Mat& frame, const cv::Mat& ip_frame,
+        cv::Mat* pair) {
+    pair->create(std::max(frame.rows, ip_frame.rows),
+            frame.cols + ip_frame.cols, CV_8UC1);
+    pair->setTo(cv::Scalar(0));
+    cv::Mat left = (*pair)(cv::Rect(0, 0, frame.cols, frame.rows));
+    cv::Mat right = (*pair)(cv::Rect(frame.cols, 0,
+                ip_frame.cols, ip_frame.rows));
+    frame.copyTo(left);
+    ip_frame.copyTo(right);
+}
+
 bool IPCamProcessor::getLastPair(cv::Mat* dst) {
     int rc = 0;
     if( (rc = pthread_rwlock_rdlock(&_last_pair_lock)) != 0) {
@@ -2,6 +2,7 @@
 #define IP_CAM_PROCESSOR_H
 
 #include <opencv2/opencv.hpp>
+#include <map>
 #include <vector>
 
 #include "video_frame.h"
@@ -27,6 +28,17 @@ class IPCamProcessor : public FrameProcessor {
             _ip_moving_x_ctr(0),
             _ip_moving_y_ctr(0),
             _ip_ctr(5),
+            _have_result(false),
+            _result_seq(0),
+            _tracking(false),
+            _track_id(0),
+            _template_size(_frame_width/8),
+            _search_margin(2*_ip_center_step),
+            _min_track_score(0.7),
+            _frames_since_refresh(0),
+            _refresh_interval(30),
+            _shed_refresh_factor(4),
+            _ptz_control(true),
    _motion_loc_blob_thresh(motion_loc_blob_thresh) {
                 int rc = 0;
                 if( (rc = pthread_rwlock_init(&_last_pair_lock, 
@@ -43,9 +55,43 @@ class IPCamProcessor : public FrameProcessor {
         
         virtual bool processFrame();
         bool getLastPair(cv::Mat* dst);
-        
+        // Mean ip frame location of the keypoints matched on each
+        // motion blob, by label, from the last SURF match; empty when
+        // motion had no full detection of that frame
+        bool getBlobCorrespondences(std::map<cvb::CvLabel, cv::Point>* ip_pts);
+        // Whether the camera is steered toward the target, on by
+        // default
+        void setPtzControl(bool enabled) {
+            _ptz_control = enabled;
+        };
+
+    protected:
+        // Forgets the result and template of the frame
+        virtual void discardFrame();
     private:
+        // Full SURF match of frame into ip_frame. Writes the annotated
+        // pair and the matched ip_frame location of every blob; returns
+        // whether any match fell on target, and if so its location.
+        // Matches are bucketed by the labels of detection_seq, the full
+        // detection target came with, only when that detection was run
+        // on frame; 0 goes by target's bbox alone.
+        bool matchFeatures(const cv::Mat& frame, const cv::Mat& ip_frame,
+                const BlobTrack_t* target, unsigned long detection_seq,
+                cv::Point* ip_pt, cv::Mat* pair);
+        // Cuts the template around ip_pt, where the track target_id was
+        // located, for trackTemplate
+        void startTracking(const cv::Mat& ip_frame, const cv::Point& ip_pt,
+                int target_id);
+        // Finds the template near its last location by normalized cross
+        // correlation; false when the best score is too low
+        bool trackTemplate(const cv::Mat& ip_frame, cv::Point* ip_pt);
+        // frame and ip_frame side by side, as matchFeatures draws them
+        void drawPair(const cv::Mat& frame, const cv::Mat& ip_frame,
+                cv::Mat* pair);
+
         cv::Mat _last_pair;
+        // Guarded by _last_pair_lock
+        std::map<cvb::CvLabel, cv::Point> _blob_ip_pts;
         int _ip_center_x;
         int _ip_center_y;
         // Maximum amount the center of object of the ip camera can move by
@@ -54,6 +100,32 @@ class IPCamProcessor : public FrameProcessor {
         int _ip_moving_x_ctr;
         int _ip_moving_y_ctr;
         int _ip_ctr;
+        // Sequence number of the frame the last pair was matched on
+        bool _have_result;
+        unsigned long _result_seq;
+
+        // Between SURF refreshes the target is followed in the ip frame
+        // by matching a template cut around the last SURF location
+        bool _tracking;
+        // Track the template was cut for; it is only followed while
+        // that track stays the target
+        int _track_id;
+        cv::Mat _template;
+        // Center of the template in the last ip frame
+        cv::Point _track_pt;
+        int _template_size;
+        // Pixels the search window extends past the template
+        int _search_margin;
+        // Lowest normalized correlation that still counts as found
+        double _min_track_score;
+        int _frames_since_refresh;
+        // Frames tracked before SURF runs again anyway
+        int _refresh_interval;
+        // The interval is this many times longer while load is shed
+        int _shed_refresh_factor;
+        bool _ptz_control;
+        // Scratch for trackTemplate
+        cv::Mat _match_scores;
         // Homography matrix
         // cv::Mat _H;
         MotionLocBlobThresh* _motion_loc_blob_thresh;
@@ -0,0 +1,89 @@
+#include "JitterProbe.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "Metrics.h"
+
+// Probed time the statistics are published over
+const static long REPORT_NS = 1000000000L;
+
+JitterProbe::JitterProbe(const std::string& name, int period_ms) :
+    _period_ms(period_ms),
+    _started(false),
+    _stop(false),
+    _max_metric("sched." + name + ".jitter_max_us"),
+    _mean_metric("sched." + name + ".jitter_mean_us") {
+}
+
+JitterProbe::~JitterProbe() {
+    stop();
+}
+
+bool JitterProbe::start() {
+    _stop = false;
+    if (pthread_create(&_thread, NULL, &probeThread, this)) {
+        perror("Could not create jitter probe thread.");
+        return false;
+    }
+    _started = true;
+    return true;
+}
+
+void JitterProbe::stop() {
+    if (!_started) {
+        return;
+    }
+    _stop = true;
+    pthread_join(_thread, NULL);
+    _started = false;
+}
+
+void* JitterProbe::probeThread(void* arg) {
+    ((JitterProbe*) arg)->probeLoop();
+    return NULL;
+}
+
+void JitterProbe::probeLoop() {
+    const long period_ns = _period_ms * 1000000L;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long elapsed_ns = 0;
+    long wakeups = 0;
+    double sum_us = 0;
+    double max_us = 0;
+    while (!_stop) {
+        next.tv_nsec += period_ns;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double late_us = (now.tv_sec - next.tv_sec) * 1000000.0 +
+            (now.tv_nsec - next.tv_nsec) / 1000.0;
+        sum_us += late_us;
+        if (late_us > max_us) {
+            max_us = late_us;
+        }
+        wakeups++;
+        // A wakeup late by more than a period restarts the schedule,
+        // rather than counting the missed ones as late too
+        if (late_us > _period_ms * 1000.0) {
+            next = now;
+        }
+
+        elapsed_ns += period_ns;
+        if (elapsed_ns >= REPORT_NS) {
+            Metrics& metrics = globalMetrics();
+            metrics.set(_max_metric, max_us);
+            metrics.set(_mean_metric, sum_us / wakeups);
+            elapsed_ns = 0;
+            wakeups = 0;
+            sum_us = 0;
+            max_us = 0;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef JITTER_PROBE_H
+#define JITTER_PROBE_H
+
+#include <pthread.h>
+#include <string>
+
+// Measures scheduling jitter where it runs: a thread wakes on a fixed
+// period and records how late each wakeup comes. Started from the
+// capture thread, it inherits its cores and priority and so sees the
+// delays capture would see. Publishes the worst and the mean lateness
+// of each second as sched.<name>.jitter_max_us and
+// sched.<name>.jitter_mean_us.
+class JitterProbe {
+    public:
+        JitterProbe(const std::string& name, int period_ms);
+        ~JitterProbe();
+
+        bool start();
+        void stop();
+
+    private:
+        static void* probeThread(void* arg);
+        void probeLoop();
+
+        int _period_ms;
+        pthread_t _thread;
+        bool _started;
+        volatile bool _stop;
+
+        // Metric names, built once
+        std::string _max_metric;
+        std::string _mean_metric;
+};
+
+#endif // JITTER_PROBE_H
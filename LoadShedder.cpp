@@ -0,0 +1,124 @@
+#include "LoadShedder.h"
+
+#include <iostream>
+#include <stdio.h>
+#include <time.h>
+
+#include "Metrics.h"
+
+// Length of the windows latencies are judged over
+const static double WINDOW_MS = 500;
+// Time after a step up before the next one, so the queues behind a
+// slow stage can drain and show whether the step was enough
+const static double SETTLE_MS = 1500;
+// A window counts as calm when every stage stayed under this fraction
+// of its budget; the gap to 1 keeps the level from flapping
+const static double RESTORE_FRACTION = 0.5;
+// Calm windows in a row before a step down
+const static int RESTORE_WINDOWS = 10;
+
+const static char* STAGE_NAMES[LoadShedder::NUM_STAGES] = {
+    "bgd", "motion", "ipcam"
+};
+
+static double monotonic_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+LoadShedder::LoadShedder(int webcam_budget_ms, int ip_budget_ms) :
+    _window_start_ms(monotonic_ms()),
+    _changed_ms(_window_start_ms),
+    _calm_windows(0),
+    _level(SHED_NONE) {
+    _budget_ms[STAGE_BGD] = webcam_budget_ms;
+    _budget_ms[STAGE_MOTION] = webcam_budget_ms;
+    _budget_ms[STAGE_IPCAM] = ip_budget_ms;
+    for (int i = 0; i < NUM_STAGES; i++) {
+        _window_max_ms[i] = -1;
+        _latency_metrics[i] = std::string("shed.") + STAGE_NAMES[i] +
+            ".latency_ms";
+    }
+    int rc = 0;
+    if( (rc = pthread_mutex_init(&_lock, NULL)) != 0) {
+        perror("mutex initialization failed in LoadShedder constructor.");
+    }
+    globalMetrics().set("shed.level", _level);
+}
+
+LoadShedder::~LoadShedder() {
+    pthread_mutex_destroy(&_lock);
+}
+
+void LoadShedder::report(Stage stage, const struct timeval& capture_time) {
+    double now_ms = monotonic_ms();
+    double latency_ms = now_ms - (capture_time.tv_sec * 1000.0 +
+            capture_time.tv_usec / 1000.0);
+
+    int rc = 0;
+    if( (rc = pthread_mutex_lock(&_lock)) != 0) {
+        perror("unable to lock load shedder");
+        return;
+    }
+    if (latency_ms > _window_max_ms[stage]) {
+        _window_max_ms[stage] = latency_ms;
+    }
+    if (now_ms - _window_start_ms >= WINDOW_MS) {
+        evaluate(now_ms);
+    }
+    if( (rc = pthread_mutex_unlock(&_lock)) != 0) {
+        perror("unable to unlock load shedder");
+    }
+}
+
+// Called with _lock held at the end of each window
+void LoadShedder::evaluate(double now_ms) {
+    bool over = false;
+    bool calm = true;
+    Metrics& metrics = globalMetrics();
+    for (int i = 0; i < NUM_STAGES; i++) {
+        // A stage with no frame in the window is idle or paused, which
+        // tells nothing either way
+        if (_window_max_ms[i] < 0) {
+            continue;
+        }
+        metrics.set(_latency_metrics[i], _window_max_ms[i]);
+        if (_budget_ms[i] > 0) {
+            if (_window_max_ms[i] > _budget_ms[i]) {
+                over = true;
+            }
+            if (_window_max_ms[i] > RESTORE_FRACTION * _budget_ms[i]) {
+                calm = false;
+            }
+        }
+        _window_max_ms[i] = -1;
+    }
+    _window_start_ms = now_ms;
+
+    int level = _level;
+    if (over) {
+        _calm_windows = 0;
+        if (level < NUM_LEVELS - 1 && now_ms - _changed_ms >= SETTLE_MS) {
+            level++;
+            metrics.increment("shed.degrades");
+        }
+    } else if (calm) {
+        _calm_windows++;
+        if (level > SHED_NONE && _calm_windows >= RESTORE_WINDOWS) {
+            level--;
+            _calm_windows = 0;
+            metrics.increment("shed.restores");
+        }
+    } else {
+        _calm_windows = 0;
+    }
+
+    if (level != _level) {
+        std::cout << "load shedding level " << _level << " -> " << level <<
+            std::endl;
+        _level = level;
+        _changed_ms = now_ms;
+        metrics.set("shed.level", level);
+    }
+}
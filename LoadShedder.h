@@ -0,0 +1,78 @@
+#ifndef LOAD_SHEDDER_H
+#define LOAD_SHEDDER_H
+
+#include <pthread.h>
+#include <string>
+#include <sys/time.h>
+
+// Keeps the processors within a latency budget on an overloaded box by
+// giving up quality in steps. Each stage reports how long after capture
+// it finished a frame; the worst latency of each stage over a short
+// window is held against the budget of the camera the stage serves.
+// When any stage is over budget the controller goes one level up,
+// waiting between steps for the effect to show, and once every stage
+// has stayed well under budget for a while it goes back down one
+// level at a time.
+//
+// Processors read the level once per frame and degrade on their own:
+// see the SHED_* levels for what each one gives up.
+class LoadShedder {
+    public:
+        enum Stage {
+            STAGE_BGD = 0,
+            STAGE_MOTION,
+            STAGE_IPCAM,
+            NUM_STAGES
+        };
+
+        enum Level {
+            // Full quality
+            SHED_NONE = 0,
+            // The bgd model is updated on every other frame
+            SHED_BGD_HALF,
+            // Motion is detected on a downscaled frame
+            SHED_MOTION_SCALE,
+            // SURF runs less often between template matches
+            SHED_SURF_RATE,
+            // Cross camera correlation is paused
+            SHED_IPCAM_PAUSE,
+            NUM_LEVELS
+        };
+
+        // Budgets in ms from capture to a stage finishing a frame, for
+        // the webcam stages (bgd and motion) and the ip camera stage;
+        // stages with a budget of 0 are not held to one
+        LoadShedder(int webcam_budget_ms, int ip_budget_ms);
+        ~LoadShedder();
+
+        // Called by stage after processing the frame captured at
+        // capture_time (CLOCK_MONOTONIC)
+        void report(Stage stage, const struct timeval& capture_time);
+        // Current level, read without locking once per frame
+        int level() const {
+            return _level;
+        };
+
+    private:
+        void evaluate(double now_ms);
+
+        double _budget_ms[NUM_STAGES];
+        // Worst latency of each stage in the current window, -1 if it
+        // reported nothing
+        double _window_max_ms[NUM_STAGES];
+        double _window_start_ms;
+        // Time of the last level change
+        double _changed_ms;
+        // Windows in a row every stage stayed under the restore
+        // fraction of its budget
+        int _calm_windows;
+        volatile int _level;
+
+        // Metric names, built once
+        std::string _latency_metrics[NUM_STAGES];
+
+        // Guards everything but _level's readers
+        pthread_mutex_t _lock;
+};
+
+#endif // LOAD_SHEDDER_H
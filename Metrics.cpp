@@ -0,0 +1,48 @@
+#include "Metrics.h"
+
+#include <stdio.h>
+
+Metrics::Metrics() {
+    int rc = 0;
+    if( (rc = pthread_mutex_init(&_lock, NULL)) != 0) {
+        perror("mutex initialization failed in metrics constructor.");
+    }
+}
+
+Metrics::~Metrics() {
+    pthread_mutex_destroy(&_lock);
+}
+
+void Metrics::increment(const std::string& name, double delta) {
+    pthread_mutex_lock(&_lock);
+    _values[name] += delta;
+    pthread_mutex_unlock(&_lock);
+}
+
+void Metrics::set(const std::string& name, double value) {
+    pthread_mutex_lock(&_lock);
+    _values[name] = value;
+    pthread_mutex_unlock(&_lock);
+}
+
+double Metrics::get(const std::string& name) {
+    pthread_mutex_lock(&_lock);
+    std::map<std::string, double>::const_iterator it = _values.find(name);
+    double value = (it == _values.end()) ? 0 : it->second;
+    pthread_mutex_unlock(&_lock);
+    return value;
+}
+
+void Metrics::dump(std::ostream& out) {
+    pthread_mutex_lock(&_lock);
+    for (std::map<std::string, double>::const_iterator it = _values.begin();
+            it != _values.end(); ++it) {
+        out << it->first << " " << it->second << std::endl;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+Metrics& globalMetrics() {
+    static Metrics metrics;
+    return metrics;
+}
@@ -0,0 +1,30 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <map>
+#include <ostream>
+#include <pthread.h>
+#include <string>
+
+// Process wide registry of named counters and gauges. Values are
+// created on first use; updates take a short uncontended mutex, which
+// is cheap at frame rate.
+class Metrics {
+    public:
+        Metrics();
+        ~Metrics();
+
+        void increment(const std::string& name, double delta = 1);
+        void set(const std::string& name, double value);
+        double get(const std::string& name);
+        // Writes one "name value" line per metric
+        void dump(std::ostream& out);
+
+    private:
+        pthread_mutex_t _lock;
+        std::map<std::string, double> _values;
+};
+
+Metrics& globalMetrics();
+
+#endif // METRICS_H
@@ -0,0 +1,464 @@
+#include "MjpegServer.h"
+#include "Metrics.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+const static int MAX_EVENTS = 32;
+// Longest request header accepted
+const static size_t MAX_REQUEST = 4096;
+const static int JPEG_QUALITY = 80;
+
+MjpegServer::MjpegServer(int port) :
+    _port(port),
+    _listen_fd(-1),
+    _epoll_fd(-1),
+    _wake_fd(-1),
+    _started(false),
+    _stop(false) {
+    int rc = 0;
+    if( (rc = pthread_mutex_init(&_lock, NULL)) != 0) {
+        perror("mutex initialization failed in mjpeg server constructor.");
+    }
+}
+
+MjpegServer::~MjpegServer() {
+    stop();
+    for (size_t i = 0; i < _streams.size(); i++) {
+        delete _streams[i].incoming;
+    }
+    pthread_mutex_destroy(&_lock);
+}
+
+int MjpegServer::addStream(const std::string& name) {
+    Stream_t stream;
+    stream.name = name;
+    stream.incoming = NULL;
+    stream.clients = 0;
+    _streams.push_back(stream);
+    return _streams.size() - 1;
+}
+
+bool MjpegServer::start() {
+    _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (_listen_fd < 0) {
+        perror("unable to create http socket");
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(_port);
+    if (bind(_listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+            listen(_listen_fd, 16) != 0) {
+        perror("unable to listen for http clients");
+        close(_listen_fd);
+        _listen_fd = -1;
+        return false;
+    }
+
+    _epoll_fd = epoll_create1(0);
+    _wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (_epoll_fd < 0 || _wake_fd < 0) {
+        perror("unable to set up http event loop");
+        return false;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = _listen_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &ev);
+    ev.data.fd = _wake_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_fd, &ev);
+
+    if (pthread_create(&_thread, NULL, &serverThread, this)) {
+        perror("Could not create http server thread.");
+        return false;
+    }
+    _started = true;
+    std::cout << "serving mjpeg on port " << _port << std::endl;
+    return true;
+}
+
+void MjpegServer::stop() {
+    if (_started) {
+        pthread_mutex_lock(&_lock);
+        _stop = true;
+        pthread_mutex_unlock(&_lock);
+        uint64_t one = 1;
+        if (write(_wake_fd, &one, sizeof(one)) != sizeof(one)) {
+            perror("unable to wake http server");
+        }
+        pthread_join(_thread, NULL);
+        _started = false;
+    }
+    if (_listen_fd >= 0) {
+        close(_listen_fd);
+        _listen_fd = -1;
+    }
+    if (_epoll_fd >= 0) {
+        close(_epoll_fd);
+        _epoll_fd = -1;
+    }
+    if (_wake_fd >= 0) {
+        close(_wake_fd);
+        _wake_fd = -1;
+    }
+}
+
+bool MjpegServer::hasClients(int stream) {
+    pthread_mutex_lock(&_lock);
+    bool has_clients = _streams[stream].clients > 0;
+    pthread_mutex_unlock(&_lock);
+    return has_clients;
+}
+
+bool MjpegServer::publish(int stream, const cv::Mat& img) {
+    if (!hasClients(stream)) {
+        return true;
+    }
+    std::vector<unsigned char> jpeg;
+    std::vector<int> params;
+    params.push_back(CV_IMWRITE_JPEG_QUALITY);
+    params.push_back(JPEG_QUALITY);
+    if (!cv::imencode(".jpg", img, jpeg, params)) {
+        std::cout << "unable to encode frame for " <<
+            _streams[stream].name << std::endl;
+        return false;
+    }
+    globalMetrics().increment("http.frames_encoded");
+    return publishEncoded(stream, &jpeg[0], jpeg.size());
+}
+
+bool MjpegServer::publishEncoded(int stream, const unsigned char* jpeg,
+        size_t size) {
+    char header[128];
+    int header_size = snprintf(header, sizeof(header),
+            "--frame\r\nContent-Type: image/jpeg\r\n"
+            "Content-Length: %lu\r\n\r\n", (unsigned long) size);
+    SharedFrame_t* frame = new SharedFrame_t;
+    frame->refs = 0;
+    frame->data.reserve(header_size + size + 2);
+    frame->data.insert(frame->data.end(), header, header + header_size);
+    frame->data.insert(frame->data.end(), jpeg, jpeg + size);
+    frame->data.push_back('\r');
+    frame->data.push_back('\n');
+
+    pthread_mutex_lock(&_lock);
+    // The server thread hasn't picked up the previous one yet
+    delete _streams[stream].incoming;
+    _streams[stream].incoming = frame;
+    pthread_mutex_unlock(&_lock);
+
+    uint64_t one = 1;
+    if (write(_wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("unable to wake http server");
+        return false;
+    }
+    return true;
+}
+
+void* MjpegServer::serverThread(void* arg) {
+    ((MjpegServer*) arg)->serve();
+    return NULL;
+}
+
+void MjpegServer::serve() {
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        int n = epoll_wait(_epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("http event loop failed");
+            break;
+        }
+
+        bool stop = false;
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == _listen_fd) {
+                acceptClients();
+                continue;
+            }
+            if (fd == _wake_fd) {
+                uint64_t count;
+                if (read(_wake_fd, &count, sizeof(count)) < 0 &&
+                        errno != EAGAIN) {
+                    perror("unable to read http wakeup");
+                }
+                std::vector<SharedFrame_t*> incoming(_streams.size());
+                pthread_mutex_lock(&_lock);
+                stop = _stop;
+                for (size_t s = 0; s < _streams.size(); s++) {
+                    incoming[s] = _streams[s].incoming;
+                    _streams[s].incoming = NULL;
+                }
+                pthread_mutex_unlock(&_lock);
+                for (size_t s = 0; s < incoming.size(); s++) {
+                    if (incoming[s] != NULL) {
+                        distribute(s, incoming[s]);
+                    }
+                }
+                continue;
+            }
+
+            std::map<int, Client_t>::iterator it = _clients.find(fd);
+            if (it == _clients.end()) {
+                continue;
+            }
+            Client_t* client = &it->second;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closeClient(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                readRequest(client);
+                if (client->fd < 0) {
+                    closeClient(fd);
+                    continue;
+                }
+            }
+            if ((events[i].events & EPOLLOUT) && !flush(client)) {
+                closeClient(fd);
+            }
+        }
+        if (stop) {
+            break;
+        }
+    }
+
+    while (!_clients.empty()) {
+        closeClient(_clients.begin()->first);
+    }
+}
+
+void MjpegServer::acceptClients() {
+    for (;;) {
+        int fd = accept4(_listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("unable to accept http client");
+            }
+            return;
+        }
+        Client_t client;
+        client.fd = fd;
+        client.stream = -1;
+        client.text_sent = 0;
+        client.close_after_text = false;
+        client.sending = NULL;
+        client.sent = 0;
+        client.next = NULL;
+        client.want_write = false;
+        _clients[fd] = client;
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            perror("unable to watch http client");
+            closeClient(fd);
+        }
+    }
+}
+
+// Reads the request line once; anything a streaming client sends
+// after that is discarded. Sets client->fd to -1 if it hung up.
+void MjpegServer::readRequest(Client_t* client) {
+    char buf[1024];
+    for (;;) {
+        ssize_t n = recv(client->fd, buf, sizeof(buf), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            client->fd = -1;
+            return;
+        }
+        if (n < 0) {
+            break;
+        }
+        if (client->stream < 0 && client->text.empty()) {
+            client->request.append(buf, n);
+        }
+    }
+    if (client->stream >= 0 || !client->text.empty()) {
+        return;
+    }
+    if (client->request.find("\r\n\r\n") == std::string::npos) {
+        if (client->request.size() > MAX_REQUEST) {
+            client->fd = -1;
+        }
+        return;
+    }
+
+    std::string path;
+    if (client->request.compare(0, 5, "GET /") == 0) {
+        std::string::size_type end = client->request.find_first_of(" ?", 5);
+        path = client->request.substr(5, end - 5);
+    }
+    client->request.clear();
+
+    if (path.empty()) {
+        std::string body = "<html><body>";
+        for (size_t s = 0; s < _streams.size(); s++) {
+            body += "<p><a href=\"/" + _streams[s].name + "\">" +
+                _streams[s].name + "</a></p>";
+        }
+        body += "</body></html>";
+        client->text = "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/html\r\n\r\n" + body;
+        client->close_after_text = true;
+    } else {
+        for (size_t s = 0; s < _streams.size(); s++) {
+            if (_streams[s].name == path) {
+                client->stream = s;
+            }
+        }
+        if (client->stream < 0) {
+            client->text = "HTTP/1.0 404 Not Found\r\n"
+                "Content-Type: text/plain\r\n\r\nno such stream\r\n";
+            client->close_after_text = true;
+        } else {
+            client->text = "HTTP/1.0 200 OK\r\n"
+                "Cache-Control: no-cache\r\n"
+                "Content-Type: multipart/x-mixed-replace; boundary=frame"
+                "\r\n\r\n";
+            pthread_mutex_lock(&_lock);
+            _streams[client->stream].clients++;
+            pthread_mutex_unlock(&_lock);
+            globalMetrics().increment("http.clients");
+        }
+    }
+    if (!flush(client)) {
+        client->fd = -1;
+    }
+}
+
+void MjpegServer::distribute(int stream, SharedFrame_t* frame) {
+    // Held while handing it out, a client may finish sending it
+    // right away
+    frame->refs = 1;
+    std::vector<int> gone;
+    for (std::map<int, Client_t>::iterator it = _clients.begin();
+            it != _clients.end(); ++it) {
+        Client_t* client = &it->second;
+        if (client->stream != stream) {
+            continue;
+        }
+        frame->refs++;
+        if (client->sending == NULL) {
+            client->sending = frame;
+            client->sent = 0;
+        } else {
+            // Still busy with an earlier frame, keep only the newest
+            if (client->next != NULL) {
+                release(client->next);
+                globalMetrics().increment("http.frames_dropped");
+            }
+            client->next = frame;
+        }
+        if (!flush(client)) {
+            gone.push_back(it->first);
+        }
+    }
+    release(frame);
+    for (size_t i = 0; i < gone.size(); i++) {
+        closeClient(gone[i]);
+    }
+}
+
+bool MjpegServer::flush(Client_t* client) {
+    while (client->text_sent < client->text.size()) {
+        ssize_t n = send(client->fd, client->text.data() + client->text_sent,
+                client->text.size() - client->text_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                updateInterest(client);
+                return true;
+            }
+            return false;
+        }
+        client->text_sent += n;
+    }
+    if (client->close_after_text) {
+        return false;
+    }
+
+    while (client->sending != NULL) {
+        const std::vector<unsigned char>& data = client->sending->data;
+        ssize_t n = send(client->fd, &data[client->sent],
+                data.size() - client->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        client->sent += n;
+        if (client->sent == data.size()) {
+            release(client->sending);
+            globalMetrics().increment("http.frames_sent");
+            client->sending = client->next;
+            client->next = NULL;
+            client->sent = 0;
+        }
+    }
+    updateInterest(client);
+    return true;
+}
+
+// Asks for EPOLLOUT only while there is something left to send
+void MjpegServer::updateInterest(Client_t* client) {
+    bool want_write = client->text_sent < client->text.size() ||
+        client->sending != NULL;
+    if (want_write == client->want_write) {
+        return;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+    ev.data.fd = client->fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) != 0) {
+        perror("unable to update http client events");
+    }
+    client->want_write = want_write;
+}
+
+void MjpegServer::closeClient(int fd) {
+    std::map<int, Client_t>::iterator it = _clients.find(fd);
+    if (it == _clients.end()) {
+        return;
+    }
+    Client_t& client = it->second;
+    if (client.sending != NULL) {
+        release(client.sending);
+    }
+    if (client.next != NULL) {
+        release(client.next);
+    }
+    if (client.stream >= 0) {
+        pthread_mutex_lock(&_lock);
+        _streams[client.stream].clients--;
+        pthread_mutex_unlock(&_lock);
+        globalMetrics().increment("http.clients", -1);
+    }
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    _clients.erase(it);
+}
+
+void MjpegServer::release(SharedFrame_t* frame) {
+    if (--frame->refs == 0) {
+        delete frame;
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef MJPEG_SERVER_H
+#define MJPEG_SERVER_H
+
+#include <opencv2/opencv.hpp>
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// HTTP server of multipart MJPEG streams, so the livefeed can be
+// watched remotely. Each published frame is JPEG encoded once, and
+// that one buffer is handed to every client of the stream. Sockets are
+// non-blocking and served from one epoll thread. A client holds at
+// most the frame it is being sent plus the newest one; frames
+// published in between are dropped for it, so slow clients lose
+// frames instead of growing memory.
+//
+// GET /<stream> serves a stream, GET / lists them.
+class MjpegServer {
+    public:
+        MjpegServer(int port);
+        ~MjpegServer();
+
+        // Registers a stream served at /name, before start
+        int addStream(const std::string& name);
+        bool start();
+        void stop();
+
+        // Whether anyone is watching, so publishers can skip encoding
+        bool hasClients(int stream);
+        // Encodes img and queues it for the stream's clients
+        bool publish(int stream, const cv::Mat& img);
+        // Queues an already encoded JPEG
+        bool publishEncoded(int stream, const unsigned char* jpeg,
+                size_t size);
+
+    private:
+        // A multipart part, boundary and headers included, shared by
+        // all clients sending it. Only the server thread touches refs.
+        typedef struct SharedFrame {
+            std::vector<unsigned char> data;
+            int refs;
+        } SharedFrame_t;
+
+        typedef struct Client {
+            int fd;
+            // -1 until the request names a stream
+            int stream;
+            std::string request;
+            // Response header or error page, sent before any frame
+            std::string text;
+            size_t text_sent;
+            // The text is all there is to send, e.g. a 404
+            bool close_after_text;
+            SharedFrame_t* sending;
+            size_t sent;
+            // Newest frame published while sending, replaced by newer
+            SharedFrame_t* next;
+            // Whether EPOLLOUT is currently requested
+            bool want_write;
+        } Client_t;
+
+        typedef struct Stream {
+            std::string name;
+            // Handed over by publish, taken by the server thread
+            SharedFrame_t* incoming;
+            int clients;
+        } Stream_t;
+
+        static void* serverThread(void* arg);
+        void serve();
+        void acceptClients();
+        void readRequest(Client_t* client);
+        void distribute(int stream, SharedFrame_t* frame);
+        // Sends as much as the socket takes; false if the client is gone
+        bool flush(Client_t* client);
+        void updateInterest(Client_t* client);
+        void closeClient(int fd);
+        void release(SharedFrame_t* frame);
+
+        int _port;
+        int _listen_fd;
+        int _epoll_fd;
+        // Written by publish and stop to wake up the server thread
+        int _wake_fd;
+
+        std::vector<Stream_t> _streams;
+        // Owned by the server thread
+        std::map<int, Client_t> _clients;
+
+        bool _started;
+        bool _stop;
+        pthread_t _thread;
+        // Guards _streams' incoming and clients, and _stop
+        pthread_mutex_t _lock;
+};
+
+#endif // MJPEG_SERVER_H
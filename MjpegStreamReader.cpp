@@ -0,0 +1,445 @@
+#include "MjpegStreamReader.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Size of the socket/file read buffer
+const static size_t READ_BUFLEN = 64 * 1024;
+// Longest header or boundary line kept while scanning for a boundary
+const static size_t MAX_LINE_LEN = 4096;
+// Largest JPEG accepted from a part; a bigger Content-Length is taken
+// as a corrupt header rather than allocated
+const static size_t MAX_JPEG_LEN = 16 * 1024 * 1024;
+
+MjpegStreamReader::MjpegStreamReader() :
+    _fd(-1),
+    _multipart(false),
+    _buf(READ_BUFLEN),
+    _buf_start(0),
+    _buf_end(0),
+    _jpeg_len(0),
+    _target_width(0),
+    _target_height(0),
+    _scale_denom(0) {
+    _dinfo.err = jpeg_std_error(&_jerr.pub);
+    _jerr.pub.error_exit = jpegErrorExit;
+    jpeg_create_decompress(&_dinfo);
+}
+
+MjpegStreamReader::~MjpegStreamReader() {
+    release();
+    jpeg_destroy_decompress(&_dinfo);
+}
+
+void MjpegStreamReader::jpegErrorExit(j_common_ptr cinfo) {
+    JpegErrorMgr* err = (JpegErrorMgr*) cinfo->err;
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->setjmp_buffer, 1);
+}
+
+bool MjpegStreamReader::open(const std::string& url) {
+    release();
+    if (url.compare(0, 7, "http://") == 0) {
+        return openHttp(url);
+    }
+    if (url.compare(0, 7, "file://") == 0) {
+        return openFile(url.substr(7));
+    }
+    return openFile(url);
+}
+
+bool MjpegStreamReader::isOpened() const {
+    return _fd >= 0;
+}
+
+void MjpegStreamReader::release() {
+    if (_fd >= 0) {
+        close(_fd);
+    }
+    _fd = -1;
+    _multipart = false;
+    _boundary.clear();
+    _buf_start = 0;
+    _buf_end = 0;
+    _jpeg_len = 0;
+}
+
+void MjpegStreamReader::setTargetSize(int width, int height) {
+    _target_width = width;
+    _target_height = height;
+}
+
+void MjpegStreamReader::setScaleDenom(int denom) {
+    _scale_denom = denom;
+}
+
+bool MjpegStreamReader::openHttp(const std::string& url) {
+    std::string rest = url.substr(7);
+    std::string::size_type slash = rest.find('/');
+    std::string host_port = rest.substr(0, slash);
+    std::string path = (slash == std::string::npos) ?
+        "/" : rest.substr(slash);
+
+    std::string host = host_port;
+    std::string port = "80";
+    std::string::size_type colon = host_port.find(':');
+    if (colon != std::string::npos) {
+        host = host_port.substr(0, colon);
+        port = host_port.substr(colon + 1);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = NULL;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        perror("unable to resolve mjpeg stream host");
+        return false;
+    }
+
+    for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+        _fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (_fd < 0) {
+            continue;
+        }
+        if (connect(_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(_fd);
+        _fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (_fd < 0) {
+        perror("unable to connect to mjpeg stream");
+        return false;
+    }
+
+    std::string request = "GET " + path + " HTTP/1.0\r\n"
+        "Host: " + host + "\r\n"
+        "Connection: close\r\n\r\n";
+    size_t sent = 0;
+    while (sent < request.size()) {
+        ssize_t n = send(_fd, request.data() + sent,
+                request.size() - sent, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("unable to send mjpeg stream request");
+            release();
+            return false;
+        }
+        sent += n;
+    }
+
+    if (!readHttpHeaders()) {
+        release();
+        return false;
+    }
+    return true;
+}
+
+bool MjpegStreamReader::openFile(const std::string& path) {
+    _fd = ::open(path.c_str(), O_RDONLY);
+    if (_fd < 0) {
+        perror("unable to open mjpeg file");
+        return false;
+    }
+
+    // Recorded files are either bare concatenated JPEGs or a saved
+    // multipart body whose boundary is learned from the first part
+    if (!fillBuffer()) {
+        release();
+        return false;
+    }
+    _multipart = !(_buf_end - _buf_start >= 2 &&
+            _buf[_buf_start] == 0xFF &&
+            _buf[_buf_start + 1] == 0xD8);
+    return true;
+}
+
+bool MjpegStreamReader::readHttpHeaders() {
+    std::string line;
+    if (!readLine(&line) || line.compare(0, 5, "HTTP/") != 0) {
+        std::cout << "unexpected mjpeg stream response" << std::endl;
+        return false;
+    }
+    std::string::size_type sp = line.find(' ');
+    if (sp == std::string::npos || atoi(line.c_str() + sp + 1) != 200) {
+        std::cout << "mjpeg stream returned: " << line << std::endl;
+        return false;
+    }
+
+    while (readLine(&line) && !line.empty()) {
+        if (strncasecmp(line.c_str(), "content-type:", 13) != 0) {
+            continue;
+        }
+        if (line.find("multipart") == std::string::npos) {
+            continue;
+        }
+        _multipart = true;
+        std::string::size_type b = line.find("boundary=");
+        if (b == std::string::npos) {
+            continue;
+        }
+        _boundary = line.substr(b + 9);
+        std::string::size_type end = _boundary.find(';');
+        if (end != std::string::npos) {
+            _boundary = _boundary.substr(0, end);
+        }
+        if (!_boundary.empty() && _boundary[0] == '"') {
+            _boundary = _boundary.substr(1, _boundary.find('"', 1) - 1);
+        }
+        // Some cameras put the leading dashes in the header value
+        while (_boundary.compare(0, 2, "--") == 0) {
+            _boundary = _boundary.substr(2);
+        }
+    }
+    return true;
+}
+
+bool MjpegStreamReader::fillBuffer() {
+    if (_buf_start == _buf_end) {
+        _buf_start = 0;
+        _buf_end = 0;
+    } else if (_buf_end == _buf.size()) {
+        memmove(&_buf[0], &_buf[_buf_start], _buf_end - _buf_start);
+        _buf_end -= _buf_start;
+        _buf_start = 0;
+    }
+
+    for (;;) {
+        ssize_t n = ::read(_fd, &_buf[_buf_end], _buf.size() - _buf_end);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        _buf_end += n;
+        return true;
+    }
+}
+
+bool MjpegStreamReader::readLine(std::string* line) {
+    line->clear();
+    for (;;) {
+        if (_buf_start == _buf_end && !fillBuffer()) {
+            return false;
+        }
+        unsigned char c = _buf[_buf_start++];
+        if (c == '\n') {
+            if (!line->empty() && (*line)[line->size() - 1] == '\r') {
+                line->erase(line->size() - 1);
+            }
+            return true;
+        }
+        if (line->size() < MAX_LINE_LEN) {
+            line->push_back(c);
+        }
+    }
+}
+
+bool MjpegStreamReader::readBytes(size_t n,
+        std::vector<unsigned char>* dst) {
+    if (dst->size() < n) {
+        dst->resize(n);
+    }
+    size_t copied = 0;
+    while (copied < n) {
+        if (_buf_start == _buf_end && !fillBuffer()) {
+            return false;
+        }
+        size_t avail = std::min(_buf_end - _buf_start, n - copied);
+        memcpy(&(*dst)[copied], &_buf[_buf_start], avail);
+        _buf_start += avail;
+        copied += avail;
+    }
+    return true;
+}
+
+// Used for bare JPEG files and for parts without a Content-Length:
+// takes everything from the next SOI marker up to the following EOI.
+bool MjpegStreamReader::readJpegByMarkers() {
+    bool started = false;
+    unsigned char prev = 0;
+    _jpeg_len = 0;
+    for (;;) {
+        if (_buf_start == _buf_end && !fillBuffer()) {
+            return false;
+        }
+        unsigned char c = _buf[_buf_start++];
+        if (!started) {
+            if (prev == 0xFF && c == 0xD8) {
+                started = true;
+                if (_jpeg.size() < 2) {
+                    _jpeg.resize(READ_BUFLEN);
+                }
+                _jpeg[0] = 0xFF;
+                _jpeg[1] = 0xD8;
+                _jpeg_len = 2;
+            }
+            prev = c;
+            continue;
+        }
+
+        if (_jpeg_len == _jpeg.size()) {
+            if (_jpeg.size() >= MAX_JPEG_LEN) {
+                // No EOI in sight; start over at the next SOI
+                started = false;
+                prev = c;
+                continue;
+            }
+            _jpeg.resize(2 * _jpeg.size());
+        }
+        _jpeg[_jpeg_len++] = c;
+        if (prev == 0xFF && c == 0xD9) {
+            return true;
+        }
+        prev = c;
+    }
+}
+
+bool MjpegStreamReader::readPart() {
+    std::string line;
+    for (;;) {
+        // Skip to the next boundary line
+        for (;;) {
+            if (!readLine(&line)) {
+                return false;
+            }
+            if (_boundary.empty()) {
+                if (line.compare(0, 2, "--") == 0 && line.size() > 2) {
+                    _boundary = line.substr(2);
+                    break;
+                }
+            } else if (line.find(_boundary) != std::string::npos) {
+                // Closing delimiter ends the stream
+                if (line.size() >= 2 &&
+                        line.compare(line.size() - 2, 2, "--") == 0 &&
+                        line.size() > _boundary.size() + 2) {
+                    return false;
+                }
+                break;
+            }
+        }
+
+        size_t content_length = 0;
+        while (readLine(&line) && !line.empty()) {
+            if (strncasecmp(line.c_str(), "content-length:", 15) == 0) {
+                content_length = strtoul(line.c_str() + 15, NULL, 10);
+            }
+        }
+
+        if (content_length > MAX_JPEG_LEN) {
+            // Skip the part and resync on the next boundary
+            std::cout << "mjpeg part of " << content_length <<
+                " bytes dropped" << std::endl;
+            continue;
+        }
+        if (content_length == 0) {
+            return readJpegByMarkers();
+        }
+        if (!readBytes(content_length, &_jpeg)) {
+            return false;
+        }
+        _jpeg_len = content_length;
+        return true;
+    }
+}
+
+bool MjpegStreamReader::grab() {
+    if (_fd < 0) {
+        return false;
+    }
+    bool grabbed = _multipart ? readPart() : readJpegByMarkers();
+    if (!grabbed) {
+        _jpeg_len = 0;
+    }
+    return grabbed;
+}
+
+int MjpegStreamReader::chooseScaleDenom(int width, int height) const {
+    if (_scale_denom > 0) {
+        return _scale_denom;
+    }
+    if (_target_width <= 0 || _target_height <= 0) {
+        return 1;
+    }
+    for (int denom = 8; denom > 1; denom /= 2) {
+        if ((width + denom - 1) / denom >= _target_width &&
+                (height + denom - 1) / denom >= _target_height) {
+            return denom;
+        }
+    }
+    return 1;
+}
+
+bool MjpegStreamReader::retrieve(cv::Mat* dst, bool gray) {
+    if (_jpeg_len == 0) {
+        return false;
+    }
+
+    if (setjmp(_jerr.setjmp_buffer)) {
+        // Corrupt or truncated frame, decoder state is reset for the
+        // next one
+        jpeg_abort_decompress(&_dinfo);
+        return false;
+    }
+
+    jpeg_mem_src(&_dinfo, &_jpeg[0], _jpeg_len);
+    jpeg_read_header(&_dinfo, TRUE);
+
+    _dinfo.scale_num = 1;
+    _dinfo.scale_denom = chooseScaleDenom(_dinfo.image_width,
+            _dinfo.image_height);
+    _dinfo.dct_method = JDCT_IFAST;
+    _dinfo.do_fancy_upsampling = FALSE;
+    // Grayscale output only runs the IDCT on the luma component
+#ifdef JCS_EXTENSIONS
+    _dinfo.out_color_space = gray ? JCS_GRAYSCALE : JCS_EXT_BGR;
+#else
+    _dinfo.out_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+#endif
+
+    jpeg_start_decompress(&_dinfo);
+
+    dst->create(_dinfo.output_height, _dinfo.output_width,
+            gray ? CV_8UC1 : CV_8UC3);
+    if (_rows.size() < _dinfo.output_height) {
+        _rows.resize(_dinfo.output_height);
+    }
+    for (unsigned int i = 0; i < _dinfo.output_height; i++) {
+        _rows[i] = dst->ptr(i);
+    }
+    while (_dinfo.output_scanline < _dinfo.output_height) {
+        jpeg_read_scanlines(&_dinfo,
+                &_rows[_dinfo.output_scanline],
+                _dinfo.output_height - _dinfo.output_scanline);
+    }
+    jpeg_finish_decompress(&_dinfo);
+
+#ifndef JCS_EXTENSIONS
+    if (!gray) {
+        cv::cvtColor(*dst, *dst, CV_RGB2BGR);
+    }
+#endif
+    return true;
+}
+
+bool MjpegStreamReader::read(cv::Mat* dst, bool gray) {
+    return grab() && retrieve(dst, gray);
+}
@@ -0,0 +1,88 @@
+#ifndef MJPEG_STREAM_READER_H
+#define MJPEG_STREAM_READER_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+// Reads a multipart/x-mixed-replace MJPEG stream (http://host[:port]/path)
+// or a recorded .mjpg file (raw concatenated JPEGs or a saved multipart
+// body) and decodes frames with libjpeg-turbo. Decoding uses the scaled
+// IDCT to come out at the smallest 1/1, 1/2, 1/4 or 1/8 scale that still
+// covers the target size, and can produce luma only so grayscale
+// consumers never pay for color conversion.
+//
+// Mirrors the grab()/retrieve() split of cv::VideoCapture: grab() only
+// pulls the compressed frame off the stream, so skipping stale frames
+// costs no decode.
+class MjpegStreamReader {
+    public:
+        MjpegStreamReader();
+        ~MjpegStreamReader();
+
+        bool open(const std::string& url);
+        bool isOpened() const;
+        void release();
+
+        // Smallest frame size retrieve() should produce. The decoder
+        // picks the largest IDCT scale down that stays at or above it.
+        void setTargetSize(int width, int height);
+        // Force a fixed scale denominator (1, 2, 4 or 8). 0 selects
+        // the scale from the target size.
+        void setScaleDenom(int denom);
+
+        // Read the next compressed frame from the stream
+        bool grab();
+        // Decode the last grabbed frame into dst, which is only
+        // reallocated if its size or type changes. gray selects
+        // luma-only CV_8UC1 output, otherwise CV_8UC3 BGR.
+        bool retrieve(cv::Mat* dst, bool gray);
+        bool read(cv::Mat* dst, bool gray);
+
+    private:
+        struct JpegErrorMgr {
+            struct jpeg_error_mgr pub;
+            jmp_buf setjmp_buffer;
+        };
+        static void jpegErrorExit(j_common_ptr cinfo);
+
+        bool openHttp(const std::string& url);
+        bool openFile(const std::string& path);
+        bool readHttpHeaders();
+
+        // Buffered reads from _fd
+        bool fillBuffer();
+        bool readLine(std::string* line);
+        bool readBytes(size_t n, std::vector<unsigned char>* dst);
+
+        bool readPart();
+        bool readJpegByMarkers();
+        int chooseScaleDenom(int width, int height) const;
+
+        int _fd;
+        bool _multipart;
+        std::string _boundary;
+
+        std::vector<unsigned char> _buf;
+        size_t _buf_start;
+        size_t _buf_end;
+
+        // Compressed data of the last grabbed frame. Capacity is kept
+        // between frames so steady state reads don't allocate.
+        std::vector<unsigned char> _jpeg;
+        size_t _jpeg_len;
+
+        int _target_width;
+        int _target_height;
+        int _scale_denom;
+
+        struct jpeg_decompress_struct _dinfo;
+        JpegErrorMgr _jerr;
+        std::vector<JSAMPROW> _rows;
+};
+
+#endif // MJPEG_STREAM_READER_H
@@ -0,0 +1,351 @@
+#ifndef MOTION_KERNELS_H
+#define MOTION_KERNELS_H
+
+#include <stddef.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Motion mask kernels templated on their parameters: the abs
+// difference to the bgd fused with the threshold, and a binary
+// opening and closing with an elliptic structuring element.
+//
+// Params supplies width(), height(), thresh() and radius(). With
+// FixedMotionParams all of them are compile-time constants, so row
+// loops have constant trip counts, the threshold is an immediate and
+// the per-radius loops unroll completely. RuntimeMotionParams runs the
+// same code for any other configuration. See MotionMaskKernel for the
+// dispatch between the two.
+
+// STATIC_RADIUS is the radius when it is known at compile time, 0
+// otherwise
+template <int W, int H, int THRESH, int RADIUS>
+struct FixedMotionParams {
+    enum { STATIC_RADIUS = RADIUS };
+    int width() const { return W; }
+    int height() const { return H; }
+    int thresh() const { return THRESH; }
+    int radius() const { return RADIUS; }
+};
+
+struct RuntimeMotionParams {
+    enum { STATIC_RADIUS = 0 };
+    RuntimeMotionParams(int width, int height, int thresh, int radius) :
+        _width(width),
+        _height(height),
+        _thresh(thresh),
+        _radius(radius) {};
+    int width() const { return _width; }
+    int height() const { return _height; }
+    int thresh() const { return _thresh; }
+    int radius() const { return _radius; }
+
+    int _width;
+    int _height;
+    int _thresh;
+    int _radius;
+};
+
+// Erosion of a binary mask is a min, dilation a max. Pixels outside
+// the image are the identity, as with OpenCV's default morphology
+// border.
+struct MorphMinOp {
+    static const unsigned char identity = 255;
+    static unsigned char apply(unsigned char a, unsigned char b) {
+        return a < b ? a : b;
+    }
+#ifdef __SSE2__
+    static __m128i apply(__m128i a, __m128i b) {
+        return _mm_min_epu8(a, b);
+    }
+#endif
+};
+
+struct MorphMaxOp {
+    static const unsigned char identity = 0;
+    static unsigned char apply(unsigned char a, unsigned char b) {
+        return a > b ? a : b;
+    }
+#ifdef __SSE2__
+    static __m128i apply(__m128i a, __m128i b) {
+        return _mm_max_epu8(a, b);
+    }
+#endif
+};
+
+// Half widths of the rows of the (2 * radius + 1)^2 ellipse, computed
+// the way cv::getStructuringElement(MORPH_ELLIPSE) does so the masks
+// match OpenCV's morphology exactly
+inline void ellipseHalfWidths(int radius, int* half_widths) {
+    double inv_r2 = radius ? 1.0 / ((double) radius * radius) : 0;
+    for (int dy = -radius; dy <= radius; dy++) {
+        half_widths[dy + radius] = (int) lrint(radius *
+                sqrt((radius * radius - dy * dy) * inv_r2));
+    }
+}
+
+#ifdef __SSE2__
+// Min/max down N rows at column i, unrolled at compile time
+template <class Op, int N>
+struct ColumnReduce {
+    static __m128i apply(const unsigned char* const* rows, int i) {
+        return Op::apply(ColumnReduce<Op, N - 1>::apply(rows, i),
+                _mm_loadu_si128((const __m128i*) (rows[N - 1] + i)));
+    }
+};
+
+template <class Op>
+struct ColumnReduce<Op, 1> {
+    static __m128i apply(const unsigned char* const* rows, int i) {
+        return _mm_loadu_si128((const __m128i*) (rows[0] + i));
+    }
+};
+#endif
+
+template <class Params>
+class MotionKernel {
+    public:
+        // Bytes of scratch memory morph and openClose need
+        static size_t scratchSize(const Params& p) {
+            int r = p.radius();
+            return ((size_t) (2 * r + 1) * (r + 1) + 1) *
+                (p.width() + 2 * r);
+        }
+
+        // diff = |frame - bgd|, bin = 255 where diff > thresh, else 0.
+        // With spans, row y is only computed over [span_begin[y],
+        // span_end[y]) and left untouched elsewhere.
+        static void diffThreshold(const Params& p,
+                const unsigned char* frame, size_t frame_step,
+                const unsigned char* bgd, size_t bgd_step,
+                unsigned char* diff, size_t diff_step,
+                unsigned char* bin, size_t bin_step,
+                const int* span_begin = NULL, const int* span_end = NULL) {
+            const int w = p.width();
+            const int h = p.height();
+            const unsigned char t = (unsigned char) p.thresh();
+            for (int y = 0; y < h; y++) {
+                const unsigned char* f = frame + y * frame_step;
+                const unsigned char* b = bgd + y * bgd_step;
+                unsigned char* d = diff + y * diff_step;
+                unsigned char* m = bin + y * bin_step;
+                int x = (span_begin != NULL) ? span_begin[y] : 0;
+                const int end = (span_end != NULL) ? span_end[y] : w;
+#ifdef __SSE2__
+                const __m128i vt = _mm_set1_epi8((char) t);
+                const __m128i zero = _mm_setzero_si128();
+                for (; x + 16 <= end; x += 16) {
+                    __m128i vf = _mm_loadu_si128((const __m128i*) (f + x));
+                    __m128i vb = _mm_loadu_si128((const __m128i*) (b + x));
+                    __m128i vd = _mm_or_si128(_mm_subs_epu8(vf, vb),
+                            _mm_subs_epu8(vb, vf));
+                    _mm_storeu_si128((__m128i*) (d + x), vd);
+                    // diff > t exactly where diff - t doesn't saturate
+                    // to zero
+                    __m128i below = _mm_cmpeq_epi8(
+                            _mm_subs_epu8(vd, vt), zero);
+                    _mm_storeu_si128((__m128i*) (m + x),
+                            _mm_andnot_si128(below, _mm_set1_epi8(-1)));
+                }
+#endif
+                for (; x < end; x++) {
+                    unsigned char v = f[x] > b[x] ? f[x] - b[x] : b[x] - f[x];
+                    d[x] = v;
+                    m[x] = v > t ? 255 : 0;
+                }
+            }
+        }
+
+        // Same with a threshold per pixel: bin = 255 where
+        // diff > thresh[x], p.thresh() is unused. A threshold of 255
+        // masks a pixel out.
+        static void diffThresholdPlane(const Params& p,
+                const unsigned char* frame, size_t frame_step,
+                const unsigned char* bgd, size_t bgd_step,
+                const unsigned char* thresh, size_t thresh_step,
+                unsigned char* diff, size_t diff_step,
+                unsigned char* bin, size_t bin_step,
+                const int* span_begin = NULL, const int* span_end = NULL) {
+            const int w = p.width();
+            const int h = p.height();
+            for (int y = 0; y < h; y++) {
+                const unsigned char* f = frame + y * frame_step;
+                const unsigned char* b = bgd + y * bgd_step;
+                const unsigned char* t = thresh + y * thresh_step;
+                unsigned char* d = diff + y * diff_step;
+                unsigned char* m = bin + y * bin_step;
+                int x = (span_begin != NULL) ? span_begin[y] : 0;
+                const int end = (span_end != NULL) ? span_end[y] : w;
+#ifdef __SSE2__
+                const __m128i zero = _mm_setzero_si128();
+                for (; x + 16 <= end; x += 16) {
+                    __m128i vf = _mm_loadu_si128((const __m128i*) (f + x));
+                    __m128i vb = _mm_loadu_si128((const __m128i*) (b + x));
+                    __m128i vt = _mm_loadu_si128((const __m128i*) (t + x));
+                    __m128i vd = _mm_or_si128(_mm_subs_epu8(vf, vb),
+                            _mm_subs_epu8(vb, vf));
+                    _mm_storeu_si128((__m128i*) (d + x), vd);
+                    __m128i below = _mm_cmpeq_epi8(
+                            _mm_subs_epu8(vd, vt), zero);
+                    _mm_storeu_si128((__m128i*) (m + x),
+                            _mm_andnot_si128(below, _mm_set1_epi8(-1)));
+                }
+#endif
+                for (; x < end; x++) {
+                    unsigned char v = f[x] > b[x] ? f[x] - b[x] : b[x] - f[x];
+                    d[x] = v;
+                    m[x] = v > t[x] ? 255 : 0;
+                }
+            }
+        }
+
+        // Erosion (MorphMinOp) or dilation (MorphMaxOp) of img in place
+        // with the elliptic element of radius p.radius().
+        //
+        // The element is split into rows: for every half width k the
+        // horizontal min/max over [x - k, x + k] is built from the one
+        // for k - 1, and each output row combines the 2r + 1 input
+        // rows around it at their half widths. Only the last 2r + 1
+        // input rows are kept, in a ring in scratch.
+        template <class Op>
+        static void morph(const Params& p, unsigned char* img, size_t step,
+                unsigned char* scratch) {
+            const int w = p.width();
+            const int h = p.height();
+            const int r = p.radius();
+            const int padded = w + 2 * r;
+            const int ring = 2 * r + 1;
+            if (r == 0) {
+                return;
+            }
+
+            int half_widths[2 * 64 + 1];
+            ellipseHalfWidths(r, half_widths);
+
+            unsigned char* identity_row =
+                scratch + (size_t) ring * (r + 1) * padded;
+            for (int i = 0; i < w; i++) {
+                identity_row[i] = Op::identity;
+            }
+
+            for (int y = 0; y < h + r; y++) {
+                if (y < h) {
+                    // Level 0 is the padded input row, level k its
+                    // min/max over [x - k, x + k]
+                    unsigned char* level =
+                        scratch + (size_t) (y % ring) * (r + 1) * padded;
+                    for (int i = 0; i < r; i++) {
+                        level[i] = Op::identity;
+                        level[r + w + i] = Op::identity;
+                    }
+                    copyRow(level + r, img + y * step, w);
+                    for (int k = 1; k <= r; k++) {
+                        combine3<Op>(level + k * padded + k,
+                                level + (k - 1) * padded + k,
+                                padded - 2 * k);
+                    }
+                }
+
+                int out_y = y - r;
+                if (out_y < 0) {
+                    continue;
+                }
+                // Rows of the element outside the image read the
+                // identity row kept after the ring
+                const unsigned char* rows[2 * 64 + 1];
+                for (int dy = -r; dy <= r; dy++) {
+                    int in_y = out_y + dy;
+                    if (in_y < 0 || in_y >= h) {
+                        rows[dy + r] = identity_row;
+                    } else {
+                        rows[dy + r] = scratch +
+                            ((size_t) (in_y % ring) * (r + 1) +
+                             half_widths[dy + r]) * padded + r;
+                    }
+                }
+                combineColumns<Op>(p, img + out_y * step, rows);
+            }
+        }
+
+        // Opening then closing, which drops specks and fills holes
+        static void openClose(const Params& p, unsigned char* bin,
+                size_t step, unsigned char* scratch) {
+            morph<MorphMinOp>(p, bin, step, scratch);
+            morph<MorphMaxOp>(p, bin, step, scratch);
+            morph<MorphMaxOp>(p, bin, step, scratch);
+            morph<MorphMinOp>(p, bin, step, scratch);
+        }
+
+    private:
+        // Row copy kept as an explicit loop; with a constant length GCC
+        // would otherwise expand memcpy into slow inline string moves
+        static void copyRow(unsigned char* dst, const unsigned char* src,
+                int n) {
+            int i = 0;
+#ifdef __SSE2__
+            for (; i + 16 <= n; i += 16) {
+                _mm_storeu_si128((__m128i*) (dst + i),
+                        _mm_loadu_si128((const __m128i*) (src + i)));
+            }
+#endif
+            for (; i < n; i++) {
+                dst[i] = src[i];
+            }
+        }
+
+        // dst[i] = op(rows[0][i], ..., rows[2r][i]). The accumulator
+        // stays in a register across all rows of the element; with a
+        // fixed radius the row loop is unrolled by ColumnReduce.
+        template <class Op>
+        static void combineColumns(const Params& p, unsigned char* dst,
+                const unsigned char* const* rows) {
+            const int w = p.width();
+            const int n = 2 * p.radius() + 1;
+            int i = 0;
+#ifdef __SSE2__
+            for (; i + 16 <= w; i += 16) {
+                __m128i acc;
+                if (Params::STATIC_RADIUS > 0) {
+                    acc = ColumnReduce<Op,
+                        2 * Params::STATIC_RADIUS + 1>::apply(rows, i);
+                } else {
+                    acc = _mm_loadu_si128((const __m128i*) (rows[0] + i));
+                    for (int j = 1; j < n; j++) {
+                        acc = Op::apply(acc, _mm_loadu_si128(
+                                    (const __m128i*) (rows[j] + i)));
+                    }
+                }
+                _mm_storeu_si128((__m128i*) (dst + i), acc);
+            }
+#endif
+            for (; i < w; i++) {
+                unsigned char acc = rows[0][i];
+                for (int j = 1; j < n; j++) {
+                    acc = Op::apply(acc, rows[j][i]);
+                }
+                dst[i] = acc;
+            }
+        }
+
+        // dst[i] = op(src[i - 1], src[i], src[i + 1])
+        template <class Op>
+        static void combine3(unsigned char* dst, const unsigned char* src,
+                int n) {
+            int i = 0;
+#ifdef __SSE2__
+            for (; i + 16 <= n; i += 16) {
+                __m128i l = _mm_loadu_si128((const __m128i*) (src + i - 1));
+                __m128i c = _mm_loadu_si128((const __m128i*) (src + i));
+                __m128i r = _mm_loadu_si128((const __m128i*) (src + i + 1));
+                _mm_storeu_si128((__m128i*) (dst + i),
+                        Op::apply(Op::apply(l, c), r));
+            }
+#endif
+            for (; i < n; i++) {
+                dst[i] = Op::apply(Op::apply(src[i - 1], src[i]), src[i + 1]);
+            }
+        }
+};
+
+#endif // MOTION_KERNELS_H
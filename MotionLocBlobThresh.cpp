@@ -6,19 +6,126 @@
 // When process frame is called, this thread holds rd locks on
 // _cur_frame_i and _cur_frame_i + 1
 bool MotionLocBlobThresh::processFrame() {
+    VideoFrame_t& this_frame = (*_frame_buffer)[_cur_frame_i];
+
+    // Under load detection drops to the next coarser level
+    int scale = (shedLevel() >= LoadShedder::SHED_MOTION_SCALE) ?
+        std::min(4, 2 * _base_scale) : _base_scale;
+    if (scale != _scale) {
+        applyScale(scale);
+    }
+
+    // Shared, read only reference to the current bgd, and its per pixel
+    // threshold if it has one
+    cv::Mat bgd;
+    cv::Mat thresh;
+    unsigned int bgd_version = 0;
+    if (!getBgd(&bgd, &thresh, &bgd_version)) {
+        return false;
+    }
+
+    // Nothing changed since the frame the last result was computed on,
+    // and the bgd is the same, so that result still holds
+    if (_have_result && 
+            this_frame.last_change_seq <= _result_seq &&
+            bgd_version == _result_bgd_version) {
+        recordFrame("motion", true);
+        return true;
+    }
+    recordFrame("motion", false);
+    _have_result = true;
+    _result_seq = this_frame.seq;
+    _result_bgd_version = bgd_version;
+
     cv::Mat mask(_frame_height, _frame_width, CV_8UC1,
             cv::Scalar(0));
-    cv::Mat bgd(_frame_height, _frame_width, CV_8UC1,
-            cv::Scalar(0));
-    getBgd(&bgd);
-    VideoFrame_t& this_frame = (*_frame_buffer)[_cur_frame_i];
+
+    // With zones the threshold is raised to 255 outside them, which
+    // keeps confirmTracks and refineBlobs inside the zones too
+    bool adaptive = !thresh.empty();
+    cv::Mat bgd_thresh = thresh;
+    if (_zones != NULL) {
+        if (_zone_thresh.empty() || bgd_version != _zone_thresh_version) {
+            zoneThreshold(bgd_thresh, _zone_mask, &_zone_thresh);
+            _zone_thresh_version = bgd_version;
+        }
+        thresh = _zone_thresh;
+    }
+
+    int rc = 0; 
+    if( (rc = pthread_rwlock_wrlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to lock on motion blobs mask.");
+    }
+    if (_frame_bus != NULL) {
+        _prev_tracker = _tracker;
+    }
+    _tracker.predict();
+    bool confirmed = false;
+    if (_frames_since_full < _full_detect_interval) {
+        confirmed = confirmTracks(this_frame.frame, bgd, thresh);
+    }
+    if( (rc = pthread_rwlock_unlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to unlock on motion blobs mask.");
+    }
+    // All tracks were found where predicted, so keep the last prob
+    // mask and blobs instead of running a full detection
+    if (confirmed) {
+        _frames_since_full++;
+        return true;
+    }
     
-    // Calculate motion probabilities
-    _motion_prob_y_diff.getMotionProbs(this_frame.frame, 
-            bgd, 
-            &mask);
+    // Difference, threshold, opening and closing in one kernel, on the
+    // downscaled level if one is configured. The structuring element
+    // shrinks with the level so it covers the same area of the scene.
+    int morph_size = std::max(1,
+            (adaptive ? _adaptive_morph_size : _morph_size) / _scale);
+    cv::Mat thresh_mask;
+    if (_scale == 1 && _zones != NULL) {
+        _motion_kernel.runZoned(this_frame.frame, bgd, thresh, morph_size,
+                _zone_mask, &_zone_diff, &_zone_bin);
+        mask = _zone_diff;
+        thresh_mask = _zone_bin;
+    } else if (_scale == 1) {
+        if (adaptive) {
+            _motion_kernel.runAdaptive(this_frame.frame, bgd, thresh,
+                    morph_size, &mask, &thresh_mask);
+        } else {
+            _motion_kernel.run(this_frame.frame, bgd, _diff_thresh,
+                    morph_size, &mask, &thresh_mask);
+        }
+    } else {
+        cv::Size small_size(_frame_width / _scale,
+                _frame_height / _scale);
+        cv::resize(this_frame.frame, _small_frame, small_size, 0, 0,
+                cv::INTER_AREA);
+        // The downscaled bgd is only redone when a new bgd is set
+        if (_small_bgd.empty() || bgd_version != _small_bgd_version) {
+            cv::resize(bgd, _small_bgd, small_size, 0, 0, cv::INTER_AREA);
+            if (adaptive) {
+                cv::resize(bgd_thresh, _small_thresh, small_size, 0, 0,
+                        cv::INTER_AREA);
+            } else {
+                _small_thresh.release();
+            }
+            if (_zones != NULL) {
+                zoneThreshold(_small_thresh, _small_zone_mask,
+                        &_small_thresh);
+            }
+            _small_bgd_version = bgd_version;
+        }
+        if (_zones != NULL) {
+            _motion_kernel.runZoned(_small_frame, _small_bgd, _small_thresh,
+                    morph_size, _small_zone_mask, &_small_mask, &_zone_bin);
+            thresh_mask = _zone_bin;
+        } else if (adaptive) {
+            _motion_kernel.runAdaptive(_small_frame, _small_bgd,
+                    _small_thresh, morph_size, &_small_mask, &thresh_mask);
+        } else {
+            _motion_kernel.run(_small_frame, _small_bgd, _diff_thresh,
+                    morph_size, &_small_mask, &thresh_mask);
+        }
+    }
    
-    int rc = 0; 
     if( (rc = pthread_rwlock_wrlock(&_last_prob_mask_lock)) != 0) {
         perror("unable to lock on last prob mask.");
     }
@@ -26,30 +133,71 @@ bool MotionLocBlobThresh::processFrame() {
         perror("unable to lock on motion blobs mask.");
     }
 
+    IplImage thresh_ipl = thresh_mask;
+    if (_scale == 1) {
+        cvLabel(&thresh_ipl, 
+                _label_img, 
+                _motion_blobs);
+    } else {
+        cvLabel(&thresh_ipl,
+                _small_label_img,
+                _motion_blobs);
+        refineBlobs(this_frame.frame, bgd, thresh, &mask);
+    }
+
     mask.copyTo(_last_prob_mask);
+    if (_compositor != NULL) {
+        _compositor->writePanel(DisplayCompositor::PANEL_PROB_MASK, mask);
+    }
 
-    cv::Mat thresh_mask;
-    cv::threshold(mask, thresh_mask, 6, 256, 0);    
-
-    int morph_size = 4;
-    cv::Mat element = cv::getStructuringElement(2, // ellipse
-            cv::Size(2 * morph_size + 1, 
-                2 * morph_size + 1), 
-            cv::Point( morph_size, morph_size));
-    cv::morphologyEx(thresh_mask, 
-            thresh_mask, 
-            2, //opening
-            element);
-    cv::morphologyEx(thresh_mask, 
-            thresh_mask, 
-            3,  // Closing
-            element);
- 
-
-    IplImage* thresh_ipl = new IplImage(thresh_mask);
-    cvLabel(thresh_ipl, 
-            _label_img, 
-            _motion_blobs);
+    _blob_zones.clear();
+    if (_zones != NULL) {
+        for (cvb::CvBlobs::const_iterator it = _motion_blobs.begin();
+                it != _motion_blobs.end(); ++it) {
+            _blob_zones[it->first] = blobZone(*it->second);
+        }
+    }
+    // Color statistics only when the source captured color anyway
+    cv::Mat labels(_frame_height, _frame_width, CV_32SC1,
+            _label_img->imageData, _label_img->widthStep);
+    computeBlobStats(labels, _motion_blobs, this_frame.frame,
+            this_frame.color_valid ? this_frame.color_frame : cv::Mat(),
+            mask, &_blob_stats);
+
+    _tracker.update(_motion_blobs);
+    _detection_seq = this_frame.seq;
+    _frames_since_full = 0;
+
+    if( (rc = pthread_rwlock_unlock(&_last_prob_mask_lock)) != 0) {
+        perror("unable to unlock on last prob mask.");
+    }
+    if( (rc = pthread_rwlock_unlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to unlock on motion blobs mask.");
+    }
+    return true;
+}
+
+
+void MotionLocBlobThresh::discardFrame() {
+    int rc = 0;
+    if( (rc = pthread_rwlock_wrlock(&_last_prob_mask_lock)) != 0) {
+        perror("unable to lock on last prob mask.");
+    }
+    if( (rc = pthread_rwlock_wrlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to lock on motion blobs mask.");
+    }
+
+    _tracker = _prev_tracker;
+    cvb::cvReleaseBlobs(_motion_blobs);
+    cvSetZero(_label_img);
+    _blob_zones.clear();
+    _blob_stats.clear();
+    _last_prob_mask.setTo(cv::Scalar(0));
+    // The next frame gets a full detection, and is never taken as
+    // unchanged from the torn one
+    _frames_since_full = _full_detect_interval;
+    _have_result = false;
+    _detection_seq = 0;
 
     if( (rc = pthread_rwlock_unlock(&_last_prob_mask_lock)) != 0) {
         perror("unable to unlock on last prob mask.");
@@ -57,9 +205,246 @@ bool MotionLocBlobThresh::processFrame() {
     if( (rc = pthread_rwlock_unlock(&_motion_blobs_lock)) != 0) {
         perror("unable to unlock on motion blobs mask.");
     }
+}
+
+// Sets the pyramid level motion is detected on: 1 for full
+// resolution, 2 or 4 for half or quarter. Must be called before the
+// processor is started.
+bool MotionLocBlobThresh::setScale(int scale) {
+    if (scale != 1 && scale != 2 && scale != 4) {
+        std::cout << "unsupported motion scale " << scale << std::endl;
+        return false;
+    }
+    _base_scale = scale;
+    applyScale(scale);
     return true;
 }
 
+void MotionLocBlobThresh::applyScale(int scale) {
+    if (_small_label_img != NULL) {
+        cvReleaseImage(&_small_label_img);
+    }
+    _scale = scale;
+    _small_bgd.release();
+    _small_thresh.release();
+    if (_scale > 1) {
+        _small_label_img = cvCreateImage(cvSize(_frame_width / _scale,
+                    _frame_height / _scale), IPL_DEPTH_LABEL, 1);
+    }
+    rasterizeZones();
+}
+
+void MotionLocBlobThresh::setZones(const ZoneMap* zones) {
+    _zones = zones;
+    rasterizeZones();
+}
+
+void MotionLocBlobThresh::rasterizeZones() {
+    // Derived thresholds are redone on the next frame
+    _zone_thresh.release();
+    _small_bgd.release();
+    if (_zones == NULL) {
+        return;
+    }
+    _zones->rasterize(cv::Size(_frame_width, _frame_height), 1,
+            &_zone_mask);
+    if (_scale > 1) {
+        _zones->rasterize(cv::Size(_frame_width / _scale,
+                    _frame_height / _scale), _scale, &_small_zone_mask);
+    }
+}
+
+void MotionLocBlobThresh::zoneThreshold(const cv::Mat& thresh,
+        const ZoneMask_t& zones, cv::Mat* dst) {
+    if (thresh.empty()) {
+        dst->create(zones.labels.size(), CV_8UC1);
+        dst->setTo(cv::Scalar(_diff_thresh));
+    } else if (thresh.data != dst->data) {
+        thresh.copyTo(*dst);
+    }
+    cv::max(*dst, zones.outside, *dst);
+}
+
+// Zone under the blob's centroid, or for blobs whose centroid falls
+// outside every zone, the zone of their first pixel. Called with
+// _motion_blobs_lock held after the label image is updated.
+int MotionLocBlobThresh::blobZone(const cvb::CvBlob& blob) {
+    const cv::Mat& zones = _zone_mask.labels;
+    int cx = (int) blob.centroid.x;
+    int cy = (int) blob.centroid.y;
+    if (cx >= 0 && cx < zones.cols && cy >= 0 && cy < zones.rows &&
+            zones.at<uchar>(cy, cx) != 0) {
+        return zones.at<uchar>(cy, cx);
+    }
+
+    cv::Mat labels(_frame_height, _frame_width, CV_32SC1,
+            _label_img->imageData, _label_img->widthStep);
+    int maxx = std::min((int) blob.maxx, _frame_width - 1);
+    int maxy = std::min((int) blob.maxy, _frame_height - 1);
+    for (int y = (int) blob.miny; y <= maxy; y++) {
+        const cvb::CvLabel* l = labels.ptr<cvb::CvLabel>(y);
+        const uchar* z = zones.ptr<uchar>(y);
+        for (int x = (int) blob.minx; x <= maxx; x++) {
+            if (l[x] == blob.label && z[x] != 0) {
+                return z[x];
+            }
+        }
+    }
+    return 0;
+}
+
+// Maps blobs found on the downscaled level back to full resolution.
+// The abs difference and threshold are evaluated only inside each
+// blob's upscaled bbox (plus one level pixel of margin), and a 3x3
+// opening drops the isolated noise pixels the coarse level averaged
+// away. Each blob's bbox, area and centroid are recomputed from the
+// pixels that remain and no earlier blob has claimed, and its label is
+// written into the full resolution label image; mask gets the full
+// resolution difference inside the bboxes and zero elsewhere, and with
+// zones only inside them. thresh is the per pixel threshold, or empty
+// to use _diff_thresh. Called with _motion_blobs_lock held.
+void MotionLocBlobThresh::refineBlobs(const cv::Mat& frame,
+        const cv::Mat& bgd, const cv::Mat& thresh, cv::Mat* mask) {
+    bool adaptive = !thresh.empty();
+    bool zoned = _zones != NULL;
+    mask->setTo(cv::Scalar(0));
+    cv::Mat labels(_frame_height, _frame_width, CV_32SC1,
+            _label_img->imageData, _label_img->widthStep);
+    labels.setTo(cv::Scalar(0));
+    cv::Rect frame_rect(0, 0, _frame_width, _frame_height);
+    if (_refine_element.empty()) {
+        _refine_element = cv::getStructuringElement(cv::MORPH_RECT,
+                cv::Size(3, 3));
+    }
+
+    for (cvb::CvBlobs::iterator it = _motion_blobs.begin();
+            it != _motion_blobs.end(); ++it) {
+        cvb::CvBlob* blob = it->second;
+        cv::Rect roi = cv::Rect(((int) blob->minx - 1) * _scale,
+                ((int) blob->miny - 1) * _scale,
+                ((int) (blob->maxx - blob->minx) + 3) * _scale,
+                ((int) (blob->maxy - blob->miny) + 3) * _scale) & frame_rect;
+
+        _refine_bin.create(roi.height, roi.width, CV_8UC1);
+        for (int y = roi.y; y < roi.y + roi.height; y++) {
+            const uchar* f = frame.ptr<uchar>(y);
+            const uchar* b = bgd.ptr<uchar>(y);
+            const uchar* t = adaptive ? thresh.ptr<uchar>(y) : NULL;
+            const uchar* o = zoned ? _zone_mask.outside.ptr<uchar>(y) : NULL;
+            uchar* m = mask->ptr<uchar>(y);
+            uchar* bin = _refine_bin.ptr<uchar>(y - roi.y);
+            for (int x = roi.x; x < roi.x + roi.width; x++) {
+                if (zoned && o[x] != 0) {
+                    bin[x - roi.x] = 0;
+                    continue;
+                }
+                int d = abs(f[x] - b[x]);
+                m[x] = d;
+                bin[x - roi.x] =
+                    d > (adaptive ? t[x] : _diff_thresh) ? 255 : 0;
+            }
+        }
+        cv::morphologyEx(_refine_bin, _refine_bin, cv::MORPH_OPEN,
+                _refine_element);
+
+        unsigned int count = 0;
+        double sum_x = 0;
+        double sum_y = 0;
+        int minx = roi.x + roi.width;
+        int miny = roi.y + roi.height;
+        int maxx = roi.x;
+        int maxy = roi.y;
+        for (int y = roi.y; y < roi.y + roi.height; y++) {
+            const uchar* bin = _refine_bin.ptr<uchar>(y - roi.y);
+            cvb::CvLabel* l = labels.ptr<cvb::CvLabel>(y);
+            for (int x = roi.x; x < roi.x + roi.width; x++) {
+                // Overlapping rois: the pixel stays with the first blob
+                if (bin[x - roi.x] != 0 && l[x] == 0) {
+                    l[x] = blob->label;
+                    count++;
+                    sum_x += x;
+                    sum_y += y;
+                    minx = std::min(minx, x);
+                    maxx = std::max(maxx, x);
+                    miny = std::min(miny, y);
+                    maxy = std::max(maxy, y);
+                }
+            }
+        }
+
+        if (count == 0) {
+            // Only the coarse level saw it, keep the scaled up blob
+            blob->minx *= _scale;
+            blob->miny *= _scale;
+            blob->maxx = blob->maxx * _scale + _scale - 1;
+            blob->maxy = blob->maxy * _scale + _scale - 1;
+            blob->area *= _scale * _scale;
+            blob->centroid.x *= _scale;
+            blob->centroid.y *= _scale;
+            continue;
+        }
+
+        blob->minx = minx;
+        blob->miny = miny;
+        blob->maxx = maxx;
+        blob->maxy = maxy;
+        blob->area = count;
+        blob->m10 = sum_x;
+        blob->m01 = sum_y;
+        blob->centroid.x = sum_x / count;
+        blob->centroid.y = sum_y / count;
+    }
+}
+
+// Cheap check of the predicted tracks. Only the pixels inside each
+// predicted bbox are differenced and thresholded; if every confirmed
+// track still shows enough motion there, the tracks are updated from
+// those pixels alone. thresh is as for refineBlobs. Called with
+// _motion_blobs_lock held.
+bool MotionLocBlobThresh::confirmTracks(const cv::Mat& frame,
+        const cv::Mat& bgd, const cv::Mat& thresh) {
+    const std::vector<BlobTrack_t>& tracks = _tracker.getTracks();
+    if (tracks.empty()) {
+        return false;
+    }
+
+    std::vector<cv::Point2f> centroids(tracks.size());
+    std::vector<cv::Rect> bboxes(tracks.size());
+    std::vector<unsigned int> areas(tracks.size());
+    for (size_t t = 0; t < tracks.size(); t++) {
+        if (!_tracker.isConfirmed(tracks[t])) {
+            return false;
+        }
+        cv::Rect roi = _tracker.predictedBbox(tracks[t], _confirm_margin);
+        if (roi.area() == 0) {
+            return false;
+        }
+
+        cv::absdiff(frame(roi), bgd(roi), _roi_diff);
+        if (thresh.empty()) {
+            cv::threshold(_roi_diff, _roi_diff, _diff_thresh, 255, 0);
+        } else {
+            cv::compare(_roi_diff, thresh(roi), _roi_diff, cv::CMP_GT);
+        }
+        cv::Moments m = cv::moments(_roi_diff, true);
+        if (m.m00 < _confirm_density * tracks[t].area) {
+            return false;
+        }
+
+        centroids[t] = cv::Point2f(roi.x + m.m10 / m.m00,
+                roi.y + m.m01 / m.m00);
+        bboxes[t] = cv::Rect(
+                (int) centroids[t].x - tracks[t].bbox.width / 2,
+                (int) centroids[t].y - tracks[t].bbox.height / 2,
+                tracks[t].bbox.width, tracks[t].bbox.height);
+        areas[t] = (unsigned int) m.m00;
+    }
+
+    for (size_t t = 0; t < centroids.size(); t++) {
+        _tracker.updateTrack(t, centroids[t], bboxes[t], areas[t]);
+    }
+    return true;
+}
 
 bool MotionLocBlobThresh::getLastProbMask(cv::Mat* dst) {
     int rc = 0;
@@ -89,6 +474,106 @@ bool MotionLocBlobThresh::getLastMotionBlobs(cvb::CvBlobs* blobs) {
     return true;
 }
 
+bool MotionLocBlobThresh::getBlobStats(
+        std::map<cvb::CvLabel, BlobStats_t>* stats) {
+    int rc = 0;
+    if( (rc = pthread_rwlock_rdlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to lock on motion blobs.");
+    }
+
+    *stats = _blob_stats;
+
+    if( (rc = pthread_rwlock_unlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to unlock on motion blobs.");
+    }
+    return true;
+}
+
+bool MotionLocBlobThresh::labelsAt(const std::vector<cv::Point2f>& pts,
+        unsigned long detection_seq,
+        std::vector<cvb::CvLabel>* labels) {
+    int rc = 0;
+    if( (rc = pthread_rwlock_rdlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to lock on motion blobs.");
+    }
+
+    labels->assign(pts.size(), 0);
+    if (detection_seq == 0 || detection_seq != _detection_seq) {
+        if( (rc = pthread_rwlock_unlock(&_motion_blobs_lock)) != 0) {
+            perror("unable to unlock on motion blobs.");
+        }
+        return false;
+    }
+    cv::Mat label_img(_frame_height, _frame_width, CV_32SC1,
+            _label_img->imageData, _label_img->widthStep);
+    for (size_t i = 0; i < pts.size(); i++) {
+        int x = (int) pts[i].x;
+        int y = (int) pts[i].y;
+        (*labels)[i] = (x >= 0 && x < _frame_width &&
+                y >= 0 && y < _frame_height) ?
+            label_img.ptr<cvb::CvLabel>(y)[x] : 0;
+    }
+
+    if( (rc = pthread_rwlock_unlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to unlock on motion blobs.");
+    }
+    return true;
+}
+
+bool MotionLocBlobThresh::getBlobZones(
+        std::map<cvb::CvLabel, int>* zones) {
+    int rc = 0;
+    if( (rc = pthread_rwlock_rdlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to lock on motion blobs.");
+    }
+
+    zones->clear();
+    for (cvb::CvBlobs::const_iterator it = _motion_blobs.begin();
+            it != _motion_blobs.end(); ++it) {
+        std::map<cvb::CvLabel, int>::const_iterator zone =
+            _blob_zones.find(it->first);
+        (*zones)[it->first] = (zone != _blob_zones.end()) ?
+            zone->second : 0;
+    }
+
+    if( (rc = pthread_rwlock_unlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to unlock on motion blobs.");
+    }
+    return true;
+}
+
+bool MotionLocBlobThresh::getTracks(std::vector<BlobTrack_t>* tracks) {
+    int rc = 0;
+    if( (rc = pthread_rwlock_rdlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to lock on motion blobs.");
+    }
+
+    *tracks = _tracker.getTracks();
+
+    if( (rc = pthread_rwlock_unlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to unlock on motion blobs.");
+    }
+    return true;
+}
+
+bool MotionLocBlobThresh::getTargetTrack(BlobTrack_t* target,
+        unsigned long* detection_seq) {
+    int rc = 0;
+    // Target selection remembers the chosen track, so take the write
+    // lock
+    if( (rc = pthread_rwlock_wrlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to lock on motion blobs.");
+    }
+
+    bool found = _tracker.selectTarget(target);
+    *detection_seq = _detection_seq;
+
+    if( (rc = pthread_rwlock_unlock(&_motion_blobs_lock)) != 0) {
+        perror("unable to unlock on motion blobs.");
+    }
+    return found;
+}
+
 // mat should be CV_U8C3 matrix
 bool MotionLocBlobThresh::annotateMatWithBlobs(cv::Mat* mat) {
     int rc = 0;
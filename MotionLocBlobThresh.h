@@ -2,11 +2,15 @@
 #define MOTION_LOC_BLOB_THRESH_H
 
 #include <opencv2/opencv.hpp>
+#include <map>
 #include <vector>
 
 #include "video_frame.h"
 #include "FrameProcessor.h"
-#include "MotionProbYDiff.h"
+#include "MotionMaskKernel.h"
+#include "BlobTracker.h"
+#include "ZoneMap.h"
+#include "BlobStats.h"
 #include "cvblob.h"
 
 class MotionLocBlobThresh : public FrameProcessor {
@@ -17,11 +21,29 @@ class MotionLocBlobThresh : public FrameProcessor {
                 int frame_height) :
             FrameProcessor(frame_buffer, buffer_length,
                     frame_width, frame_height), 
-            _motion_prob_y_diff(frame_width, frame_height),
             _last_prob_mask(cv::Mat(frame_height, 
                         frame_width, 
                         CV_8UC1, 
-                        cv::Scalar(0))) {
+                        cv::Scalar(0))),
+            _diff_thresh(6),
+            _morph_size(4),
+            _adaptive_morph_size(2),
+            _tracker(frame_width, frame_height),
+            _prev_tracker(frame_width, frame_height),
+            _frames_since_full(0),
+            _full_detect_interval(5),
+            _confirm_margin(4),
+            _confirm_density(0.3),
+            _scale(1),
+            _base_scale(1),
+            _small_bgd_version(0),
+            _small_label_img(NULL),
+            _zones(NULL),
+            _zone_thresh_version(0),
+            _have_result(false),
+            _result_seq(0),
+            _result_bgd_version(0),
+            _detection_seq(0) {
                 int rc = 0;
                 if( (rc = pthread_rwlock_init(&_motion_blobs_lock, 
                                 NULL)) != 0) {
@@ -40,27 +62,148 @@ class MotionLocBlobThresh : public FrameProcessor {
         ~MotionLocBlobThresh() {
             pthread_rwlock_destroy(&_motion_blobs_lock);
             pthread_rwlock_destroy(&_last_prob_mask_lock);
+            cvReleaseImage(&_label_img);
+            if (_small_label_img != NULL) {
+                cvReleaseImage(&_small_label_img);
+            }
         };
         
         virtual bool processFrame();
+        bool setScale(int scale);
+        // Only look for motion inside zones, see ZoneMap. Must be called
+        // before the processor is started.
+        void setZones(const ZoneMap* zones);
+        // 0 runs the full detection on every frame
+        void setFullDetectInterval(int interval) {
+            _full_detect_interval = interval;
+        };
         bool getLastProbMask(cv::Mat* dst);
         
         // Returns cvb::CvBlobs object with the blobs for all motion
         bool getLastMotionBlobs(cvb::CvBlobs* blobs);
+        // Zone id of each blob of getLastMotionBlobs by label, all 0
+        // without zones
+        bool getBlobZones(std::map<cvb::CvLabel, int>* zones);
+        // Appearance of each blob of getLastMotionBlobs by label
+        bool getBlobStats(std::map<cvb::CvLabel, BlobStats_t>* stats);
+        // Label of the blob under each of pts, 0 where there is none,
+        // in the label image of the full detection on frame
+        // detection_seq. Labels restart with every detection, so this
+        // is false, with all labels 0, once a later one replaced it.
+        bool labelsAt(const std::vector<cv::Point2f>& pts,
+                unsigned long detection_seq,
+                std::vector<cvb::CvLabel>* labels);
+        // Tracked blobs with stable ids
+        bool getTracks(std::vector<BlobTrack_t>* tracks);
+        // Whether a track from getTracks is seen often enough to be
+        // trusted
+        bool isConfirmed(const BlobTrack_t& track) const {
+            return _tracker.isConfirmed(track);
+        };
+        // Track the PTZ camera should follow, false if there is none.
+        // Also gives the frame of the full detection its label refers
+        // to, 0 before the first one.
+        bool getTargetTrack(BlobTrack_t* target,
+                unsigned long* detection_seq);
         bool annotateMatWithBlobs(cv::Mat* mat);
         
         bool findMaxLocation(cv::Mat mask,
                int num_locations, 
                cv::Point* dst_loc,
                cv::Point* dst_loc2); 
+    protected:
+        // Puts the tracker back to before the frame and drops its blobs
+        virtual void discardFrame();
     private:
-        MotionProbYDiff _motion_prob_y_diff;
+        bool confirmTracks(const cv::Mat& frame, const cv::Mat& bgd,
+                const cv::Mat& thresh);
+        void refineBlobs(const cv::Mat& frame, const cv::Mat& bgd,
+                const cv::Mat& thresh, cv::Mat* mask);
+        // Switches the level detection runs at, reallocating what
+        // depends on it
+        void applyScale(int scale);
+        void rasterizeZones();
+        // dst = thresh, or _diff_thresh if thresh is empty, raised to 255
+        // outside the zones
+        void zoneThreshold(const cv::Mat& thresh, const ZoneMask_t& zones,
+                cv::Mat* dst);
+        int blobZone(const cvb::CvBlob& blob);
+
+        MotionMaskKernel _motion_kernel;
         cv::Mat _last_prob_mask;
         cvb::CvBlobs _motion_blobs;
         IplImage* _label_img;
+        // Threshold on the abs difference to the bgd, used when the bgd
+        // comes without a per pixel threshold
+        int _diff_thresh;
+        // Radius of the opening/closing structuring element
+        int _morph_size;
+        // Same with a per pixel threshold, which leaves fewer noise
+        // specks for the opening to remove
+        int _adaptive_morph_size;
+
+        BlobTracker _tracker;
+        // Tracker as it was before the current frame, kept off a bus
+        // to undo a frame that turns out torn
+        BlobTracker _prev_tracker;
+        // Full detection is skipped while every track is confirmed
+        // inside its predicted bbox, but at least every
+        // _full_detect_interval frames so new objects are picked up
+        int _frames_since_full;
+        int _full_detect_interval;
+        // Pixels added around a predicted bbox when confirming
+        int _confirm_margin;
+        // Fraction of a track's area that must show motion inside its
+        // predicted bbox for it to count as confirmed
+        double _confirm_density;
+        // Scratch for confirmTracks
+        cv::Mat _roi_diff;
+
+        // Pyramid level divisor the coarse detection runs at, 1 for
+        // full resolution
+        int _scale;
+        // Level set with setScale; _scale goes below it while load is
+        // shed
+        int _base_scale;
+        cv::Mat _small_frame;
+        cv::Mat _small_bgd;
+        cv::Mat _small_thresh;
+        // Bgd version _small_bgd and _small_thresh were derived from
+        unsigned int _small_bgd_version;
+        cv::Mat _small_mask;
+        IplImage* _small_label_img;
+        // Scratch for refineBlobs: thresholded roi and the element it
+        // is opened with
+        cv::Mat _refine_bin;
+        cv::Mat _refine_element;
+
+        const ZoneMap* _zones;
+        // Zones at full resolution and at the downscaled level
+        ZoneMask_t _zone_mask;
+        ZoneMask_t _small_zone_mask;
+        // Full resolution threshold with the zones applied, and the bgd
+        // version it was derived from
+        cv::Mat _zone_thresh;
+        unsigned int _zone_thresh_version;
+        // Outputs of the zoned kernel, kept since it only writes inside
+        // the zones
+        cv::Mat _zone_diff;
+        cv::Mat _zone_bin;
+        std::map<cvb::CvLabel, int> _blob_zones;
+        std::map<cvb::CvLabel, BlobStats_t> _blob_stats;
+
+        // Frame and bgd version the current blobs were computed from,
+        // used to skip static frames
+        bool _have_result;
+        unsigned long _result_seq;
+        unsigned int _result_bgd_version;
+        // Frame of the full detection behind _label_img, _motion_blobs
+        // and the tracks' labels, 0 if there is none
+        unsigned long _detection_seq;
 
         pthread_rwlock_t _last_prob_mask_lock;
-        // Lock for _motion_blobs and _label_img
+        // Lock for _motion_blobs, _blob_zones, _blob_stats, _label_img,
+        // _detection_seq and _tracker
         pthread_rwlock_t _motion_blobs_lock;
 };
 
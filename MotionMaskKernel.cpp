@@ -0,0 +1,210 @@
+#include "MotionMaskKernel.h"
+#include "MotionKernels.h"
+
+// Largest radius the kernels' per row tables hold
+const static int MAX_RADIUS = 64;
+
+// Threshold and morphology radius MotionLocBlobThresh uses by default
+const static int DEFAULT_THRESH = 6;
+const static int DEFAULT_RADIUS = 4;
+// Radius it uses with a per pixel threshold, which already leaves
+// fewer specks to remove
+const static int ADAPTIVE_RADIUS = 2;
+
+template <class Params>
+void MotionMaskKernel::runWith(const Params& params,
+        const cv::Mat& frame, const cv::Mat& bgd,
+        const cv::Mat* thresh_plane,
+        cv::Mat* diff, cv::Mat* bin) {
+    size_t scratch_size = MotionKernel<Params>::scratchSize(params);
+    if (_scratch.size() < scratch_size) {
+        _scratch.resize(scratch_size);
+    }
+    if (thresh_plane == NULL) {
+        MotionKernel<Params>::diffThreshold(params,
+                frame.data, frame.step,
+                bgd.data, bgd.step,
+                diff->data, diff->step,
+                bin->data, bin->step);
+    } else {
+        MotionKernel<Params>::diffThresholdPlane(params,
+                frame.data, frame.step,
+                bgd.data, bgd.step,
+                thresh_plane->data, thresh_plane->step,
+                diff->data, diff->step,
+                bin->data, bin->step);
+    }
+    MotionKernel<Params>::openClose(params, bin->data, bin->step,
+            &_scratch[0]);
+}
+
+bool MotionMaskKernel::isSpecialized(int width, int height,
+        int thresh, int radius) {
+    return dispatchFixed(NULL, width, height, thresh, radius,
+            NULL, NULL, NULL, NULL, NULL);
+}
+
+bool MotionMaskKernel::checkArgs(const cv::Mat& frame, const cv::Mat& bgd,
+        int thresh, int radius, cv::Mat* diff, cv::Mat* bin) {
+    if (frame.type() != CV_8UC1 || bgd.type() != CV_8UC1 ||
+            frame.size() != bgd.size()) {
+        std::cout << "motion mask kernel needs equal size gray frames" <<
+            std::endl;
+        return false;
+    }
+    if (radius < 0 || radius > MAX_RADIUS || thresh < 0 || thresh > 255) {
+        std::cout << "unsupported motion mask radius " << radius <<
+            " or threshold " << thresh << std::endl;
+        return false;
+    }
+    diff->create(frame.rows, frame.cols, CV_8UC1);
+    bin->create(frame.rows, frame.cols, CV_8UC1);
+    return true;
+}
+
+bool MotionMaskKernel::run(const cv::Mat& frame, const cv::Mat& bgd,
+        int thresh, int radius,
+        cv::Mat* diff, cv::Mat* bin) {
+    if (!checkArgs(frame, bgd, thresh, radius, diff, bin)) {
+        return false;
+    }
+    if (!_force_generic && dispatchFixed(this, frame.cols, frame.rows,
+                thresh, radius, &frame, &bgd, NULL, diff, bin)) {
+        return true;
+    }
+    runWith(RuntimeMotionParams(frame.cols, frame.rows, thresh, radius),
+            frame, bgd, NULL, diff, bin);
+    return true;
+}
+
+bool MotionMaskKernel::runAdaptive(const cv::Mat& frame, const cv::Mat& bgd,
+        const cv::Mat& thresh, int radius,
+        cv::Mat* diff, cv::Mat* bin) {
+    if (!checkArgs(frame, bgd, 0, radius, diff, bin)) {
+        return false;
+    }
+    if (thresh.type() != CV_8UC1 || thresh.size() != frame.size()) {
+        std::cout << "motion mask threshold plane must match the frame" <<
+            std::endl;
+        return false;
+    }
+    // The threshold the instantiations are fixed on goes unused, any
+    // of them does
+    if (!_force_generic && dispatchFixed(this, frame.cols, frame.rows,
+                DEFAULT_THRESH, radius, &frame, &bgd, &thresh, diff, bin)) {
+        return true;
+    }
+    runWith(RuntimeMotionParams(frame.cols, frame.rows, 0, radius),
+            frame, bgd, &thresh, diff, bin);
+    return true;
+}
+
+bool MotionMaskKernel::runZoned(const cv::Mat& frame, const cv::Mat& bgd,
+        const cv::Mat& thresh, int radius, const ZoneMask_t& zones,
+        cv::Mat* diff, cv::Mat* bin) {
+    if (frame.type() != CV_8UC1 || bgd.type() != CV_8UC1 ||
+            frame.size() != bgd.size()) {
+        std::cout << "motion mask kernel needs equal size gray frames" <<
+            std::endl;
+        return false;
+    }
+    if (radius < 0 || radius > MAX_RADIUS) {
+        std::cout << "unsupported motion mask radius " << radius << std::endl;
+        return false;
+    }
+    if (thresh.type() != CV_8UC1 || thresh.size() != frame.size() ||
+            zones.labels.size() != frame.size()) {
+        std::cout << "motion mask threshold plane and zones must match "
+            "the frame" << std::endl;
+        return false;
+    }
+    diff->create(frame.rows, frame.cols, CV_8UC1);
+    bin->create(frame.rows, frame.cols, CV_8UC1);
+    if (zones.labels.data != _zoned_labels || diff->data != _zoned_diff ||
+            bin->data != _zoned_bin) {
+        diff->setTo(cv::Scalar(0));
+        bin->setTo(cv::Scalar(0));
+        _zoned_labels = zones.labels.data;
+        _zoned_diff = diff->data;
+        _zoned_bin = bin->data;
+    }
+    if (zones.active.area() == 0) {
+        return true;
+    }
+
+    RuntimeMotionParams params(frame.cols, frame.rows, 0, radius);
+    MotionKernel<RuntimeMotionParams>::diffThresholdPlane(params,
+            frame.data, frame.step,
+            bgd.data, bgd.step,
+            thresh.data, thresh.step,
+            diff->data, diff->step,
+            bin->data, bin->step,
+            &zones.span_begin[0], &zones.span_end[0]);
+
+    // Opening and closing reach 4 * radius, so with that margin around
+    // the active tiles, where bin is 0, the box gives the same result
+    // inside the zones as the whole frame would
+    int margin = 4 * radius;
+    cv::Rect box = cv::Rect(zones.active.x - margin,
+            zones.active.y - margin,
+            zones.active.width + 2 * margin,
+            zones.active.height + 2 * margin) &
+        cv::Rect(0, 0, frame.cols, frame.rows);
+    RuntimeMotionParams box_params(box.width, box.height, 0, radius);
+    size_t scratch_size =
+        MotionKernel<RuntimeMotionParams>::scratchSize(box_params);
+    if (_scratch.size() < scratch_size) {
+        _scratch.resize(scratch_size);
+    }
+    MotionKernel<RuntimeMotionParams>::openClose(box_params,
+            bin->ptr<unsigned char>(box.y) + box.x, bin->step,
+            &_scratch[0]);
+
+    // The dilations may have grown blobs out of the zones inside the
+    // box; bin is 0 or 255, so the saturating subtract clears those
+    cv::Mat box_bin = (*bin)(box);
+    cv::subtract(box_bin, zones.outside(box), box_bin);
+    return true;
+}
+
+// Instantiation for one fixed configuration, matched against the
+// arguments of run
+#define MOTION_MASK_CASE(W, H, THRESH, RADIUS) \
+    if (width == W && height == H && \
+            thresh == THRESH && radius == RADIUS) { \
+        if (kernel != NULL) { \
+            kernel->runWith(FixedMotionParams<W, H, THRESH, RADIUS>(), \
+                    *frame, *bgd, thresh_plane, diff, bin); \
+        } \
+        return true; \
+    }
+
+bool MotionMaskKernel::dispatchFixed(MotionMaskKernel* kernel,
+        int width, int height, int thresh, int radius,
+        const cv::Mat* frame, const cv::Mat* bgd,
+        const cv::Mat* thresh_plane,
+        cv::Mat* diff, cv::Mat* bin) {
+    // Full resolution
+    MOTION_MASK_CASE(352, 240, DEFAULT_THRESH, DEFAULT_RADIUS)
+    MOTION_MASK_CASE(640, 480, DEFAULT_THRESH, DEFAULT_RADIUS)
+    MOTION_MASK_CASE(1280, 720, DEFAULT_THRESH, DEFAULT_RADIUS)
+    // Half resolution, see MotionLocBlobThresh::setScale
+    MOTION_MASK_CASE(176, 120, DEFAULT_THRESH, DEFAULT_RADIUS / 2)
+    MOTION_MASK_CASE(320, 240, DEFAULT_THRESH, DEFAULT_RADIUS / 2)
+    MOTION_MASK_CASE(640, 360, DEFAULT_THRESH, DEFAULT_RADIUS / 2)
+    // Quarter resolution
+    MOTION_MASK_CASE(88, 60, DEFAULT_THRESH, DEFAULT_RADIUS / 4)
+    MOTION_MASK_CASE(160, 120, DEFAULT_THRESH, DEFAULT_RADIUS / 4)
+    MOTION_MASK_CASE(320, 180, DEFAULT_THRESH, DEFAULT_RADIUS / 4)
+    // Adaptive threshold at full and half resolution; at quarter it
+    // shares the radius 1 cases above
+    MOTION_MASK_CASE(352, 240, DEFAULT_THRESH, ADAPTIVE_RADIUS)
+    MOTION_MASK_CASE(640, 480, DEFAULT_THRESH, ADAPTIVE_RADIUS)
+    MOTION_MASK_CASE(1280, 720, DEFAULT_THRESH, ADAPTIVE_RADIUS)
+    MOTION_MASK_CASE(176, 120, DEFAULT_THRESH, ADAPTIVE_RADIUS / 2)
+    MOTION_MASK_CASE(320, 240, DEFAULT_THRESH, ADAPTIVE_RADIUS / 2)
+    MOTION_MASK_CASE(640, 360, DEFAULT_THRESH, ADAPTIVE_RADIUS / 2)
+    return false;
+}
+
+#undef MOTION_MASK_CASE
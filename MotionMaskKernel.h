@@ -0,0 +1,84 @@
+#ifndef MOTION_MASK_KERNEL_H
+#define MOTION_MASK_KERNEL_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "ZoneMap.h"
+
+// Runs the motion mask kernels of MotionKernels.h on cv::Mat frames.
+// The common frame sizes (352x240, 640x480 and 1280x720, and their
+// half and quarter levels for downscaled detection) with the default
+// threshold and morphology radius have their own instantiations with
+// every parameter fixed at compile time; anything else runs the
+// generic one. Adaptive runs, with a threshold per pixel, are
+// specialized on size and radius alone.
+class MotionMaskKernel {
+    public:
+        MotionMaskKernel() :
+            _force_generic(false),
+            _zoned_labels(NULL),
+            _zoned_diff(NULL),
+            _zoned_bin(NULL) {};
+
+        // diff gets |frame - bgd|, bin the mask of diff > thresh after
+        // an opening and a closing with an ellipse of the given radius.
+        // Both are allocated to the frame size if needed.
+        bool run(const cv::Mat& frame, const cv::Mat& bgd,
+                int thresh, int radius,
+                cv::Mat* diff, cv::Mat* bin);
+
+        // Same with a threshold per pixel, thresh is a CV_8UC1 plane
+        // the size of the frame
+        bool runAdaptive(const cv::Mat& frame, const cv::Mat& bgd,
+                const cv::Mat& thresh, int radius,
+                cv::Mat* diff, cv::Mat* bin);
+
+        // Same restricted to zones. thresh must be 255 outside them.
+        // The difference and threshold only run over the tiles holding
+        // zone pixels and the morphology over their bounding box, so
+        // the cost follows the zones' area. Pixels outside the zones
+        // are never written and stay 0, so diff and bin have to be
+        // kept between calls; they are cleared when allocated or when
+        // given other zones.
+        bool runZoned(const cv::Mat& frame, const cv::Mat& bgd,
+                const cv::Mat& thresh, int radius, const ZoneMask_t& zones,
+                cv::Mat* diff, cv::Mat* bin);
+
+        // Whether run has a specialized instantiation for these
+        // parameters
+        static bool isSpecialized(int width, int height,
+                int thresh, int radius);
+        // Always run the generic instantiation, for benchmarking
+        void setForceGeneric(bool force_generic) {
+            _force_generic = force_generic;
+        };
+
+    private:
+        bool checkArgs(const cv::Mat& frame, const cv::Mat& bgd,
+                int thresh, int radius, cv::Mat* diff, cv::Mat* bin);
+
+        // Runs the specialized instantiation for the configuration, or
+        // only reports whether there is one if kernel is NULL
+        static bool dispatchFixed(MotionMaskKernel* kernel,
+                int width, int height, int thresh, int radius,
+                const cv::Mat* frame, const cv::Mat* bgd,
+                const cv::Mat* thresh_plane,
+                cv::Mat* diff, cv::Mat* bin);
+
+        // thresh_plane NULL thresholds at params.thresh()
+        template <class Params>
+        void runWith(const Params& params,
+                const cv::Mat& frame, const cv::Mat& bgd,
+                const cv::Mat* thresh_plane,
+                cv::Mat* diff, cv::Mat* bin);
+
+        std::vector<unsigned char> _scratch;
+        bool _force_generic;
+        // Zones and buffers runZoned last cleared for
+        const unsigned char* _zoned_labels;
+        const unsigned char* _zoned_diff;
+        const unsigned char* _zoned_bin;
+};
+
+#endif // MOTION_MASK_KERNEL_H
@@ -1,9 +1,13 @@
 #include "MotionProbYDiff.h"
+#include "PixelKernels.h"
 
 bool MotionProbYDiff::getMotionProbs(const cv::Mat& frame, 
         const cv::Mat& bgd,
         cv::Mat* mask) {
-       
-    cv::absdiff(frame, bgd, *mask);
+    mask->create(frame.rows, frame.cols, CV_8UC1);
+    for (int y = 0; y < frame.rows; y++) {
+        absDiffRow(frame.ptr<unsigned char>(y), bgd.ptr<unsigned char>(y),
+                mask->ptr<unsigned char>(y), frame.cols);
+    }
     return true;
 }
@@ -0,0 +1,102 @@
+#include "PixelKernels.h"
+
+#include <math.h>
+
+// Build each kernel for several ISA levels and let the dynamic loader
+// pick one. NO_CPU_DISPATCH builds only the baseline version. Clones
+// are chosen by feature level rather than by CPU model: the resolver
+// only picks an arch=<cpu> clone on that exact model, but an
+// x86-64-vN clone on every CPU that has the level's features. GCC
+// before 12 has no levels to resolve on and gets no AVX-512 clone.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 12 && \
+    defined(__x86_64__) && !defined(NO_CPU_DISPATCH)
+#define PIXEL_KERNEL_LEVELS
+#define PIXEL_KERNEL __attribute__((target_clones("arch=x86-64-v4", \
+                "arch=x86-64-v3", "arch=x86-64-v2", "default")))
+#elif defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6 && \
+    defined(__x86_64__) && !defined(NO_CPU_DISPATCH)
+#define PIXEL_KERNEL_FEATURES
+#define PIXEL_KERNEL __attribute__((target_clones("avx2", "sse4.2", \
+                "default")))
+#else
+#define PIXEL_KERNEL
+#endif
+
+PIXEL_KERNEL
+void absDiffRow(const unsigned char* a, const unsigned char* b,
+        unsigned char* dst, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    }
+}
+
+PIXEL_KERNEL
+void accumulateRow(const unsigned char* src, uint16_t* sum, int n) {
+    for (int i = 0; i < n; i++) {
+        sum[i] += src[i];
+    }
+}
+
+PIXEL_KERNEL
+void averageRow(const uint16_t* sum, int count, unsigned char* dst, int n) {
+    float scale = 1.0f / count;
+    for (int i = 0; i < n; i++) {
+        // Rounded half to even like cvRound, which the float average
+        // this replaced went through
+        dst[i] = (unsigned char) (int) rintf(sum[i] * scale);
+    }
+}
+
+PIXEL_KERNEL
+void updateMeanVarRow(const unsigned char* src, uint16_t* mean,
+        uint16_t* var, int shift, int n) {
+    for (int i = 0; i < n; i++) {
+        int m = mean[i];
+        // Difference to the mean in Q4, squared into Q8, back to Q4
+        int d = ((src[i] << 8) - m) >> 4;
+        int d2 = (d * d) >> 4;
+        d2 = d2 < 65535 ? d2 : 65535;
+        mean[i] = (uint16_t) (m + (((src[i] << 8) - m) >> shift));
+        var[i] = (uint16_t) (var[i] + ((d2 - var[i]) >> shift));
+    }
+}
+
+PIXEL_KERNEL
+void meanVarToThresholdRow(const uint16_t* mean, const uint16_t* var,
+        float k, int min_thresh,
+        unsigned char* bgd, unsigned char* thresh, int n) {
+    float floor = (float) min_thresh;
+    for (int i = 0; i < n; i++) {
+        bgd[i] = (unsigned char) ((mean[i] + 128) >> 8);
+        float t = k * sqrtf(var[i] * (1.0f / 16)) + 0.5f;
+        t = t > floor ? t : floor;
+        t = t < 255.0f ? t : 255.0f;
+        thresh[i] = (unsigned char) t;
+    }
+}
+
+// The same predicates, in the same order, as the resolver of the
+// PIXEL_KERNEL clones
+const char* pixelKernelIsa() {
+#if defined(PIXEL_KERNEL_LEVELS)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("x86-64-v4")) {
+        return "x86-64-v4 (avx512)";
+    }
+    if (__builtin_cpu_supports("x86-64-v3")) {
+        return "x86-64-v3 (avx2)";
+    }
+    if (__builtin_cpu_supports("x86-64-v2")) {
+        return "x86-64-v2 (sse4.2)";
+    }
+#elif defined(PIXEL_KERNEL_FEATURES)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return "sse4.2";
+    }
+#endif
+    return "baseline";
+}
@@ -0,0 +1,37 @@
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include <stdint.h>
+
+// Per pixel loops of the bgd and motion processors. They are written
+// as plain loops for the compiler to vectorize and, where the compiler
+// supports it, built once per x86 ISA level; the best version for the
+// running CPU is picked when the program loads. One binary then uses
+// AVX-512 or AVX2 where the machine has it and still runs on machines
+// with nothing newer than SSE2.
+
+// dst = |a - b|
+void absDiffRow(const unsigned char* a, const unsigned char* b,
+        unsigned char* dst, int n);
+// sum += src
+void accumulateRow(const unsigned char* src, uint16_t* sum, int n);
+// dst = sum / count, rounded to nearest, ties to even
+void averageRow(const uint16_t* sum, int count, unsigned char* dst, int n);
+
+// Running background statistics in fixed point. mean is Q8.8 and var
+// Q12.4 (pixel units squared, saturating at 4095.9). Both move towards
+// the new frame by 2^-shift of the difference; a single sample's
+// contribution to the variance is capped so one outlier can't blow it
+// up.
+void updateMeanVarRow(const unsigned char* src, uint16_t* mean,
+        uint16_t* var, int shift, int n);
+// bgd = mean rounded to a pixel value, thresh = max(min_thresh,
+// k * sigma) capped at 255
+void meanVarToThresholdRow(const uint16_t* mean, const uint16_t* var,
+        float k, int min_thresh,
+        unsigned char* bgd, unsigned char* thresh, int n);
+
+// Widest instruction set the kernels use on this CPU, for logging
+const char* pixelKernelIsa();
+
+#endif // PIXEL_KERNELS_H
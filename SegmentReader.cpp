@@ -0,0 +1,160 @@
+#include "SegmentReader.h"
+
+#include <stdio.h>
+
+SegmentReader::SegmentReader(const std::vector<std::string>& segments,
+        const std::vector<long>& segment_frames,
+        int frame_width, int frame_height,
+        size_t prefetch) :
+    _segments(segments),
+    _segment_frames(segment_frames),
+    _frame_width(frame_width),
+    _frame_height(frame_height),
+    _prefetch(prefetch),
+    _begin(0),
+    _end(0),
+    _started(false),
+    _stop(false),
+    _done(false) {
+    int rc = 0;
+    if( (rc = pthread_mutex_init(&_lock, NULL)) != 0) {
+        perror("mutex initialization failed in segment reader constructor.");
+    }
+    if( (rc = pthread_cond_init(&_not_empty, NULL)) != 0) {
+        perror("cond initialization failed in segment reader constructor.");
+    }
+    if( (rc = pthread_cond_init(&_not_full, NULL)) != 0) {
+        perror("cond initialization failed in segment reader constructor.");
+    }
+}
+
+SegmentReader::~SegmentReader() {
+    if (_started) {
+        pthread_mutex_lock(&_lock);
+        _stop = true;
+        pthread_cond_broadcast(&_not_full);
+        pthread_mutex_unlock(&_lock);
+        pthread_join(_thread, NULL);
+    }
+    pthread_cond_destroy(&_not_full);
+    pthread_cond_destroy(&_not_empty);
+    pthread_mutex_destroy(&_lock);
+}
+
+bool SegmentReader::start(long begin, long end) {
+    if (_started) {
+        std::cout << "segment reader already started" << std::endl;
+        return false;
+    }
+    _begin = begin;
+    _end = end;
+    if (pthread_create(&_thread, NULL, &decodeThread, this)) {
+        perror("Could not create segment decode thread.");
+        return false;
+    }
+    _started = true;
+    return true;
+}
+
+bool SegmentReader::read(cv::Mat* frame, long* index) {
+    pthread_mutex_lock(&_lock);
+    while (_frames.empty() && !_done) {
+        pthread_cond_wait(&_not_empty, &_lock);
+    }
+    if (_frames.empty()) {
+        pthread_mutex_unlock(&_lock);
+        return false;
+    }
+    *frame = _frames.front().frame;
+    *index = _frames.front().index;
+    _frames.pop_front();
+    pthread_cond_signal(&_not_full);
+    pthread_mutex_unlock(&_lock);
+    return true;
+}
+
+void* SegmentReader::decodeThread(void* arg) {
+    ((SegmentReader*) arg)->decode();
+    return NULL;
+}
+
+bool SegmentReader::seek(long* index, cv::VideoCapture* cap, int* segment,
+        long* first) {
+    *first = 0;
+    for (size_t i = 0; i < _segments.size(); i++) {
+        if (*index < *first + _segment_frames[i]) {
+            if (!cap->open(_segments[i])) {
+                std::cout << "unable to open " << _segments[i] << std::endl;
+                return false;
+            }
+            // Seeking lands on the nearest preceding keyframe and decodes
+            // forward from there with most codecs; where it really
+            // landed is taken from the container
+            if (*index > *first) {
+                cap->set(CV_CAP_PROP_POS_FRAMES, (double) (*index - *first));
+                double pos = cap->get(CV_CAP_PROP_POS_FRAMES);
+                if (pos >= 0) {
+                    *index = *first + (long) pos;
+                }
+            }
+            *segment = i;
+            return true;
+        }
+        *first += _segment_frames[i];
+    }
+    return false;
+}
+
+void SegmentReader::decode() {
+    cv::VideoCapture cap;
+    int segment = 0;
+    long first = 0;
+    long index = _begin;
+    bool ok = seek(&index, &cap, &segment, &first);
+    cv::Mat color;
+    while (ok && index < _end) {
+        if (index >= first + _segment_frames[segment] || !cap.read(color)) {
+            // End of this segment by its count or by its data, continue
+            // with the next one at its planned first frame
+            first += _segment_frames[segment];
+            segment++;
+            if (segment >= (int) _segments.size() ||
+                    !cap.open(_segments[segment])) {
+                break;
+            }
+            index = first;
+            continue;
+        }
+
+        cv::Mat gray;
+        if (color.channels() == 3) {
+            cv::cvtColor(color, gray, CV_BGR2GRAY);
+        } else {
+            gray = color.clone();
+        }
+        if (gray.cols != _frame_width || gray.rows != _frame_height) {
+            cv::resize(gray, gray, cv::Size(_frame_width, _frame_height),
+                    0, 0, cv::INTER_AREA);
+        }
+
+        pthread_mutex_lock(&_lock);
+        while (_frames.size() >= _prefetch && !_stop) {
+            pthread_cond_wait(&_not_full, &_lock);
+        }
+        if (_stop) {
+            pthread_mutex_unlock(&_lock);
+            break;
+        }
+        DecodedFrame_t decoded;
+        decoded.frame = gray;
+        decoded.index = index++;
+        _frames.push_back(decoded);
+        pthread_cond_signal(&_not_empty);
+        pthread_mutex_unlock(&_lock);
+    }
+
+    pthread_mutex_lock(&_lock);
+    _done = true;
+    pthread_cond_broadcast(&_not_empty);
+    pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,73 @@
+#ifndef SEGMENT_READER_H
+#define SEGMENT_READER_H
+
+#include <opencv2/opencv.hpp>
+#include <deque>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// Prefetching reader over a recording split into segment files. The
+// frames of all segments are numbered consecutively; start() decodes a
+// range of them on a thread of its own into a bounded queue of gray
+// frames, so decoding overlaps the processing of earlier frames.
+//
+// Frame counts and seeks are only as exact as the container makes
+// them. Numbering restarts at each segment's planned first frame, so
+// an error in one segment's count never shifts the frames of the
+// next: frames past a segment's count are dropped, and a segment that
+// ends early leaves a gap in the numbers.
+class SegmentReader {
+    public:
+        // segment_frames holds the frame count of each segment; frames
+        // not width x height are resized
+        SegmentReader(const std::vector<std::string>& segments,
+                const std::vector<long>& segment_frames,
+                int frame_width, int frame_height,
+                size_t prefetch);
+        ~SegmentReader();
+
+        // Starts decoding frames [begin, end)
+        bool start(long begin, long end);
+        // Waits for the next frame; false once the range is done or
+        // decoding failed. The first frames may come from before the
+        // range's begin, where the seek landed.
+        bool read(cv::Mat* frame, long* index);
+
+    private:
+        typedef struct DecodedFrame {
+            cv::Mat frame;
+            long index;
+        } DecodedFrame_t;
+
+        static void* decodeThread(void* arg);
+        void decode();
+        // Opens the segment holding frame index and seeks to it. On
+        // return segment is the segment, first its first frame and
+        // index the frame the next read returns, as far as the
+        // container reports it.
+        bool seek(long* index, cv::VideoCapture* cap, int* segment,
+                long* first);
+
+        const std::vector<std::string>& _segments;
+        const std::vector<long>& _segment_frames;
+        int _frame_width;
+        int _frame_height;
+        size_t _prefetch;
+
+        long _begin;
+        long _end;
+        bool _started;
+        // Set by the destructor to stop the decoder early
+        bool _stop;
+        // Set by the decoder when it is done
+        bool _done;
+        std::deque<DecodedFrame_t> _frames;
+
+        pthread_t _thread;
+        pthread_mutex_t _lock;
+        pthread_cond_t _not_empty;
+        pthread_cond_t _not_full;
+};
+
+#endif // SEGMENT_READER_H
@@ -0,0 +1,54 @@
+#include "StaticFrameDetector.h"
+
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const static int BLOCK_SIZE = 8;
+
+// SADs of the left and right 8 pixel halves of a 16 pixel row segment
+static inline void rowSad(const uchar* a, const uchar* b,
+        unsigned int* left, unsigned int* right) {
+#ifdef __SSE2__
+    __m128i va = _mm_loadu_si128((const __m128i*) a);
+    __m128i vb = _mm_loadu_si128((const __m128i*) b);
+    __m128i sad = _mm_sad_epu8(va, vb);
+    *left += _mm_cvtsi128_si32(sad);
+    *right += _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+#else
+    for (int x = 0; x < BLOCK_SIZE; x++) {
+        *left += abs(a[x] - b[x]);
+        *right += abs(a[x + BLOCK_SIZE] - b[x + BLOCK_SIZE]);
+    }
+#endif
+}
+
+bool StaticFrameDetector::isStatic(const cv::Mat& frame,
+        const cv::Mat& prev_frame) const {
+    if (frame.empty() || prev_frame.empty() ||
+            frame.rows != prev_frame.rows ||
+            frame.cols != prev_frame.cols) {
+        return false;
+    }
+
+    int pairs_x = frame.cols / (2 * BLOCK_SIZE);
+    unsigned int max_sad = _block_thresh * BLOCK_SIZE * BLOCK_SIZE;
+
+    // Partial blocks at the right and bottom edges are not checked
+    for (int by = 0; by + BLOCK_SIZE <= frame.rows; by += BLOCK_SIZE) {
+        for (int px = 0; px < pairs_x; px++) {
+            unsigned int left = 0;
+            unsigned int right = 0;
+            for (int y = by; y < by + BLOCK_SIZE; y++) {
+                rowSad(frame.ptr<uchar>(y) + px * 2 * BLOCK_SIZE,
+                        prev_frame.ptr<uchar>(y) + px * 2 * BLOCK_SIZE,
+                        &left, &right);
+            }
+            if (left > max_sad || right > max_sad) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
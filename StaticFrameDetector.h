@@ -0,0 +1,35 @@
+#ifndef STATIC_FRAME_DETECTOR_H
+#define STATIC_FRAME_DETECTOR_H
+
+#include <opencv2/opencv.hpp>
+
+// Cheap global change check between two grayscale frames. Every row is
+// compared with a SIMD sum of absolute differences, summed over 8x8
+// blocks. A frame is static when no block's mean difference exceeds the
+// threshold. What a block catches is a summed difference, so an object
+// is only seen if its part within one block differs by more than 64
+// times the threshold in total: at the default of 4, a 4x4 object
+// inside one block must differ by more than 16, and smaller or fainter
+// objects, or ones split over block boundaries, can go unnoticed.
+//
+// Blocks are 16 columns wide in pairs, so columns past the last
+// multiple of 16 and rows past the last multiple of 8 are not checked.
+class StaticFrameDetector {
+    public:
+        StaticFrameDetector() :
+            _block_thresh(4) {};
+
+        // Mean abs difference per pixel a block may have and still
+        // count as unchanged
+        void setBlockThreshold(int thresh) {
+            _block_thresh = thresh;
+        };
+
+        // Both frames must be CV_8UC1 of the same size
+        bool isStatic(const cv::Mat& frame, const cv::Mat& prev_frame) const;
+
+    private:
+        int _block_thresh;
+};
+
+#endif // STATIC_FRAME_DETECTOR_H
@@ -2,40 +2,102 @@
 #include <opencv2/opencv.hpp>
 #include <pthread.h>
 #include <vector>
+#include <fstream>
 
 #include <curlpp/cURLpp.hpp>
 #include <curlpp/Easy.hpp>
 #include <curlpp/Options.hpp>
 
+#include <ctype.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "video_frame.h"
+#include "Config.h"
+#include "DisplayCompositor.h"
+#include "MjpegServer.h"
+#include "BackgroundStore.h"
+#include "FrameQueue.h"
+#include "BatchAnalyzer.h"
 #include "BgdCapturerAverage.h"
+#include "BgdCapturerRunning.h"
+#include "BgdCheckpoint.h"
 #include "MotionLocBlobThresh.h"
+#include "ZoneMap.h"
 #include "IPCamProcessor.h"
+#include "MjpegStreamReader.h"
+#include "CaptureSource.h"
+#include "CaptureSourceOpenCV.h"
+#include "CaptureSourceV4L2.h"
+#include "CaptureSourceYuvFile.h"
+#include "CaptureSourceSynthetic.h"
+#include "FramePool.h"
+#include "FrameHistory.h"
+#include "FrameBus.h"
+#include "LoadShedder.h"
+#include "ThreadPlacement.h"
+#include "JitterProbe.h"
+#include "Metrics.h"
+#include "PixelKernels.h"
+#include "StaticFrameDetector.h"
 #include "cvblob.h"
 
 // Height and width of frame in pixels
 const static int FRAME_HEIGHT = 240;
 const static int FRAME_WIDTH = 352;
 
-// Length of video frame buffer
-const static int FRAME_BUFLEN = 100;
+// Smallest frame buffer the processors can work with
+const static int MIN_FRAME_BUFLEN = 8;
 
 // Number of frames per background
 const static int FRAMES_PER_BGD = 20;
 
 // The index to which the current frame is being written
 static int cur_frame_i = 0;
-static std::vector<VideoFrame_t> video_frame_buffer(sizeof(VideoFrame_t));
+// Sized from the config in main
+static std::vector<VideoFrame_t> video_frame_buffer;
+
+// Set on SIGINT so headless runs can shut down cleanly
+static volatile sig_atomic_t exit_requested = 0;
+
+void handle_sigint(int sig) {
+    exit_requested = 1;
+}
+
+// Tells the processors reading the frames at prev_i and cur_i to exit
+void signal_thread_exit(int prev_i, int cur_i) {
+    int rc = 0;
+    if( (rc = pthread_rwlock_wrlock(
+                    video_frame_buffer[prev_i].rw_lock)) != 0) {
+        perror ("Failed to acquire write lock on prev video frame.");
+    }
+    if( (rc = pthread_rwlock_wrlock(
+                    video_frame_buffer[cur_i].rw_lock)) != 0) {
+        perror ("Failed to acquire write lock on cur video frame.");
+    }
+
+    // TODO: check if these both refer to same frame
+    video_frame_buffer[prev_i].exit_thread = true;
+    video_frame_buffer[cur_i].exit_thread = true;
+
+    if( (rc = pthread_rwlock_unlock(
+                    video_frame_buffer[prev_i].rw_lock)) != 0) {
+        perror ("Failed to acquire write lock on prev video frame.");
+    }
+    if( (rc = pthread_rwlock_unlock(
+                    video_frame_buffer[cur_i].rw_lock)) != 0) {
+        perror ("Failed to acquire write lock on cur video frame.");
+    }
+}
 
 // Background capture thread
 // Will have access to data in video_frame_buffer 
 void* capture_background(void* arg) {
-	BgdCapturerAverage* bgdCapturerAverage =
-		(BgdCapturerAverage*) arg;
-    if(!bgdCapturerAverage->runInThread()) {
+	FrameProcessor* bgdCapturer =
+		(FrameProcessor*) arg;
+    if(!bgdCapturer->runInThread()) {
 		perror("Error capturing background");
 		return NULL;
 	}
@@ -67,19 +129,451 @@ void* locate_motion(void* arg) {
 	return NULL;	
 }
 
+// Display thread
+// Shows the compositor canvas at its own rate
+void* run_display(void* arg) {
+    DisplayCompositor* displayCompositor =
+        (DisplayCompositor*) arg;
+    if(!displayCompositor->runInThread()) {
+        perror("Error running display");
+        return NULL;
+    }
+    return NULL;
+}
+
+// Whether capture renders a synthetic scene, ip camera view included
+bool synthetic_capture(const SystemConfig_t& config) {
+    return config.capture_source == "synthetic";
+}
+
+// Opens the webcam through OpenCV, a /dev/video* device through V4L2
+// directly, the video file or raw yuv recording given as capture
+// source, or a synthetic scene. Recordings are paced at replay_fps,
+// OpenCV webcams at capture_fps.
+CaptureSource* open_capture_source(const SystemConfig_t& config) {
+    const std::string& source = config.capture_source;
+    if (synthetic_capture(config)) {
+        SyntheticSceneParams_t params;
+        params.width = FRAME_WIDTH;
+        params.height = FRAME_HEIGHT;
+        params.num_objects = config.synthetic_objects;
+        params.noise_sigma = config.synthetic_noise;
+        params.drift = config.synthetic_drift;
+        return new CaptureSourceSynthetic(params, config.synthetic_fps);
+    }
+    if (source.size() > 4 && 
+            source.compare(source.size() - 4, 4, ".yuv") == 0) {
+        int pixel_format = 
+            CaptureSourceYuvFile::parsePixelFormat(config.capture_format);
+        if (pixel_format < 0) {
+            std::cout << "unknown capture format " << 
+                config.capture_format << std::endl;
+            return NULL;
+        }
+        CaptureSourceYuvFile* yuv_source = new CaptureSourceYuvFile(
+                source, pixel_format, FRAME_WIDTH, FRAME_HEIGHT);
+        if (!yuv_source->isOpened()) {
+            delete yuv_source;
+            return NULL;
+        }
+        yuv_source->setFps(config.replay_fps);
+        return yuv_source;
+    }
+    if (source.compare(0, 10, "/dev/video") == 0) {
+        CaptureSourceV4L2* v4l2_source = new CaptureSourceV4L2(source,
+                CaptureSourceYuvFile::parsePixelFormat(config.capture_format),
+                FRAME_WIDTH, FRAME_HEIGHT);
+        if (!v4l2_source->isOpened()) {
+            delete v4l2_source;
+            return NULL;
+        }
+        // Processes attached to the bus only see the frame pool
+        v4l2_source->setCopyFrames(!config.bus.empty());
+        return v4l2_source;
+    }
+    if (source.find_first_not_of("0123456789") != std::string::npos) {
+        CaptureSourceOpenCV* file_source = new CaptureSourceOpenCV(source,
+                FRAME_WIDTH, FRAME_HEIGHT);
+        if (!file_source->isOpened()) {
+            delete file_source;
+            return NULL;
+        }
+        file_source->setFps(config.replay_fps);
+        return file_source;
+    }
+    // cv::VideoCapture may hand out the last frame again without
+    // waiting for a new one, so webcams are paced too
+    CaptureSourceOpenCV* webcam_source = new CaptureSourceOpenCV(
+            atoi(source.c_str()), FRAME_WIDTH, FRAME_HEIGHT);
+    webcam_source->setFps(config.capture_fps);
+    return webcam_source;
+}
+
+// Checkpoint file of the background model, one per capture source
+std::string bgd_checkpoint_path(const SystemConfig_t& config) {
+    if (!config.bgd_checkpoint.empty()) {
+        return config.bgd_checkpoint;
+    }
+    std::string name = config.capture_source;
+    for (size_t i = 0; i < name.size(); i++) {
+        if (!isalnum((unsigned char) name[i])) {
+            name[i] = '_';
+        }
+    }
+    return "bgd-" + name + ".ckpt";
+}
+
+// Cores of the capture loop and of the processors from config. Without
+// worker cpus the processors get every core the process may use but
+// the capture ones.
+bool placement_cpus(const SystemConfig_t& config,
+        std::vector<int>* capture_cpus, std::vector<int>* worker_cpus) {
+    if (!parseCpuList(config.capture_cpus, capture_cpus) ||
+            !parseCpuList(config.worker_cpus, worker_cpus)) {
+        return false;
+    }
+    if (worker_cpus->empty() && !capture_cpus->empty()) {
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            perror("unable to get cpu affinity");
+            return false;
+        }
+        for (size_t i = 0; i < capture_cpus->size(); i++) {
+            CPU_CLR((*capture_cpus)[i], &allowed);
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                worker_cpus->push_back(cpu);
+            }
+        }
+        if (worker_cpus->empty()) {
+            std::cout << "no cores left for the processors" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether config sets any latency budget for a LoadShedder to keep
+bool load_shedding(const SystemConfig_t& config) {
+    return config.latency_budget_ms > 0 || config.ip_latency_budget_ms > 0;
+}
+
+// Background model chosen in config, restored from bgdCheckpoint if it
+// has one; NULL for an unknown model
+FrameProcessor* create_bgd_capturer(const SystemConfig_t& config,
+        int buffer_length, BackgroundStore* bgdStore,
+        DisplayCompositor* displayCompositor, BgdCheckpoint* bgdCheckpoint) {
+    FrameProcessor* bgdCapturer = NULL;
+    bool restored = false;
+    if (config.bgd_model == "running") {
+        BgdCapturerRunning* running = new BgdCapturerRunning(
+                &video_frame_buffer,
+                buffer_length,
+                FRAME_WIDTH,
+                FRAME_HEIGHT);
+        running->setBackgroundStore(bgdStore);
+        running->setCompositor(displayCompositor);
+        running->setCheckpoint(bgdCheckpoint);
+        restored = running->restoreCheckpoint();
+        bgdCapturer = running;
+    } else if (config.bgd_model == "average") {
+        BgdCapturerAverage* average = new BgdCapturerAverage(
+                &video_frame_buffer,
+                buffer_length, 
+                FRAME_WIDTH, 
+                FRAME_HEIGHT, 
+                FRAMES_PER_BGD);
+        average->setBackgroundStore(bgdStore);
+        average->setCompositor(displayCompositor);
+        average->setCheckpoint(bgdCheckpoint);
+        restored = average->restoreCheckpoint();
+        bgdCapturer = average;
+    } else {
+        std::cout << "unknown bgd model " << config.bgd_model << std::endl;
+        return NULL;
+    }
+    if (restored) {
+        std::cout << "bgd restored from " << bgd_checkpoint_path(config) <<
+            std::endl;
+    }
+    return bgdCapturer;
+}
+
+// Offline analysis of config.batch_input, see BatchAnalyzer
+int run_batch(const SystemConfig_t& config) {
+    BatchAnalyzer analyzer;
+    if (config.batch_threads > 0) {
+        analyzer.setThreads(config.batch_threads);
+    }
+    analyzer.setMotionScale(config.motion_scale);
+    ZoneMap zones;
+    if (!config.zones.empty()) {
+        if (!zones.load(config.zones)) {
+            return -1;
+        }
+        analyzer.setZones(&zones);
+    }
+    if (!analyzer.addInput(config.batch_input)) {
+        return -1;
+    }
+
+    if (config.batch_log.empty()) {
+        return analyzer.run(std::cout) ? 0 : -1;
+    }
+    std::ofstream log(config.batch_log.c_str());
+    if (!log) {
+        perror(config.batch_log.c_str());
+        return -1;
+    }
+    return analyzer.run(log) ? 0 : -1;
+}
+
+// Runs the processors in this process on the frames a capture process
+// publishes on the bus config.attach, see FrameBus. The pixels are read
+// in place from the shared arena.
+int run_attached(const SystemConfig_t& config) {
+    // No capture here, the whole process runs on the worker cores
+    std::vector<int> capture_cpus;
+    std::vector<int> worker_cpus;
+    if (!placement_cpus(config, &capture_cpus, &worker_cpus) ||
+            !placeCurrentThread("processors", worker_cpus, 0)) {
+        return -1;
+    }
+
+    FrameBus frameBus;
+    if (!frameBus.attach(config.attach)) {
+        return -1;
+    }
+    const FrameBusLayout_t& layout = frameBus.layout();
+    if (layout.frame_width != FRAME_WIDTH ||
+            layout.frame_height != FRAME_HEIGHT) {
+        std::cout << "frame bus carries " << layout.frame_width << "x" <<
+            layout.frame_height << " frames" << std::endl;
+        return -1;
+    }
+    // Frames in flight must stay within the half of the ring the bus
+    // keeps readers in
+    const int frame_buflen = layout.num_slots;
+    if (config.pipeline_depth < 1 ||
+            3 * (config.pipeline_depth + 1) + 1 > frame_buflen / 2) {
+        std::cout << "pipeline depth must be between 1 and " <<
+            (frame_buflen / 2 - 1) / 3 - 1 << std::endl;
+        return -1;
+    }
+
+    FramePool framePool(frame_buflen, layout.pixel_format,
+            FRAME_WIDTH, FRAME_HEIGHT, layout.ip_width, layout.ip_height);
+    if (framePool.requiredSize() > frameBus.arenaSize()) {
+        std::cout << "frame bus arena is too small" << std::endl;
+        return -1;
+    }
+    framePool.useArena(frameBus.arena(), frameBus.arenaSize());
+
+    // Slot locks are local: they order this process's stages, the
+    // writer never waits on readers
+    int rc = 0;
+    video_frame_buffer.resize(frame_buflen);
+    for (int i = 0; i < frame_buflen; i++) {
+        framePool.bindSlot(i, &video_frame_buffer[i], false);
+        video_frame_buffer[i].timestamp = time_t();
+        video_frame_buffer[i].seq = 0;
+        video_frame_buffer[i].last_change_seq = 0;
+        video_frame_buffer[i].ip_last_change_seq = 0;
+        pthread_rwlock_t* rw_lock = 
+            (pthread_rwlock_t*) malloc(sizeof(pthread_rwlock_t));
+        if( (rc = pthread_rwlock_init(rw_lock, NULL)) != 0) {
+            perror("rwlock initialization failed.");
+        }
+        video_frame_buffer[i].rw_lock = rw_lock; 
+        video_frame_buffer[i].exit_thread = false;
+    }
+
+    BackgroundStore bgdStore(FRAME_WIDTH, FRAME_HEIGHT);
+    FrameQueue bgdQueue("bgd", config.pipeline_depth);
+    FrameQueue motionQueue("motion", config.pipeline_depth);
+    FrameQueue matchQueue("match", config.pipeline_depth);
+
+    BgdCheckpoint* bgdCheckpoint = NULL;
+    if (config.bgd_checkpoint != "none") {
+        bgdCheckpoint = new BgdCheckpoint(bgd_checkpoint_path(config),
+                FRAME_WIDTH, FRAME_HEIGHT);
+        if (!bgdCheckpoint->start()) {
+            delete bgdCheckpoint;
+            bgdCheckpoint = NULL;
+        }
+    }
+    LoadShedder loadShedder(config.latency_budget_ms,
+            config.ip_latency_budget_ms);
+    LoadShedder* shedder = load_shedding(config) ? &loadShedder : NULL;
+    FrameProcessor* bgdCapturer = create_bgd_capturer(config, frame_buflen,
+            &bgdStore, NULL, bgdCheckpoint);
+    if (bgdCapturer == NULL) {
+        return -1;
+    }
+    bgdCapturer->setPipelineQueues(&bgdQueue, &motionQueue);
+    bgdCapturer->setLoadShedder(shedder, LoadShedder::STAGE_BGD);
+    bgdCapturer->setFrameBus(&frameBus);
+
+    MotionLocBlobThresh motionLocBlobThresh(&video_frame_buffer,
+           frame_buflen, FRAME_WIDTH, FRAME_HEIGHT);
+    motionLocBlobThresh.setBackgroundStore(&bgdStore);
+    if(!motionLocBlobThresh.setScale(config.motion_scale)) {
+        return -1;
+    }
+    ZoneMap zones;
+    if (!config.zones.empty()) {
+        if (!zones.load(config.zones)) {
+            return -1;
+        }
+        motionLocBlobThresh.setZones(&zones);
+    }
+    motionLocBlobThresh.setPipelineQueues(&motionQueue, &matchQueue);
+    motionLocBlobThresh.setLoadShedder(shedder, LoadShedder::STAGE_MOTION);
+    motionLocBlobThresh.setFrameBus(&frameBus);
+
+    IPCamProcessor ipCamProcessor(&video_frame_buffer,
+            frame_buflen,
+            FRAME_WIDTH, 
+            FRAME_HEIGHT,
+            &motionLocBlobThresh);
+    ipCamProcessor.setBackgroundStore(&bgdStore);
+    ipCamProcessor.setPipelineQueues(&matchQueue, NULL);
+    ipCamProcessor.setLoadShedder(shedder, LoadShedder::STAGE_IPCAM);
+    ipCamProcessor.setFrameBus(&frameBus);
+
+    pthread_t background_capture_thread;
+    pthread_t motion_location_thread;
+    pthread_t ip_cam_thread;
+    if (pthread_create(&background_capture_thread, NULL,
+                &capture_background, bgdCapturer) ||
+            pthread_create(&motion_location_thread, NULL,
+                &locate_motion, &motionLocBlobThresh) ||
+            pthread_create(&ip_cam_thread, NULL,
+                &run_ip_cam, &ipCamProcessor)) {
+        perror("Could not create processor threads.");
+        return -1;
+    }
+
+    // Hands each published frame to the pipeline, like the capture
+    // loop does in a single process
+    unsigned long last_seq = 0;
+    time_t last_stats_time = time(NULL);
+    while (!exit_requested) {
+        FrameBusFrame_t frame;
+        if (!frameBus.next(last_seq, &frame, 100)) {
+            if (!frameBus.isOpen()) {
+                std::cout << "frame bus closed" << std::endl;
+                break;
+            }
+            continue;
+        }
+        last_seq = frame.seq;
+
+        VideoFrame_t& slot = video_frame_buffer[frame.slot];
+        if( (rc = pthread_rwlock_wrlock(slot.rw_lock)) != 0) {
+            perror ("Failed to acquire write lock on bus frame.");
+        }
+        slot.seq = frame.seq;
+        slot.last_change_seq = frame.last_change_seq;
+        slot.ip_last_change_seq = frame.ip_last_change_seq;
+        slot.capture_time = frame.capture_time;
+        slot.timestamp = frame.timestamp;
+        if( (rc = pthread_rwlock_unlock(slot.rw_lock)) != 0) {
+            perror ("Failed to release write lock on bus frame.");
+        }
+
+        FrameToken_t token;
+        token.slot = frame.slot;
+        token.seq = frame.seq;
+        bgdQueue.tryPush(token);
+
+        if (config.stats_interval > 0 &&
+                difftime(time(NULL), last_stats_time) >=
+                config.stats_interval) {
+            globalMetrics().dump(std::cout);
+            last_stats_time = time(NULL);
+        }
+    }
+
+    bgdQueue.close();
+    if ( (rc = pthread_join(background_capture_thread, NULL)) != 0) {
+        perror("Background capture thread did not join.");
+    }
+    delete bgdCapturer;
+    delete bgdCheckpoint;
+    if ( (rc = pthread_join(motion_location_thread, NULL)) != 0) {
+        perror("Motion location thread did not join.");
+    }
+    if ( (rc = pthread_join(ip_cam_thread, NULL)) != 0) {
+        perror("IP cam thread did not join.");
+    }
+
+    for (int i = 0; i < frame_buflen; i++) {
+        pthread_rwlock_destroy(video_frame_buffer[i].rw_lock);
+        free(video_frame_buffer[i].rw_lock);
+    }
+    return 0;
+}
+
 int main(int argc, char** argv) {
+    SystemConfig_t config;
+    if(!parseConfig(argc, argv, &config)) {
+        return -1;
+    }
+    signal(SIGINT, handle_sigint);
+    std::cout << "pixel kernels using " << pixelKernelIsa() << std::endl;
+    if (!config.batch_input.empty()) {
+        return run_batch(config);
+    }
+    if (!config.attach.empty()) {
+        return run_attached(config);
+    }
+    // Without frames of their own the stages must wait on the pipeline
+    // queues rather than poll the buffer
+    if (config.bus_only) {
+        if (config.bus.empty()) {
+            std::cout << "bus-only needs a bus" << std::endl;
+            return -1;
+        }
+        config.pipeline = true;
+    }
+
+    // Threads started from here on inherit the worker cores; the
+    // capture loop moves to its own once they are all running
+    std::vector<int> capture_cpus;
+    std::vector<int> worker_cpus;
+    if (!placement_cpus(config, &capture_cpus, &worker_cpus) ||
+            !placeCurrentThread("processors", worker_cpus, 0)) {
+        return -1;
+    }
+
+    // With a history only the frames being processed need to be kept
+    // raw, older ones go to the compressed history
+    const int frame_buflen = config.raw_frames;
+    if (frame_buflen < MIN_FRAME_BUFLEN) {
+        std::cout << "raw frames must be at least " << MIN_FRAME_BUFLEN <<
+            std::endl;
+        return -1;
+    }
+    video_frame_buffer.resize(frame_buflen);
+
     // Capture default webcam feed
-    cv::VideoCapture video_cap(0);
-	// Initialize frame width and frame height for frame capture
-    if(!(video_cap.set(CV_CAP_PROP_FRAME_WIDTH, FRAME_WIDTH) &
-				video_cap.set(CV_CAP_PROP_FRAME_HEIGHT, FRAME_HEIGHT))) {
-		perror("Can not set frame width and height");
-	}
+    CaptureSource* video_cap = open_capture_source(config);
+    if (video_cap == NULL) {
+        std::cout << "error opening capture source" << std::endl;
+        return -1;
+    }
     
-    const std::string ipStreamAddress = "http://192.168.2.30/video.mjpg";
-    // Capture default webcam feed
-    cv::VideoCapture video_cap_ip;
-    if(!video_cap_ip.open(ipStreamAddress)) {
+    // IP camera stream, or a recorded .mjpg given on the command line.
+    // A synthetic scene renders the ip view itself.
+    const bool synthetic = synthetic_capture(config);
+    const std::string ipStreamAddress = config.ip_stream_address;
+    // Decode the ip stream at the smallest IDCT scale that still
+    // covers the webcam frame size
+    MjpegStreamReader video_cap_ip;
+    video_cap_ip.setTargetSize(FRAME_WIDTH, FRAME_HEIGHT);
+    if(!synthetic && !video_cap_ip.open(ipStreamAddress)) {
         std::cout << "error opening ip video stream" << std::endl;
         return -1;
     }
@@ -87,20 +581,62 @@ int main(int argc, char** argv) {
     
     std::cout << "after opening video stream" << std::endl;
 
+    // The ip frame size depends on the camera and the decode scale, so
+    // decode one frame to lay out the frame pool
+    cv::Mat probe_ip_frame(FRAME_HEIGHT, FRAME_WIDTH, CV_8UC1);
+    if(!synthetic && !video_cap_ip.read(&probe_ip_frame, true)) {
+        std::cout << "error reading from ip video stream" << std::endl;
+        return -1;
+    }
+
+    // All slot storage comes from one arena allocated here; the
+    // capture loop below then writes frames without heap allocations
+    FramePool framePool(frame_buflen,
+            video_cap->pixelFormat(),
+            FRAME_WIDTH, FRAME_HEIGHT,
+            probe_ip_frame.cols, probe_ip_frame.rows);
+    // Published on a frame bus, the arena lives in shared memory so
+    // processes attached to the bus read the frames in place
+    FrameBus* frameBus = NULL;
+    if (!config.bus.empty()) {
+        FrameBusLayout_t layout;
+        layout.num_slots = frame_buflen;
+        layout.pixel_format = video_cap->pixelFormat();
+        layout.frame_width = FRAME_WIDTH;
+        layout.frame_height = FRAME_HEIGHT;
+        layout.ip_width = probe_ip_frame.cols;
+        layout.ip_height = probe_ip_frame.rows;
+        frameBus = new FrameBus();
+        if (!frameBus->create(config.bus, layout,
+                    framePool.requiredSize())) {
+            return -1;
+        }
+        framePool.useArena(frameBus->arena(), frameBus->arenaSize());
+    } else if(!framePool.allocate()) {
+        return -1;
+    }
+    std::cout << "frame pool: " << framePool.arenaSize() << " bytes" <<
+        (framePool.usesHugePages() ? " (huge pages)" : "") << std::endl;
+    // The processors read every frame many times over, capture writes
+    // it once, so the frames go on the processors' node
+    int numa_node = worker_cpus.empty() ? -1 : numaNodeOfCpu(worker_cpus[0]);
+    if (numa_node >= 0 && bindMemoryToNode(framePool.arena(),
+                framePool.arenaSize(), numa_node)) {
+        std::cout << "frame pool on numa node " << numa_node << std::endl;
+    }
+
    // Return code for initializing rwlocks 
    int rc = 0; 
    // Initialize frame buffer 
-    for(int i = 0; i < FRAME_BUFLEN; i++) {
-        // Initialize frame to empty frame of correct size
-        video_frame_buffer[i].frame = 
-            cv::Mat(FRAME_HEIGHT, FRAME_WIDTH, CV_8UC1, cv::Scalar(0));
-        
-        // Initialize frame to empty frame of correct size
-        video_frame_buffer[i].ip_frame = 
-            cv::Mat(FRAME_HEIGHT, FRAME_WIDTH, CV_8UC1, cv::Scalar(0));
+    for(int i = 0; i < frame_buflen; i++) {
+        // Point the frame data at its preallocated storage
+        framePool.bindSlot(i, &video_frame_buffer[i]);
         
         // Empty timestamp
         video_frame_buffer[i].timestamp = time_t();
+        video_frame_buffer[i].seq = 0;
+        video_frame_buffer[i].last_change_seq = 0;
+        video_frame_buffer[i].ip_last_change_seq = 0;
         
         // Malloc rwlock to be associated with all data in this frame
         // and initialize rwlock
@@ -118,19 +654,78 @@ int main(int argc, char** argv) {
         video_frame_buffer[i].exit_thread = false;
     } 
     
+    // Livefeed canvas, not created at all when running headless
+    // without the http server
+    DisplayCompositor* displayCompositor = NULL;
+    MjpegServer* mjpegServer = NULL;
+    if (!config.headless || config.http_port > 0) {
+        displayCompositor = new DisplayCompositor(FRAME_WIDTH,
+                FRAME_HEIGHT,
+                config.display_refresh_ms);
+        displayCompositor->setShowWindow(!config.headless);
+    }
+    if (config.http_port > 0) {
+        mjpegServer = new MjpegServer(config.http_port);
+        displayCompositor->setStreamServer(mjpegServer);
+        if (!mjpegServer->start()) {
+            return -1;
+        }
+    }
+
+    // The one bgd all processors read, set by the bgd capturer and
+    // by the 'B' key
+    BackgroundStore bgdStore(FRAME_WIDTH, FRAME_HEIGHT);
+
+    // Queues of the pipeline capture -> bgd update -> motion location
+    // -> feature matching. The capture loop drops frames the bgd stage
+    // has no room for, the stages wait on each other, so the slowest
+    // stage sets the frame rate. Every frame in flight keeps its slot,
+    // so the queues must hold far fewer frames than the buffer.
+    if (config.pipeline &&
+            (config.pipeline_depth < 1 ||
+             3 * (config.pipeline_depth + 1) + 1 > frame_buflen)) {
+        std::cout << "pipeline depth must be between 1 and " <<
+            (frame_buflen - 1) / 3 - 1 << std::endl;
+        return -1;
+    }
+    FrameQueue bgdQueue("bgd", config.pipeline_depth);
+    FrameQueue motionQueue("motion", config.pipeline_depth);
+    FrameQueue matchQueue("match", config.pipeline_depth);
+
+    // Model state is checkpointed while running and restored here, so
+    // motion detection has a bgd from the first frame after a restart
+    BgdCheckpoint* bgdCheckpoint = NULL;
+    if (config.bgd_checkpoint != "none") {
+        bgdCheckpoint = new BgdCheckpoint(bgd_checkpoint_path(config),
+                FRAME_WIDTH, FRAME_HEIGHT);
+        if (!bgdCheckpoint->start()) {
+            delete bgdCheckpoint;
+            bgdCheckpoint = NULL;
+        }
+    }
+
+    // Trades quality for latency when a stage falls behind its budget
+    LoadShedder loadShedder(config.latency_budget_ms,
+            config.ip_latency_budget_ms);
+    LoadShedder* shedder = load_shedding(config) ? &loadShedder : NULL;
+
     // Intialize background capturing option
-    BgdCapturerAverage bgdCapturerAverage(&video_frame_buffer,
-            FRAME_BUFLEN, 
-            FRAME_WIDTH, 
-            FRAME_HEIGHT, 
-            FRAMES_PER_BGD);
+    FrameProcessor* bgdCapturer = create_bgd_capturer(config, frame_buflen,
+            &bgdStore, displayCompositor, bgdCheckpoint);
+    if (bgdCapturer == NULL) {
+        return -1;
+    }
+    bgdCapturer->setLoadShedder(shedder, LoadShedder::STAGE_BGD);
+    if (config.pipeline) {
+        bgdCapturer->setPipelineQueues(&bgdQueue, &motionQueue);
+    }
 	
     // Start thread for capturing background
 	pthread_t background_capture_thread;
 	if(pthread_create(&background_capture_thread, 
 				NULL, 
 				&capture_background, 
-				&bgdCapturerAverage)) {
+				bgdCapturer)) {
 		perror("Could not create thread to capture background.");
 		return  -1;
 	}
@@ -146,7 +741,25 @@ int main(int argc, char** argv) {
 
     // Intialize background capturing option
 	MotionLocBlobThresh motionLocBlobThresh(&video_frame_buffer,
-           FRAME_BUFLEN, FRAME_WIDTH, FRAME_HEIGHT);
+           frame_buflen, FRAME_WIDTH, FRAME_HEIGHT);
+    motionLocBlobThresh.setBackgroundStore(&bgdStore);
+    motionLocBlobThresh.setCompositor(displayCompositor);
+    if(!motionLocBlobThresh.setScale(config.motion_scale)) {
+        return -1;
+    }
+    ZoneMap zones;
+    if (!config.zones.empty()) {
+        if (!zones.load(config.zones)) {
+            return -1;
+        }
+        std::cout << "looking for motion in " << zones.numZones() <<
+            " zones" << std::endl;
+        motionLocBlobThresh.setZones(&zones);
+    }
+    motionLocBlobThresh.setLoadShedder(shedder, LoadShedder::STAGE_MOTION);
+    if (config.pipeline) {
+        motionLocBlobThresh.setPipelineQueues(&motionQueue, &matchQueue);
+    }
 	
     // Start thread for capturing background
 	pthread_t motion_location_thread;
@@ -160,10 +773,18 @@ int main(int argc, char** argv) {
     
     // Intialize IP Cam capturing class
     IPCamProcessor ipCamProcessor(&video_frame_buffer,
-            FRAME_BUFLEN,
+            frame_buflen,
             FRAME_WIDTH, 
             FRAME_HEIGHT,
             &motionLocBlobThresh);
+    ipCamProcessor.setBackgroundStore(&bgdStore);
+    ipCamProcessor.setCompositor(displayCompositor);
+    // A synthetic scene has no camera to steer
+    ipCamProcessor.setPtzControl(!synthetic);
+    ipCamProcessor.setLoadShedder(shedder, LoadShedder::STAGE_IPCAM);
+    if (config.pipeline) {
+        ipCamProcessor.setPipelineQueues(&matchQueue, NULL);
+    }
 
     // Start thread for capturing background
     pthread_t ip_cam_thread;
@@ -175,32 +796,115 @@ int main(int argc, char** argv) {
         return  -1;
     } 
 	
-    // Display live video feed window
-	cv::namedWindow("livefeed", 1);	
-	// cv::namedWindow("livecolor", 1);	
+    // Start thread for displaying live video feed window
+    pthread_t display_thread;
+    if(displayCompositor != NULL &&
+            pthread_create(&display_thread,
+                NULL,
+                &run_display,
+                displayCompositor)) {
+        perror("Could not create thread to display live feed.");
+        return  -1;
+    }
     
     cURLpp::Cleanup myCleanup;
 
+    // Compressed history of both cameras behind the frame buffer
+    FrameHistory* webcamHistory = NULL;
+    FrameHistory* ipHistory = NULL;
+    if (config.history_mb > 0) {
+        FrameHistory::Format format = FrameHistory::HISTORY_JPEG;
+        if (config.history_format == "luma") {
+            format = FrameHistory::HISTORY_LUMA;
+        } else if (config.history_format != "jpeg") {
+            std::cout << "unknown history format " <<
+                config.history_format << std::endl;
+            return -1;
+        }
+        // Frames waiting for compression keep their slot, so at most
+        // half the buffer may be queued
+        size_t budget = (size_t) config.history_mb << 20;
+        webcamHistory = new FrameHistory("webcam", &video_frame_buffer,
+                FrameHistory::HISTORY_WEBCAM, format, budget,
+                frame_buflen / 2);
+        ipHistory = new FrameHistory("ip", &video_frame_buffer,
+                FrameHistory::HISTORY_IP, format, budget,
+                frame_buflen / 2);
+        if (!webcamHistory->start() || !ipHistory->start()) {
+            return -1;
+        }
+    }
+
+    // Change detection, lets processors skip frames where nothing
+    // moved. Frames are compared with the last frame flagged as
+    // changed rather than with their predecessor, so slow drift that
+    // stays under the threshold from frame to frame still adds up to a
+    // change.
+    StaticFrameDetector staticFrameDetector;
+    cv::Mat change_ref;
+    cv::Mat ip_change_ref;
+    unsigned long frame_seq = 0;
+    unsigned long last_change_seq = 0;
+    unsigned long ip_last_change_seq = 0;
+    time_t last_stats_time = time(NULL);
+    // Metric names are built once to keep allocations out of the loop
+    const std::string capture_frames_metric = "capture.frames";
+    const std::string capture_static_metric = "capture.static_frames";
+
+    // Everything else is running, so only this thread and the probe
+    // below go on the capture cores
+    if (!placeCurrentThread("capture", capture_cpus,
+                config.capture_rt_priority)) {
+        return -1;
+    }
+    JitterProbe jitterProbe("capture", config.jitter_probe_ms);
+    if (config.jitter_probe_ms > 0 && !jitterProbe.start()) {
+        return -1;
+    }
+
     // Stream video
     for(;;) {
-        // TODO: double check ordering of this and the lock. Do I want this after the lock?
         const VideoFrame& this_video_frame = video_frame_buffer[cur_frame_i];
+
+        // Grab before taking the slot's lock: the V4L2 source may have
+        // to wait for readers of an older slot to hand back a driver
+        // buffer, and processors blocked on this slot would hold those.
+        // A replayed recording ends the run when it runs out, a device
+        // once the source gave up on it; nothing was grabbed, so the
+        // slot is left as it is.
+        if (!video_cap->grab()) {
+            signal_thread_exit(
+                    (cur_frame_i + frame_buflen - 1) % frame_buflen,
+                    cur_frame_i);
+            bgdQueue.close();
+            break;
+        }
+        // Skipping stale ip frames only reads them off the stream,
+        // only the last one is decoded
+        if (!synthetic) {
+            video_cap_ip.grab();
+            video_cap_ip.grab();
+            video_cap_ip.grab();
+            video_cap_ip.grab();
+        }
       
         // Acquire write lock on this frame
         if( (rc = pthread_rwlock_wrlock(this_video_frame.rw_lock)) != 0) {
             perror ("Failed to acquire write lock on next video frame.");
         }
        
-        
-        video_cap.grab();
-        video_cap_ip.grab();
-        video_cap_ip.grab();
-        video_cap_ip.grab();
-        video_cap_ip.grab();
-        video_cap.retrieve(
-                video_frame_buffer[cur_frame_i].color_frame); 
+        if (frameBus != NULL) {
+            frameBus->beginWrite(cur_frame_i, frame_seq + 1);
+        }
+        // Fills frame, and color_frame or raw depending on the source
+        video_cap->retrieve(&video_frame_buffer[cur_frame_i]);
    
-        video_cap_ip.retrieve(video_frame_buffer[cur_frame_i].color_ip_frame);
+        // Only luma of the ip frame is used, decode it straight
+        // into ip_frame
+        if (!synthetic) {
+            video_cap_ip.retrieve(&video_frame_buffer[cur_frame_i].ip_frame,
+                    true);
+        }
         //if (!video_cap_ip.read(fromIP)) {
         //   std::cout << "no frame" << std::endl;
         //    cv:::waitKey();
@@ -210,47 +914,41 @@ int main(int argc, char** argv) {
         //        fromIP,
         //        cv::Size(FRAME_WIDTH, FRAME_HEIGHT));
 
-        cv::Mat color_frame;
-        (video_frame_buffer[cur_frame_i].color_frame).copyTo(color_frame);
-        cvtColor(video_frame_buffer[cur_frame_i].color_frame, 
-                video_frame_buffer[cur_frame_i].frame, CV_BGR2GRAY);
-
         time(&video_frame_buffer[cur_frame_i].timestamp);
-        cv::Mat toDraw;
-        (video_frame_buffer[cur_frame_i].frame).copyTo(toDraw);
-        
-        cv::Mat prob_mask;
-        motionLocBlobThresh.getLastProbMask(&prob_mask);
-        
-        cv::Mat bgd;
-        bgdCapturerAverage.getBgd(&bgd);
-        hconcat(toDraw,
-                prob_mask,
-                toDraw);
-        hconcat(toDraw,
-                bgd,
-                toDraw);
-
-        motionLocBlobThresh.annotateMatWithBlobs(&color_frame);
-        cv::Mat y_frame_with_blobs;
-        cvtColor(color_frame, y_frame_with_blobs, CV_BGR2GRAY);
-        //hconcat(toDraw,
-        //        y_frame_with_blobs,
-        //        toDraw);
-        // std::cout << "IP: " << fromIP.size() << std::endl;
-        // std::cout << "prob mask: " << prob_mask.size() << std::endl;
-        cvtColor(video_frame_buffer[cur_frame_i].color_ip_frame, 
-                video_frame_buffer[cur_frame_i].ip_frame, 
-                CV_BGR2GRAY);
-        // hconcat(toDraw, video_frame_buffer[cur_frame_i].ip_frame, toDraw);
-
-        cv::Mat annotated_features;
-        ipCamProcessor.getLastPair(&annotated_features);
-        hconcat(toDraw, annotated_features, toDraw);
-
-        cv::imshow("livefeed", toDraw);
+
+        frame_seq++;
+        if (!staticFrameDetector.isStatic(
+                    video_frame_buffer[cur_frame_i].frame, change_ref)) {
+            last_change_seq = frame_seq;
+            video_frame_buffer[cur_frame_i].frame.copyTo(change_ref);
+        }
+        if (!staticFrameDetector.isStatic(
+                    video_frame_buffer[cur_frame_i].ip_frame, ip_change_ref)) {
+            ip_last_change_seq = frame_seq;
+            video_frame_buffer[cur_frame_i].ip_frame.copyTo(ip_change_ref);
+        }
+        video_frame_buffer[cur_frame_i].seq = frame_seq;
+        video_frame_buffer[cur_frame_i].last_change_seq = last_change_seq;
+        video_frame_buffer[cur_frame_i].ip_last_change_seq = 
+            ip_last_change_seq;
+        globalMetrics().increment(capture_frames_metric);
+        if (last_change_seq != frame_seq) {
+            globalMetrics().increment(capture_static_metric);
+        }
+
+        if (config.stats_interval > 0 &&
+                difftime(video_frame_buffer[cur_frame_i].timestamp,
+                    last_stats_time) >= config.stats_interval) {
+            globalMetrics().dump(std::cout);
+            last_stats_time = video_frame_buffer[cur_frame_i].timestamp;
+        }
+
+        // Other panels are written by the processors themselves
+        if (displayCompositor != NULL) {
+            displayCompositor->writePanel(DisplayCompositor::PANEL_FRAME,
+                    video_frame_buffer[cur_frame_i].frame);
+        }
         //output_video.write(color_frame);
-        // cv::imshow("livecolor", color_frame); 
 
 
         // Release write lock on this frame
@@ -258,10 +956,36 @@ int main(int argc, char** argv) {
             perror ("Failed to release write lock on next video frame.");
         }
 
+        if (frameBus != NULL) {
+            FrameBusFrame_t bus_frame;
+            bus_frame.slot = cur_frame_i;
+            bus_frame.seq = frame_seq;
+            bus_frame.last_change_seq = last_change_seq;
+            bus_frame.ip_last_change_seq = ip_last_change_seq;
+            bus_frame.capture_time =
+                video_frame_buffer[cur_frame_i].capture_time;
+            bus_frame.timestamp = video_frame_buffer[cur_frame_i].timestamp;
+            frameBus->publish(bus_frame);
+        }
+        if (config.pipeline && !config.bus_only) {
+            FrameToken_t token;
+            token.slot = cur_frame_i;
+            token.seq = frame_seq;
+            bgdQueue.tryPush(token);
+        }
+        if (webcamHistory != NULL) {
+            webcamHistory->add(cur_frame_i, frame_seq);
+            ipHistory->add(cur_frame_i, frame_seq);
+        }
+
         int prev_frame_i = cur_frame_i;
-        cur_frame_i = (cur_frame_i + 1) % FRAME_BUFLEN;
+        cur_frame_i = (cur_frame_i + 1) % frame_buflen;
 
-        int key = cv::waitKey(30);
+        int key = (displayCompositor != NULL) ?
+            displayCompositor->popKey() : -1;
+        if (exit_requested) {
+            key = 27; // Esc
+        }
         if( (key == 66) | (key == 98)) { // B or b
             if ( (rc = pthread_rwlock_rdlock(
                             video_frame_buffer[prev_frame_i].rw_lock))
@@ -271,11 +995,12 @@ int main(int argc, char** argv) {
 
             std::cout << "setting bgd" << std::endl;
 
-            bgdCapturerAverage.
-                setBgd(video_frame_buffer[prev_frame_i].frame);
+            bgdStore.set(video_frame_buffer[prev_frame_i].frame);
 
-            motionLocBlobThresh.
-                setBgd(video_frame_buffer[prev_frame_i].frame);
+            if (displayCompositor != NULL) {
+                displayCompositor->writePanel(DisplayCompositor::PANEL_BGD,
+                        video_frame_buffer[prev_frame_i].frame);
+            }
         
             if ( (rc = pthread_rwlock_unlock(
                             video_frame_buffer[prev_frame_i].rw_lock))
@@ -283,48 +1008,55 @@ int main(int argc, char** argv) {
             perror ("Failed to release read lock on video frame to capture as bgd.");
             }
         } else if (key >= 0) {
-            if( (rc = pthread_rwlock_wrlock(
-                            video_frame_buffer[prev_frame_i].rw_lock)) != 0) {
-                perror ("Failed to acquire write lock on prev video frame.");
-            }
-            if( (rc = pthread_rwlock_wrlock(
-                            video_frame_buffer[cur_frame_i].rw_lock)) != 0) {
-                perror ("Failed to acquire write lock on cur video frame.");
-            }
-            
-            // TODO: check if these both refer to same frame
-            video_frame_buffer[prev_frame_i].exit_thread = true;
-            video_frame_buffer[cur_frame_i].exit_thread = true; 
-            
-            if( (rc = pthread_rwlock_unlock(
-                            video_frame_buffer[prev_frame_i].rw_lock)) != 0) {
-                perror ("Failed to acquire write lock on prev video frame.");
-            }
-            if( (rc = pthread_rwlock_unlock(
-                            video_frame_buffer[cur_frame_i].rw_lock)) != 0) {
-                perror ("Failed to acquire write lock on cur video frame.");
-            }
+            signal_thread_exit(prev_frame_i, cur_frame_i);
+            // Pipeline stages finish the frames they have queued and
+            // exit one after the other
+            bgdQueue.close();
             break; 
         } 
     } 
     
+    // Compresses the frames still queued
+    delete webcamHistory;
+    delete ipHistory;
+
     if ( (rc = pthread_join(background_capture_thread, NULL)) != 0) {
         perror("Background capture thread did not join.");
     }
+    delete bgdCapturer;
+    // Writes the last checkpoint still queued
+    delete bgdCheckpoint;
 
     if ( (rc = pthread_join(motion_location_thread, NULL)) != 0) {
         perror("Motion location thread did not join.");
     }
+    // May still hold a slot's read lock, so it goes before the frame
+    // buffer, the bus and the capture source are torn down
+    if ( (rc = pthread_join(ip_cam_thread, NULL)) != 0) {
+        perror("IP cam thread did not join.");
+    }
+
+    if (displayCompositor != NULL) {
+        displayCompositor->stop();
+        if ( (rc = pthread_join(display_thread, NULL)) != 0) {
+            perror("Display thread did not join.");
+        }
+        delete displayCompositor;
+    }
+    // After the display thread, which publishes to it
+    delete mjpegServer;
  
    // TODO: notify background capture thread that it should end
    // TODO: add join for background capture thread
    // TODO: memory cleanup for rwlocks 
-    for(int i = 0; i < FRAME_BUFLEN; i++) {
+    for(int i = 0; i < frame_buflen; i++) {
         pthread_rwlock_destroy(video_frame_buffer[i].rw_lock);
         free(video_frame_buffer[i].rw_lock);
     }
 
-    video_cap.release();
-    cv::destroyWindow("livefeed");
+    // Readers see the bus close
+    delete frameBus;
+    delete video_cap;
+    video_cap_ip.release();
     return 0;
 }
@@ -0,0 +1,139 @@
+#include "SyntheticScene.h"
+
+#include <math.h>
+
+// Noise planes cycled through; enough that the noise doesn't look
+// static to the change detection
+const static int NUM_NOISE_PLANES = 8;
+// Scene size the texture density and object speeds are given for
+const static double REFERENCE_AREA = 352.0 * 240.0;
+const static double REFERENCE_WIDTH = 352.0;
+
+SyntheticSceneParams::SyntheticSceneParams() :
+    width(352),
+    height(240),
+    num_objects(2),
+    noise_sigma(2.0),
+    drift(0.05),
+    drift_period(300),
+    ip_angle(8.0),
+    ip_scale(1.15),
+    seed(1) {
+}
+
+SyntheticScene::SyntheticScene(const SyntheticSceneParams_t& params) :
+    _params(params),
+    _rng(params.seed) {
+    int w = params.width;
+    int h = params.height;
+    double area_factor = w * h / REFERENCE_AREA;
+    double speed_factor = w / REFERENCE_WIDTH;
+
+    // Vertical gradient under scattered rectangles
+    _bgd.create(h, w, CV_8UC1);
+    for (int y = 0; y < h; y++) {
+        _bgd.row(y).setTo(cv::Scalar(60 + 80 * y / h));
+    }
+    scatterRects(&_bgd, std::max(1, (int) (40 * area_factor)),
+            std::max(4, std::min(w, h) / 6));
+
+    int min_dim = std::min(w, h);
+    for (int i = 0; i < params.num_objects; i++) {
+        Object_t object;
+        int ow = _rng.uniform(min_dim / 10, min_dim / 5 + 1);
+        int oh = _rng.uniform(min_dim / 10, min_dim / 5 + 1);
+        object.texture.create(std::max(2, oh), std::max(2, ow), CV_8UC1);
+        object.texture.setTo(cv::Scalar(_rng.uniform(0, 256)));
+        scatterRects(&object.texture, 6, std::max(2, std::min(ow, oh) / 3));
+        object.start = cv::Point2d(_rng.uniform(0, w), _rng.uniform(0, h));
+        double speed = _rng.uniform(1.0, 4.0) * speed_factor;
+        double dir = _rng.uniform(0.0, 2 * CV_PI);
+        object.velocity = cv::Point2d(speed * cos(dir), speed * sin(dir));
+        _objects.push_back(object);
+    }
+
+    if (params.noise_sigma > 0) {
+        cv::Mat noise(h, w, CV_16SC1);
+        for (int i = 0; i < NUM_NOISE_PLANES; i++) {
+            _rng.fill(noise, cv::RNG::NORMAL, cv::Scalar(0),
+                    cv::Scalar(params.noise_sigma));
+            cv::Mat pos;
+            cv::Mat neg;
+            noise.convertTo(pos, CV_8U);
+            cv::Mat negated = -noise;
+            negated.convertTo(neg, CV_8U);
+            _noise_pos.push_back(pos);
+            _noise_neg.push_back(neg);
+        }
+    }
+
+    _ip_transform = cv::getRotationMatrix2D(cv::Point2f(w / 2.0f, h / 2.0f),
+            params.ip_angle, params.ip_scale);
+}
+
+void SyntheticScene::scatterRects(cv::Mat* dst, int count, int max_size) {
+    for (int i = 0; i < count; i++) {
+        int rw = _rng.uniform(2, max_size + 1);
+        int rh = _rng.uniform(2, max_size + 1);
+        cv::Rect rect(_rng.uniform(0, dst->cols), _rng.uniform(0, dst->rows),
+                rw, rh);
+        rect &= cv::Rect(0, 0, dst->cols, dst->rows);
+        cv::Mat roi = (*dst)(rect);
+        roi.setTo(cv::Scalar(_rng.uniform(0, 256)));
+    }
+}
+
+// Position along one axis of something starting at start and moving by
+// velocity per frame between 0 and travel, reflected at both ends
+static int bounce(double start, double velocity, unsigned long t,
+        int travel) {
+    if (travel <= 0) {
+        return 0;
+    }
+    double p = fmod(start + velocity * t, 2.0 * travel);
+    if (p < 0) {
+        p += 2.0 * travel;
+    }
+    if (p > travel) {
+        p = 2.0 * travel - p;
+    }
+    return (int) p;
+}
+
+cv::Rect SyntheticScene::objectRect(int i, unsigned long t) const {
+    const Object_t& object = _objects[i];
+    int ow = object.texture.cols;
+    int oh = object.texture.rows;
+    int x = bounce(object.start.x, object.velocity.x, t,
+            _params.width - ow);
+    int y = bounce(object.start.y, object.velocity.y, t,
+            _params.height - oh);
+    return cv::Rect(x, y, ow, oh) &
+        cv::Rect(0, 0, _params.width, _params.height);
+}
+
+void SyntheticScene::render(unsigned long t, cv::Mat* frame,
+        cv::Mat* ip_frame) {
+    double gain = 1.0;
+    if (_params.drift_period > 0) {
+        gain += _params.drift * sin(2 * CV_PI * t / _params.drift_period);
+    }
+    // Writes in place when frame already has the scene size, as slot
+    // storage does
+    _bgd.convertTo(*frame, CV_8U, gain);
+    for (size_t i = 0; i < _objects.size(); i++) {
+        cv::Rect rect = objectRect(i, t);
+        cv::Mat roi = (*frame)(rect);
+        _objects[i].texture(cv::Rect(0, 0, rect.width, rect.height))
+            .convertTo(roi, CV_8U, gain);
+    }
+    if (!_noise_pos.empty()) {
+        int plane = t % _noise_pos.size();
+        cv::add(*frame, _noise_pos[plane], *frame);
+        cv::subtract(*frame, _noise_neg[plane], *frame);
+    }
+    if (ip_frame != NULL) {
+        cv::warpAffine(*frame, *ip_frame, _ip_transform, frame->size(),
+                cv::INTER_LINEAR, cv::BORDER_REFLECT);
+    }
+}
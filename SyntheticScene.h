@@ -0,0 +1,72 @@
+#ifndef SYNTHETIC_SCENE_H
+#define SYNTHETIC_SCENE_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// What a SyntheticScene renders
+typedef struct SyntheticSceneParams {
+    SyntheticSceneParams();
+
+    int width;
+    int height;
+    // Textured objects moving across the scene, bouncing off the edges
+    int num_objects;
+    // Standard deviation of the sensor noise, in gray levels
+    double noise_sigma;
+    // Amplitude of the illumination drift, as a fraction of the
+    // brightness, and its period in frames
+    double drift;
+    int drift_period;
+    // The ip camera's view is the webcam's rotated by ip_angle degrees
+    // and scaled by ip_scale around the center
+    double ip_angle;
+    double ip_scale;
+    // Scenes with the same parameters and seed render the same frames
+    unsigned int seed;
+} SyntheticSceneParams_t;
+
+// Controllable input for measuring the pipeline: a textured background
+// with sensor noise and slow illumination drift, objects moving across
+// it, and the same scene seen by the ip camera through a fixed
+// transform, so feature matching finds real correspondences. Frame t is
+// a function of t alone, which makes runs repeatable and lets any
+// number of cameras be rendered side by side.
+class SyntheticScene {
+    public:
+        SyntheticScene(const SyntheticSceneParams_t& params);
+
+        // Renders frame t of the webcam into frame and, if not NULL,
+        // of the ip camera into ip_frame; both 8 bit gray at the scene
+        // size
+        void render(unsigned long t, cv::Mat* frame, cv::Mat* ip_frame);
+        // The scene without objects, noise or drift
+        const cv::Mat& background() const {
+            return _bgd;
+        };
+        // Bounding box of object i in frame t
+        cv::Rect objectRect(int i, unsigned long t) const;
+
+    private:
+        typedef struct Object {
+            cv::Mat texture;
+            cv::Point2d start;
+            cv::Point2d velocity;
+        } Object_t;
+
+        // Textures a region with rectangles of random gray levels,
+        // which gives the feature detector corners to find
+        void scatterRects(cv::Mat* dst, int count, int max_size);
+
+        SyntheticSceneParams_t _params;
+        cv::RNG _rng;
+        cv::Mat _bgd;
+        std::vector<Object_t> _objects;
+        // Noise is drawn once into a few planes, split by sign so it
+        // can be added with saturation, and cycled through
+        std::vector<cv::Mat> _noise_pos;
+        std::vector<cv::Mat> _noise_neg;
+        cv::Mat _ip_transform;
+};
+
+#endif // SYNTHETIC_SCENE_H
@@ -0,0 +1,121 @@
+#include "ThreadPlacement.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <iostream>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Widest node mask passed to mbind
+const static int MAX_NUMA_NODES = 64;
+
+bool parseCpuList(const std::string& list, std::vector<int>* cpus) {
+    cpus->clear();
+    std::string::size_type pos = 0;
+    while (pos < list.size()) {
+        std::string::size_type end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string range = list.substr(pos, end - pos);
+        pos = end + 1;
+
+        char* rest = NULL;
+        long first = strtol(range.c_str(), &rest, 10);
+        long last = first;
+        if (*rest == '-') {
+            last = strtol(rest + 1, &rest, 10);
+        }
+        if (range.empty() || *rest != '\0' || first < 0 || last < first ||
+                last >= CPU_SETSIZE) {
+            std::cout << "bad cpu list " << list << std::endl;
+            return false;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus->push_back((int) cpu);
+        }
+    }
+    return true;
+}
+
+bool placeCurrentThread(const std::string& name, const std::vector<int>& cpus,
+        int rt_priority) {
+    int rc = 0;
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t i = 0; i < cpus.size(); i++) {
+            CPU_SET(cpus[i], &set);
+        }
+        if( (rc = pthread_setaffinity_np(pthread_self(), sizeof(set),
+                        &set)) != 0) {
+            std::cout << "unable to pin " << name << ": " << strerror(rc) <<
+                std::endl;
+            return false;
+        }
+    }
+
+    if (rt_priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = rt_priority;
+        if( (rc = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+                        &param)) != 0) {
+            // Needs CAP_SYS_NICE or an rtprio limit; run on without
+            std::cout << name << " stays on normal scheduling: " <<
+                strerror(rc) << std::endl;
+        } else {
+            std::cout << name << " runs SCHED_FIFO at " << rt_priority <<
+                std::endl;
+        }
+    }
+    return true;
+}
+
+int numaNodeOfCpu(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+    // The cpu's directory links to its node as nodeN
+    int node = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char* rest = NULL;
+        if (strncmp(entry->d_name, "node", 4) == 0) {
+            long n = strtol(entry->d_name + 4, &rest, 10);
+            if (rest != entry->d_name + 4 && *rest == '\0') {
+                node = (int) n;
+                break;
+            }
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+bool bindMemoryToNode(void* addr, size_t size, int node) {
+    if (node < 0 || node >= MAX_NUMA_NODES) {
+        return false;
+    }
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |=
+        1UL << (node % (8 * sizeof(unsigned long)));
+    // Called directly rather than through libnuma, which is one more
+    // dependency for a single call
+    if (syscall(SYS_mbind, addr, size, MPOL_BIND, mask,
+                (unsigned long) MAX_NUMA_NODES + 1, MPOL_MF_MOVE) != 0) {
+        perror("unable to bind memory to numa node");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Placement of threads and memory on the cores and NUMA nodes of the
+// machine. Capture is pinned to cores of its own, where SURF and the
+// morphology can't preempt it, while the processors share the rest;
+// frame memory goes on the node of the cores that read it.
+
+// Parses a cpu list like "2,3" or "0-3,8" into cpus. An empty list
+// parses to no cpus, meaning no pinning.
+bool parseCpuList(const std::string& list, std::vector<int>* cpus);
+
+// Pins the calling thread, and the threads it creates from then on, to
+// cpus, and runs it SCHED_FIFO at rt_priority if that is above 0. Not
+// being permitted real-time scheduling is reported but not an error;
+// name is used in the messages.
+bool placeCurrentThread(const std::string& name, const std::vector<int>& cpus,
+        int rt_priority);
+
+// NUMA node cpu belongs to, -1 if unknown or the machine has none
+int numaNodeOfCpu(int cpu);
+
+// Moves the pages of [addr, addr + size) to node and keeps them there;
+// addr must be page aligned
+bool bindMemoryToNode(void* addr, size_t size, int node);
+
+#endif // THREAD_PLACEMENT_H
@@ -0,0 +1,121 @@
+#include "ZoneMap.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+
+bool ZoneMap::load(const std::string& path) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        perror(path.c_str());
+        return false;
+    }
+
+    _zones.clear();
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        std::istringstream fields(line);
+        Zone_t zone;
+        if (!(fields >> zone.name) || zone.name[0] == '#') {
+            continue;
+        }
+        std::string vertex;
+        while (fields >> vertex) {
+            int x = 0;
+            int y = 0;
+            if (sscanf(vertex.c_str(), "%d,%d", &x, &y) != 2) {
+                std::cout << path << ":" << line_no <<
+                    ": bad vertex " << vertex << std::endl;
+                return false;
+            }
+            zone.polygon.push_back(cv::Point(x, y));
+        }
+        if (zone.polygon.size() < 3) {
+            std::cout << path << ":" << line_no <<
+                ": zone " << zone.name << " needs 3 vertices" << std::endl;
+            return false;
+        }
+        // Zone ids have to fit the 8 bit label plane
+        if (_zones.size() == 255) {
+            std::cout << path << ": more than 255 zones" << std::endl;
+            return false;
+        }
+        _zones.push_back(zone);
+    }
+    return true;
+}
+
+std::string ZoneMap::name(int id) const {
+    if (id <= 0 || id > (int) _zones.size()) {
+        return "";
+    }
+    return _zones[id - 1].name;
+}
+
+void ZoneMap::rasterize(cv::Size size, int scale, ZoneMask_t* mask) const {
+    mask->labels.create(size, CV_8UC1);
+    mask->labels.setTo(cv::Scalar(0));
+    // Later zones take the pixels they share with earlier ones
+    for (size_t i = 0; i < _zones.size(); i++) {
+        std::vector<cv::Point> pts(_zones[i].polygon.size());
+        for (size_t p = 0; p < pts.size(); p++) {
+            pts[p] = cv::Point(_zones[i].polygon[p].x / scale,
+                    _zones[i].polygon[p].y / scale);
+        }
+        const cv::Point* poly = &pts[0];
+        int npts = (int) pts.size();
+        cv::fillPoly(mask->labels, &poly, &npts, 1,
+                cv::Scalar((double) (i + 1)));
+    }
+    cv::compare(mask->labels, cv::Scalar(0), mask->outside, cv::CMP_EQ);
+
+    // One span per tile row, from its first to its last tile holding a
+    // zone pixel
+    mask->span_begin.assign(size.height, 0);
+    mask->span_end.assign(size.height, 0);
+    int minx = size.width;
+    int miny = size.height;
+    int maxx = 0;
+    int maxy = 0;
+    for (int ty = 0; ty < size.height; ty += ZONE_TILE) {
+        int rows = std::min(ZONE_TILE, size.height - ty);
+        int first = size.width;
+        int last = -1;
+        for (int y = ty; y < ty + rows; y++) {
+            const uchar* l = mask->labels.ptr<uchar>(y);
+            for (int x = 0; x < first; x++) {
+                if (l[x] != 0) {
+                    first = x;
+                    break;
+                }
+            }
+            for (int x = size.width - 1; x > last; x--) {
+                if (l[x] != 0) {
+                    last = x;
+                    break;
+                }
+            }
+        }
+        if (last < 0) {
+            continue;
+        }
+        int begin = (first / ZONE_TILE) * ZONE_TILE;
+        int end = std::min(size.width, (last / ZONE_TILE + 1) * ZONE_TILE);
+        for (int y = ty; y < ty + rows; y++) {
+            mask->span_begin[y] = begin;
+            mask->span_end[y] = end;
+        }
+        minx = std::min(minx, begin);
+        maxx = std::max(maxx, end);
+        miny = std::min(miny, ty);
+        maxy = std::max(maxy, ty + rows);
+    }
+    if (maxx > minx) {
+        mask->active = cv::Rect(minx, miny, maxx - minx, maxy - miny);
+    } else {
+        mask->active = cv::Rect();
+    }
+}
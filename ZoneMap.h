@@ -0,0 +1,58 @@
+#ifndef ZONE_MAP_H
+#define ZONE_MAP_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+// Side of the square tiles zone masks are skipped in
+const int ZONE_TILE = 16;
+
+// Zones rasterized for one frame size
+typedef struct ZoneMask {
+    // Zone id of each pixel, 1 for the first zone in the file, 0
+    // outside every zone
+    cv::Mat labels;
+    // 255 outside every zone, 0 inside
+    cv::Mat outside;
+    // Columns [span_begin[y], span_end[y]) of row y cover every tile
+    // of its tile row holding a zone pixel; equal if it has none
+    std::vector<int> span_begin;
+    std::vector<int> span_end;
+    // Bounding box of the tiles holding zone pixels
+    cv::Rect active;
+} ZoneMask_t;
+
+// Per camera zones motion is looked for in, as polygons in frame
+// coordinates. Everything outside them (sky, trees, timestamps burned
+// in by the camera) is skipped by the motion kernels.
+//
+// The file has one zone per line, a name followed by its vertices:
+//   # name x,y x,y x,y ...
+//   driveway 10,120 340,120 340,239 10,239
+class ZoneMap {
+    public:
+        bool load(const std::string& path);
+        bool empty() const {
+            return _zones.empty();
+        };
+        int numZones() const {
+            return (int) _zones.size();
+        };
+        // Name of zone id, or "" for 0
+        std::string name(int id) const;
+
+        // Rasterizes the zones for frames of size, with the polygons
+        // divided by scale for downscaled levels
+        void rasterize(cv::Size size, int scale, ZoneMask_t* mask) const;
+
+    private:
+        typedef struct Zone {
+            std::string name;
+            std::vector<cv::Point> polygon;
+        } Zone_t;
+
+        std::vector<Zone_t> _zones;
+};
+
+#endif // ZONE_MAP_H
@@ -0,0 +1,138 @@
+// Cost of publishing a frame on a FrameBus, beginWrite plus publish, as
+// the capture loop pays it:
+//   idle     nobody attached, publishing is a few stores
+//   waiting  a reader process attached and waiting for every frame,
+//            so each publish also wakes it; frames are spaced so the
+//            reader is back waiting before the next one
+// The reader counts the frames it got, which must be all of them in
+// the waiting run. No pixels are written, this is the bus alone.
+//
+// Usage: frame_bus_bench [--frames=N]
+//   --frames  frames published per run (1000000 idle, a 100th of that
+//             waiting)
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FrameBus.h"
+
+const static int NUM_SLOTS = 32;
+// Time between frames of the waiting run
+const static int WAITING_INTERVAL_US = 200;
+
+static double nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Reader process: counts frames until the bus closes, exits with 0 if
+// it got every one of frames
+static int readFrames(const std::string& name, unsigned long frames) {
+    FrameBus bus;
+    if (!bus.attach(name)) {
+        return 2;
+    }
+    unsigned long last_seq = 0;
+    unsigned long received = 0;
+    FrameBusFrame_t frame;
+    for (;;) {
+        if (bus.next(last_seq, &frame, 1000)) {
+            last_seq = frame.seq;
+            received++;
+        } else if (!bus.isOpen()) {
+            break;
+        }
+    }
+    printf("  reader received %lu of %lu\n", received, frames);
+    fflush(stdout);
+    return received == frames ? 0 : 1;
+}
+
+// Publishes frames, sleeping interval_us after each; returns the mean
+// ns spent in beginWrite plus publish
+static double publishFrames(FrameBus* bus, unsigned long frames,
+        int interval_us) {
+    FrameBusFrame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    double spent = 0;
+    for (unsigned long seq = 1; seq <= frames; seq++) {
+        int slot = (seq - 1) % NUM_SLOTS;
+        double start = nowNs();
+        bus->beginWrite(slot, seq);
+        frame.slot = slot;
+        frame.seq = seq;
+        frame.last_change_seq = seq;
+        frame.ip_last_change_seq = seq;
+        bus->publish(frame);
+        spent += nowNs() - start;
+        if (interval_us > 0) {
+            usleep(interval_us);
+        }
+    }
+    return spent / frames;
+}
+
+static bool run(const char* label, unsigned long frames, bool reader) {
+    char name[64];
+    snprintf(name, sizeof(name), "frame_bus_bench_%d", (int) getpid());
+    FrameBusLayout_t layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.num_slots = NUM_SLOTS;
+    FrameBus bus;
+    if (!bus.create(name, layout, 4096)) {
+        return false;
+    }
+
+    pid_t child = -1;
+    if (reader) {
+        // The child must not print what is still buffered here again
+        fflush(stdout);
+        child = fork();
+        if (child < 0) {
+            perror("unable to fork reader");
+            return false;
+        }
+        if (child == 0) {
+            _exit(readFrames(name, frames));
+        }
+        // Lets the reader attach and start waiting
+        usleep(200000);
+    }
+
+    double ns = publishFrames(&bus, frames, reader ? WAITING_INTERVAL_US : 0);
+    bus.close();
+    printf("%-8s %9lu frames %9.1f ns per frame\n", label, frames, ns);
+
+    if (child > 0) {
+        int status = 0;
+        waitpid(child, &status, 0);
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    unsigned long frames = 1000000;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = strtoul(argv[i] + 9, NULL, 10);
+        } else {
+            printf("usage: frame_bus_bench [--frames=N]\n");
+            return -1;
+        }
+    }
+    if (frames < 100) {
+        printf("frames must be at least 100\n");
+        return -1;
+    }
+
+    bool ok = run("idle", frames, false);
+    ok = run("waiting", frames / 100, true) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,425 @@
+// Golden output check of the optimized paths against the reference
+// behaviour they replaced. Recorded clips are run through both, frame
+// by frame, and each stage is compared and timed:
+//   prob   cv::absdiff                        vs MotionProbYDiff
+//   mask   absdiff, threshold, morphologyEx   vs MotionMaskKernel
+//   blobs  the reference mask and cvLabel     vs MotionLocBlobThresh
+//   bgd    float mean of the bgd frames       vs BgdCapturerAverage,
+//                                                BgdCapturerRunning
+// Motion stages on both sides work against the reference bgd, so an
+// error in one stage doesn't carry over into the next. Reported are
+// the share of differing prob pixels, mask IoU, blob count and bbox
+// differences and bgd PSNR, next to each stage's speedup.
+//
+// prob, mask and bgd avg must match the reference exactly, and so must
+// the blobs when detected at full resolution; downscaled blobs must
+// keep a bbox IoU of at least --min-blob-iou on every frame. bgd run is
+// a different model than the reference and only reported. Exits
+// non-zero when any clip deviates or can't be read.
+//
+// Usage: golden_bench [--scale=N] [--csv=file] [--min-blob-iou=X]
+//                     clip [clip ...]
+//   --scale         pyramid level the candidate blobs are detected on
+//   --csv           also write every frame's figures to file, -1 where
+//                   a stage wasn't compared on that frame
+//   --min-blob-iou  worst bbox IoU accepted at --scale above 1 (0.5)
+#include <opencv2/opencv.hpp>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "video_frame.h"
+#include "BackgroundStore.h"
+#include "BgdCapturerAverage.h"
+#include "BgdCapturerRunning.h"
+#include "MotionLocBlobThresh.h"
+#include "MotionMaskKernel.h"
+#include "MotionProbYDiff.h"
+#include "cvblob.h"
+
+// Parameters of the reference path, the defaults of the processors
+const static int THRESH = 6;
+const static int RADIUS = 4;
+const static int BGD_STEP = 5;
+const static int FRAMES_PER_BGD = 20;
+
+enum Stage {
+    STAGE_PROB = 0,
+    STAGE_MASK,
+    STAGE_BLOBS,
+    STAGE_BGD_AVERAGE,
+    STAGE_BGD_RUNNING,
+    NUM_STAGES
+};
+const static char* STAGE_NAMES[NUM_STAGES] = {
+    "prob", "mask", "blobs", "bgd avg", "bgd run"
+};
+
+// BgdCapturerAverage as it was before the integer kernels: every
+// BGD_STEP frames one goes into a ring of FRAMES_PER_BGD, and the bgd is
+// the float mean of the ring each time the ring comes round
+class ReferenceAverage {
+    public:
+        ReferenceAverage(int width, int height) :
+            _frames(FRAMES_PER_BGD),
+            _ctr(0),
+            _frame_i(0),
+            _acc(height, width, CV_32FC1) {
+            for (int i = 0; i < FRAMES_PER_BGD; i++) {
+                _frames[i] = cv::Mat(height, width, CV_8UC1, cv::Scalar(0));
+            }
+        };
+
+        // True when a new bgd was computed
+        bool update(const cv::Mat& frame) {
+            _ctr = (_ctr + 1) % BGD_STEP;
+            if (_ctr != 0) {
+                return false;
+            }
+            frame.copyTo(_frames[_frame_i]);
+            _frame_i = (_frame_i + 1) % FRAMES_PER_BGD;
+            if (_frame_i != FRAMES_PER_BGD - 1) {
+                return false;
+            }
+            _acc.setTo(cv::Scalar(0));
+            for (int i = 0; i < FRAMES_PER_BGD; i++) {
+                cv::accumulate(_frames[i], _acc);
+            }
+            _acc.convertTo(_bgd, CV_8UC1, 1.0 / FRAMES_PER_BGD);
+            return true;
+        };
+        const cv::Mat& bgd() const {
+            return _bgd;
+        };
+
+    private:
+        std::vector<cv::Mat> _frames;
+        int _ctr;
+        int _frame_i;
+        cv::Mat _acc;
+        cv::Mat _bgd;
+};
+
+// Figures of one stage, summed over the frames
+typedef struct StageStats {
+    StageStats() :
+        ref_ticks(0), cand_ticks(0), frames(0), sum(0), min(1e9),
+        count_diff(0) {};
+
+    double ref_ticks;
+    double cand_ticks;
+    // Frames the accuracy figure was taken on
+    int frames;
+    double sum;
+    double min;
+    // Blobs only: summed |reference count - candidate count|
+    double count_diff;
+
+    void add(double value) {
+        frames++;
+        sum += value;
+        min = std::min(min, value);
+    };
+} StageStats_t;
+
+static double maskIoU(const cv::Mat& a, const cv::Mat& b) {
+    cv::Mat both;
+    cv::Mat either;
+    cv::bitwise_and(a, b, both);
+    cv::bitwise_or(a, b, either);
+    int u = cv::countNonZero(either);
+    return u == 0 ? 1.0 : (double) cv::countNonZero(both) / u;
+}
+
+static double bboxIoU(const cvb::CvBlob* a, const cvb::CvBlob* b) {
+    cv::Rect ra(a->minx, a->miny, a->maxx - a->minx + 1,
+            a->maxy - a->miny + 1);
+    cv::Rect rb(b->minx, b->miny, b->maxx - b->minx + 1,
+            b->maxy - b->miny + 1);
+    double inter = (ra & rb).area();
+    return inter / (ra.area() + rb.area() - inter);
+}
+
+// Mean over the reference blobs of the best bbox IoU with any candidate
+// blob; 1 if neither has any
+static double meanBestIoU(const cvb::CvBlobs& ref,
+        const cvb::CvBlobs& cand) {
+    if (ref.empty()) {
+        return cand.empty() ? 1.0 : 0.0;
+    }
+    double total = 0;
+    for (cvb::CvBlobs::const_iterator r = ref.begin(); r != ref.end(); ++r) {
+        double best = 0;
+        for (cvb::CvBlobs::const_iterator c = cand.begin();
+                c != cand.end(); ++c) {
+            best = std::max(best, bboxIoU(r->second, c->second));
+        }
+        total += best;
+    }
+    return total / ref.size();
+}
+
+// PSNR in dB, capped at 99 for identical images
+static double psnr(const cv::Mat& a, const cv::Mat& b) {
+    double err = cv::norm(a, b, cv::NORM_L2);
+    double mse = err * err / a.total();
+    if (mse == 0) {
+        return 99;
+    }
+    return 10 * log10(255.0 * 255.0 / mse);
+}
+
+// Whether the stage's figures are within what it must keep to
+static bool withinGolden(int stage, const StageStats_t& st, int scale,
+        double min_blob_iou) {
+    switch (stage) {
+        case STAGE_PROB:
+            return st.sum == 0;
+        case STAGE_MASK:
+            return st.min == 1;
+        case STAGE_BLOBS:
+            if (scale == 1) {
+                return st.count_diff == 0 && st.min == 1;
+            }
+            return st.min >= min_blob_iou;
+        case STAGE_BGD_AVERAGE:
+            return st.min == 99;
+        default:
+            return true;
+    }
+}
+
+static bool checkClip(const char* path, int scale, double min_blob_iou,
+        FILE* csv) {
+    cv::VideoCapture cap(path);
+    cv::Mat color;
+    if (!cap.read(color)) {
+        std::cout << "unable to read " << path << std::endl;
+        return false;
+    }
+    int width = color.cols;
+    int height = color.rows;
+    cap.open(path);
+
+    // Single slot buffer, processFrame is called directly so no
+    // locking is needed
+    std::vector<VideoFrame_t> frame_buffer(1);
+    frame_buffer[0].exit_thread = false;
+    frame_buffer[0].rw_lock = NULL;
+
+    ReferenceAverage ref_average(width, height);
+    BackgroundStore average_store(width, height);
+    BgdCapturerAverage average(&frame_buffer, 1, width, height,
+            FRAMES_PER_BGD);
+    average.setBackgroundStore(&average_store);
+    BackgroundStore running_store(width, height);
+    BgdCapturerRunning running(&frame_buffer, 1, width, height);
+    running.setBackgroundStore(&running_store);
+
+    // The candidate locator gets the reference bgd
+    BackgroundStore motion_store(width, height);
+    MotionLocBlobThresh motion(&frame_buffer, 1, width, height);
+    motion.setBackgroundStore(&motion_store);
+    motion.setFullDetectInterval(0);
+    if (!motion.setScale(scale)) {
+        return false;
+    }
+    MotionProbYDiff prob(width, height);
+    MotionMaskKernel kernel;
+
+    cv::Mat element = cv::getStructuringElement(cv::MORPH_ELLIPSE,
+            cv::Size(2 * RADIUS + 1, 2 * RADIUS + 1),
+            cv::Point(RADIUS, RADIUS));
+    IplImage* ref_labels = cvCreateImage(cvSize(width, height),
+            IPL_DEPTH_LABEL, 1);
+
+    StageStats_t stats[NUM_STAGES];
+    cv::Mat ref_diff;
+    cv::Mat ref_bin;
+    cv::Mat cand_diff;
+    cv::Mat cand_bin;
+    cv::Mat cand_bgd;
+    int frames = 0;
+    while (cap.read(color)) {
+        cv::cvtColor(color, frame_buffer[0].frame, CV_BGR2GRAY);
+        const cv::Mat& frame = frame_buffer[0].frame;
+        // Every frame counts as changed so none is skipped as static
+        frame_buffer[0].seq = frames + 1;
+        frame_buffer[0].last_change_seq = frames + 1;
+        frames++;
+        double row[NUM_STAGES];
+        for (int s = 0; s < NUM_STAGES; s++) {
+            row[s] = -1;
+        }
+        int ref_count = -1;
+        int cand_count = -1;
+
+        // Background models
+        double start = (double) cv::getTickCount();
+        bool new_bgd = ref_average.update(frame);
+        double mid = (double) cv::getTickCount();
+        average.processFrame();
+        double end = (double) cv::getTickCount();
+        running.processFrame();
+        double end_running = (double) cv::getTickCount();
+        stats[STAGE_BGD_AVERAGE].ref_ticks += mid - start;
+        stats[STAGE_BGD_AVERAGE].cand_ticks += end - mid;
+        stats[STAGE_BGD_RUNNING].ref_ticks += mid - start;
+        stats[STAGE_BGD_RUNNING].cand_ticks += end_running - end;
+        if (new_bgd) {
+            motion_store.set(ref_average.bgd());
+        }
+        const cv::Mat& bgd = ref_average.bgd();
+        if (bgd.empty()) {
+            continue;
+        }
+        if (new_bgd) {
+            unsigned int version = 0;
+            average_store.get(&cand_bgd, &version);
+            row[STAGE_BGD_AVERAGE] = psnr(bgd, cand_bgd);
+            stats[STAGE_BGD_AVERAGE].add(row[STAGE_BGD_AVERAGE]);
+            if (running_store.get(&cand_bgd, &version)) {
+                row[STAGE_BGD_RUNNING] = psnr(bgd, cand_bgd);
+                stats[STAGE_BGD_RUNNING].add(row[STAGE_BGD_RUNNING]);
+            }
+        }
+
+        // Motion probability
+        start = (double) cv::getTickCount();
+        cv::absdiff(frame, bgd, ref_diff);
+        mid = (double) cv::getTickCount();
+        prob.getMotionProbs(frame, bgd, &cand_diff);
+        end = (double) cv::getTickCount();
+        stats[STAGE_PROB].ref_ticks += mid - start;
+        stats[STAGE_PROB].cand_ticks += end - mid;
+        row[STAGE_PROB] = (double) cv::countNonZero(ref_diff != cand_diff) /
+            frame.total();
+        stats[STAGE_PROB].add(row[STAGE_PROB]);
+
+        // Threshold and morphology
+        start = (double) cv::getTickCount();
+        cv::absdiff(frame, bgd, ref_diff);
+        cv::threshold(ref_diff, ref_bin, THRESH, 255, cv::THRESH_BINARY);
+        cv::morphologyEx(ref_bin, ref_bin, cv::MORPH_OPEN, element);
+        cv::morphologyEx(ref_bin, ref_bin, cv::MORPH_CLOSE, element);
+        mid = (double) cv::getTickCount();
+        kernel.run(frame, bgd, THRESH, RADIUS, &cand_diff, &cand_bin);
+        end = (double) cv::getTickCount();
+        double ref_mask_ticks = mid - start;
+        stats[STAGE_MASK].ref_ticks += ref_mask_ticks;
+        stats[STAGE_MASK].cand_ticks += end - mid;
+        row[STAGE_MASK] = maskIoU(ref_bin, cand_bin);
+        stats[STAGE_MASK].add(row[STAGE_MASK]);
+
+        // Blobs, the reference timed from the mask on top of the mask
+        // stage so both sides cover the whole detection
+        cvb::CvBlobs ref_blobs;
+        cvb::CvBlobs cand_blobs;
+        IplImage ref_ipl = ref_bin;
+        start = (double) cv::getTickCount();
+        cvb::cvLabel(&ref_ipl, ref_labels, ref_blobs);
+        mid = (double) cv::getTickCount();
+        motion.processFrame();
+        end = (double) cv::getTickCount();
+        motion.getLastMotionBlobs(&cand_blobs);
+        stats[STAGE_BLOBS].ref_ticks += ref_mask_ticks + mid - start;
+        stats[STAGE_BLOBS].cand_ticks += end - mid;
+        ref_count = (int) ref_blobs.size();
+        cand_count = (int) cand_blobs.size();
+        stats[STAGE_BLOBS].count_diff += abs(ref_count - cand_count);
+        row[STAGE_BLOBS] = meanBestIoU(ref_blobs, cand_blobs);
+        stats[STAGE_BLOBS].add(row[STAGE_BLOBS]);
+        cvb::cvReleaseBlobs(ref_blobs);
+
+        if (csv != NULL) {
+            fprintf(csv, "%s,%d,%.6f,%.4f,%d,%d,%.4f,%.2f,%.2f\n", path,
+                    frames, row[STAGE_PROB], row[STAGE_MASK],
+                    ref_count, cand_count, row[STAGE_BLOBS],
+                    row[STAGE_BGD_AVERAGE], row[STAGE_BGD_RUNNING]);
+        }
+    }
+    cvReleaseImage(&ref_labels);
+
+    printf("%s: %dx%d, %d frames, blobs at 1/%d\n", path, width, height,
+            frames, scale);
+    printf("  %-8s %9s %9s %8s  %s\n", "stage", "ref ms", "cand ms",
+            "speedup", "accuracy (mean / worst)");
+    double ms = 1000.0 / cv::getTickFrequency() / std::max(frames, 1);
+    bool golden = true;
+    for (int s = 0; s < NUM_STAGES; s++) {
+        const StageStats_t& st = stats[s];
+        printf("  %-8s %9.3f %9.3f %8.2f  ", STAGE_NAMES[s],
+                st.ref_ticks * ms, st.cand_ticks * ms,
+                st.ref_ticks / std::max(st.cand_ticks, 1.0));
+        if (st.frames == 0) {
+            printf("no frames compared\n");
+            continue;
+        }
+        double mean = st.sum / st.frames;
+        switch (s) {
+            case STAGE_PROB:
+                // The worst frame is the largest share of differences
+                printf("differing pixels %.4f%%\n", 100 * mean);
+                break;
+            case STAGE_MASK:
+                printf("IoU %.4f / %.4f\n", mean, st.min);
+                break;
+            case STAGE_BLOBS:
+                printf("|dcount| %.3f, bbox IoU %.4f / %.4f\n",
+                        st.count_diff / st.frames, mean, st.min);
+                break;
+            default:
+                printf("PSNR %.2f / %.2f dB\n", mean, st.min);
+                break;
+        }
+        if (!withinGolden(s, st, scale, min_blob_iou)) {
+            printf("  %-8s DEVIATES from the reference\n", STAGE_NAMES[s]);
+            golden = false;
+        }
+    }
+    return golden;
+}
+
+int main(int argc, char** argv) {
+    int scale = 1;
+    double min_blob_iou = 0.5;
+    FILE* csv = NULL;
+    int clips = 0;
+    int failed = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--scale=", 8) == 0) {
+            scale = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--csv=", 6) == 0) {
+            csv = fopen(argv[i] + 6, "w");
+            if (csv == NULL) {
+                perror(argv[i] + 6);
+                return -1;
+            }
+            fprintf(csv, "clip,frame,prob_diff,mask_iou,ref_blobs,"
+                    "cand_blobs,bbox_iou,bgd_avg_psnr,bgd_run_psnr\n");
+        } else if (strncmp(argv[i], "--min-blob-iou=", 15) == 0) {
+            min_blob_iou = atof(argv[i] + 15);
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            if (!checkClip(argv[i], scale, min_blob_iou, csv)) {
+                failed++;
+            }
+            clips++;
+        }
+    }
+    if (clips == 0) {
+        std::cout << "usage: golden_bench [--scale=N] [--csv=file] "
+            "[--min-blob-iou=X] clip [clip ...]" << std::endl;
+        return -1;
+    }
+    if (csv != NULL) {
+        fclose(csv);
+    }
+    printf("%d of %d clips match the reference\n", clips - failed, clips);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,317 @@
+// Localhost check of MjpegServer. Clients connect over loopback and
+// count the multipart parts they receive while frames are published:
+//   fan-out  1, 2, 4, ... fast clients; every client gets every frame,
+//            each frame is encoded once whatever the client count, and
+//            the publish cost per frame is reported
+//   drop     a client with a small receive buffer that never reads,
+//            next to a fast one; the slow one drops frames, the fast
+//            one still gets them all
+//   pages    GET / lists the stream, an unknown stream is a 404
+//   clients  the client count goes back to 0 once everyone hung up
+// Exits non-zero when any check fails.
+//
+// Usage: mjpeg_server_bench [--port=N] [--frames=N] [--clients=N]
+//   --port     port served on (8089)
+//   --frames   frames published per check (200)
+//   --clients  most fast clients in the fan-out check (8)
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Metrics.h"
+#include "MjpegServer.h"
+
+// Time between published frames, well above what loopback needs to
+// deliver one to a client that keeps reading
+const static int PUBLISH_INTERVAL_US = 2000;
+// How long clients get to catch up or hang up before a check fails
+const static int SETTLE_MS = 2000;
+// Receive buffer of the client that never reads
+const static int SLOW_RCVBUF = 4096;
+
+static const char PART_MARK[] = "--frame\r\n";
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    printf("  %-48s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        failures++;
+    }
+}
+
+static void sleepMs(int ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+// Polls metric until it reaches value, false after SETTLE_MS
+static bool waitForMetric(const std::string& metric, double value) {
+    for (int waited = 0; waited < SETTLE_MS; waited += 10) {
+        if (globalMetrics().get(metric) == value) {
+            return true;
+        }
+        sleepMs(10);
+    }
+    return false;
+}
+
+// Connects to the server and requests path; rcvbuf 0 keeps the
+// default receive buffer
+static int openClient(int port, const std::string& path, int rcvbuf) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("unable to create client socket");
+        return -1;
+    }
+    if (rcvbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    std::string request = "GET " + path + " HTTP/1.0\r\n\r\n";
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+            send(fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+            (ssize_t) request.size()) {
+        perror("unable to request stream");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Whole response of a request the server closes after, such as a page
+static std::string fetch(int port, const std::string& path) {
+    std::string response;
+    int fd = openClient(port, path, 0);
+    if (fd < 0) {
+        return response;
+    }
+    char buf[4096];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        response.append(buf, n);
+    }
+    close(fd);
+    return response;
+}
+
+// Client reading a stream on its own thread, counting the parts
+typedef struct Reader {
+    int fd;
+    pthread_t thread;
+    volatile int parts;
+} Reader_t;
+
+static void* readStream(void* arg) {
+    Reader_t* reader = (Reader_t*) arg;
+    char buf[64 * 1024];
+    // Tail of the previous read, so a mark split over two reads counts
+    std::string window;
+    ssize_t n;
+    while ((n = recv(reader->fd, buf, sizeof(buf), 0)) > 0) {
+        window.append(buf, n);
+        std::string::size_type pos = 0;
+        while ((pos = window.find(PART_MARK, pos)) != std::string::npos) {
+            reader->parts++;
+            pos += sizeof(PART_MARK) - 1;
+        }
+        if (window.size() >= sizeof(PART_MARK) - 1) {
+            window.erase(0, window.size() - (sizeof(PART_MARK) - 2));
+        }
+    }
+    return NULL;
+}
+
+static bool startReader(int port, Reader_t* reader) {
+    reader->parts = 0;
+    reader->fd = openClient(port, "/test", 0);
+    if (reader->fd < 0) {
+        return false;
+    }
+    if (pthread_create(&reader->thread, NULL, &readStream, reader)) {
+        perror("Could not create client thread.");
+        close(reader->fd);
+        return false;
+    }
+    return true;
+}
+
+static void stopReader(Reader_t* reader) {
+    shutdown(reader->fd, SHUT_RDWR);
+    pthread_join(reader->thread, NULL);
+    close(reader->fd);
+}
+
+// Waits until every reader got frames parts, false after SETTLE_MS
+static bool waitForParts(const std::vector<Reader_t*>& readers, int frames) {
+    for (int waited = 0; waited < SETTLE_MS; waited += 10) {
+        bool all = true;
+        for (size_t r = 0; r < readers.size(); r++) {
+            all = all && readers[r]->parts >= frames;
+        }
+        if (all) {
+            return true;
+        }
+        sleepMs(10);
+    }
+    return false;
+}
+
+// Test card the fan-out check encodes on every publish
+static cv::Mat testFrame() {
+    cv::Mat img(240, 352, CV_8UC3);
+    for (int y = 0; y < img.rows; y++) {
+        cv::Vec3b* p = img.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < img.cols; x++) {
+            p[x] = cv::Vec3b(x * 255 / img.cols, y * 255 / img.rows, 128);
+        }
+    }
+    cv::rectangle(img, cv::Rect(120, 80, 100, 60), cv::Scalar(0, 0, 255),
+            -1);
+    return img;
+}
+
+static void fanOut(MjpegServer* server, int stream, int port, int frames,
+        int clients) {
+    cv::Mat img = testFrame();
+    printf("fan-out\n");
+    printf("  %7s %9s %9s %12s\n", "clients", "encoded", "received",
+            "publish ms");
+    for (int n = 1; n <= clients; n *= 2) {
+        std::vector<Reader_t> readers(n);
+        std::vector<Reader_t*> started;
+        for (int r = 0; r < n; r++) {
+            if (startReader(port, &readers[r])) {
+                started.push_back(&readers[r]);
+            }
+        }
+        check((int) started.size() == n &&
+                waitForMetric("http.clients", n), "clients connected");
+
+        double encoded_before = globalMetrics().get("http.frames_encoded");
+        double ticks = 0;
+        for (int f = 0; f < frames; f++) {
+            double t0 = (double) cv::getTickCount();
+            server->publish(stream, img);
+            ticks += (double) cv::getTickCount() - t0;
+            usleep(PUBLISH_INTERVAL_US);
+        }
+        bool all = waitForParts(started, frames);
+        double encoded = globalMetrics().get("http.frames_encoded") -
+            encoded_before;
+        int least = frames;
+        for (size_t r = 0; r < started.size(); r++) {
+            least = std::min(least, (int) started[r]->parts);
+        }
+        printf("  %7d %9.0f %9d %12.3f\n", n, encoded, least,
+                1000.0 * ticks / cv::getTickFrequency() / frames);
+        check(all, "every client got every frame");
+        check(encoded == frames, "each frame encoded once");
+
+        for (size_t r = 0; r < started.size(); r++) {
+            stopReader(started[r]);
+        }
+        check(waitForMetric("http.clients", 0), "clients gone after hang up");
+    }
+}
+
+static void drop(MjpegServer* server, int stream, int port, int frames) {
+    printf("drop\n");
+    std::vector<unsigned char> jpeg;
+    cv::imencode(".jpg", testFrame(), jpeg);
+
+    Reader_t fast;
+    std::vector<Reader_t*> readers;
+    if (startReader(port, &fast)) {
+        readers.push_back(&fast);
+    }
+    int slow = openClient(port, "/test", SLOW_RCVBUF);
+    check(readers.size() == 1 && slow >= 0 &&
+            waitForMetric("http.clients", 2), "clients connected");
+
+    double dropped_before = globalMetrics().get("http.frames_dropped");
+    for (int f = 0; f < frames; f++) {
+        server->publishEncoded(stream, &jpeg[0], jpeg.size());
+        usleep(PUBLISH_INTERVAL_US);
+    }
+    bool all = waitForParts(readers, frames);
+    double dropped = globalMetrics().get("http.frames_dropped") -
+        dropped_before;
+    printf("  fast client received %d of %d, slow client dropped %.0f\n",
+            readers.empty() ? 0 : (int) fast.parts, frames, dropped);
+    check(all, "fast client got every frame");
+    check(dropped > 0, "slow client dropped frames");
+
+    if (!readers.empty()) {
+        stopReader(&fast);
+    }
+    if (slow >= 0) {
+        close(slow);
+    }
+    check(waitForMetric("http.clients", 0), "clients gone after hang up");
+}
+
+static void pages(int port) {
+    printf("pages\n");
+    std::string index = fetch(port, "/");
+    check(index.compare(0, 15, "HTTP/1.0 200 OK") == 0 &&
+            index.find("href=\"/test\"") != std::string::npos,
+            "index lists the stream");
+    std::string missing = fetch(port, "/nope");
+    check(missing.compare(0, 12, "HTTP/1.0 404") == 0,
+            "unknown stream is a 404");
+    check(waitForMetric("http.clients", 0), "no clients left behind");
+}
+
+int main(int argc, char** argv) {
+    int port = 8089;
+    int frames = 200;
+    int clients = 8;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--port=", 7) == 0) {
+            port = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--clients=", 10) == 0) {
+            clients = atoi(argv[i] + 10);
+        } else {
+            std::cout << "usage: mjpeg_server_bench [--port=N] "
+                "[--frames=N] [--clients=N]" << std::endl;
+            return -1;
+        }
+    }
+    if (frames < 1 || clients < 1) {
+        std::cout << "frames and clients must be at least 1" << std::endl;
+        return -1;
+    }
+
+    MjpegServer server(port);
+    int stream = server.addStream("test");
+    if (!server.start()) {
+        return -1;
+    }
+    pages(port);
+    fanOut(&server, stream, port, frames, clients);
+    drop(&server, stream, port, frames);
+    server.stop();
+
+    printf("%s\n", failures == 0 ? "all checks passed" : "checks failed");
+    return failures == 0 ? 0 : 1;
+}
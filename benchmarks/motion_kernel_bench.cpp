@@ -0,0 +1,122 @@
+// Times the motion mask (difference, threshold, opening and closing)
+// for each frame size MotionMaskKernel has a specialized instantiation
+// for: OpenCV's absdiff/threshold/morphologyEx, the generic kernel and
+// the specialized kernel. Frames are synthetic, a noisy background
+// with moving blocks, and both kernels are checked against OpenCV.
+//
+// Usage: motion_kernel_bench [iterations]
+#include <opencv2/opencv.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "MotionMaskKernel.h"
+
+const static int NUM_SIZES = 3;
+const static int WIDTHS[NUM_SIZES] = {352, 640, 1280};
+const static int HEIGHTS[NUM_SIZES] = {240, 480, 720};
+
+const static int THRESH = 6;
+const static int RADIUS = 4;
+// Distinct frames cycled through while timing
+const static int NUM_FRAMES = 16;
+
+static void makeFrames(int width, int height, cv::Mat* bgd,
+        std::vector<cv::Mat>* frames) {
+    cv::RNG rng(width * height);
+    bgd->create(height, width, CV_8UC1);
+    rng.fill(*bgd, cv::RNG::UNIFORM, 0, 256);
+    cv::Mat noise(height, width, CV_8UC1);
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        cv::Mat frame = bgd->clone();
+        // Sensor noise around the threshold
+        rng.fill(noise, cv::RNG::UNIFORM, 0, 2 * THRESH);
+        cv::add(frame, noise, frame);
+        for (int b = 0; b < 4; b++) {
+            int bw = width / 8;
+            int bh = height / 6;
+            int x = (b * width / 4 + i * width / (2 * NUM_FRAMES)) %
+                (width - bw);
+            int y = (b * height / 5 + i * 3) % (height - bh);
+            cv::rectangle(frame, cv::Rect(x, y, bw, bh),
+                    cv::Scalar(rng.uniform(0, 256)), CV_FILLED);
+        }
+        frames->push_back(frame);
+    }
+}
+
+static void referenceMask(const cv::Mat& frame, const cv::Mat& bgd,
+        const cv::Mat& element, cv::Mat* diff, cv::Mat* bin) {
+    cv::absdiff(frame, bgd, *diff);
+    cv::threshold(*diff, *bin, THRESH, 256, 0);
+    cv::morphologyEx(*bin, *bin, 2, element);
+    cv::morphologyEx(*bin, *bin, 3, element);
+}
+
+static void benchSize(int width, int height, int iterations) {
+    cv::Mat bgd;
+    std::vector<cv::Mat> frames;
+    makeFrames(width, height, &bgd, &frames);
+    cv::Mat element = cv::getStructuringElement(2, // ellipse
+            cv::Size(2 * RADIUS + 1, 2 * RADIUS + 1),
+            cv::Point(RADIUS, RADIUS));
+
+    MotionMaskKernel generic;
+    generic.setForceGeneric(true);
+    MotionMaskKernel specialized;
+
+    cv::Mat diff;
+    cv::Mat bin;
+    cv::Mat ref_diff;
+    cv::Mat ref_bin;
+    int mismatches = 0;
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        referenceMask(frames[i], bgd, element, &ref_diff, &ref_bin);
+        generic.run(frames[i], bgd, THRESH, RADIUS, &diff, &bin);
+        mismatches += cv::countNonZero(bin != ref_bin);
+        mismatches += cv::countNonZero(diff != ref_diff);
+        specialized.run(frames[i], bgd, THRESH, RADIUS, &diff, &bin);
+        mismatches += cv::countNonZero(bin != ref_bin);
+        mismatches += cv::countNonZero(diff != ref_diff);
+    }
+
+    double ticks[3] = {0, 0, 0};
+    for (int i = 0; i < iterations; i++) {
+        const cv::Mat& frame = frames[i % NUM_FRAMES];
+        double start = (double) cv::getTickCount();
+        referenceMask(frame, bgd, element, &ref_diff, &ref_bin);
+        ticks[0] += (double) cv::getTickCount() - start;
+
+        start = (double) cv::getTickCount();
+        generic.run(frame, bgd, THRESH, RADIUS, &diff, &bin);
+        ticks[1] += (double) cv::getTickCount() - start;
+
+        start = (double) cv::getTickCount();
+        specialized.run(frame, bgd, THRESH, RADIUS, &diff, &bin);
+        ticks[2] += (double) cv::getTickCount() - start;
+    }
+
+    double ms = 1000.0 / cv::getTickFrequency() / iterations;
+    printf("%5dx%-5d %8.3f %8.3f %8.3f %10.2f %10.2f  %s\n",
+            width, height,
+            ticks[0] * ms, ticks[1] * ms, ticks[2] * ms,
+            ticks[0] / ticks[2], ticks[1] / ticks[2],
+            mismatches == 0 ? "ok" : "MISMATCH");
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    printf("thresh %d, radius %d, %d iterations, ms/frame\n",
+            THRESH, RADIUS, iterations);
+    printf("%-11s %8s %8s %8s %10s %10s\n", "size", "opencv", "generic",
+            "special", "vs opencv", "vs generic");
+    for (int i = 0; i < NUM_SIZES; i++) {
+        if (!MotionMaskKernel::isSpecialized(WIDTHS[i], HEIGHTS[i],
+                    THRESH, RADIUS)) {
+            std::cout << "no specialization for " << WIDTHS[i] << "x" <<
+                HEIGHTS[i] << std::endl;
+        }
+        benchSize(WIDTHS[i], HEIGHTS[i], iterations);
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+// Replays recorded clips through MotionLocBlobThresh at full resolution
+// and at each pyramid level, and reports the time per frame next to how
+// far the downscaled detection strays from the full resolution one.
+//
+// Usage: motion_scale_bench clip [clip ...]
+#include <opencv2/opencv.hpp>
+#include <stdio.h>
+#include <vector>
+
+#include "video_frame.h"
+#include "BackgroundStore.h"
+#include "MotionLocBlobThresh.h"
+#include "cvblob.h"
+
+// Frames averaged into the background before timing starts
+const static int WARMUP_FRAMES = 20;
+
+const static int NUM_SCALES = 3;
+const static int SCALES[NUM_SCALES] = {1, 2, 4};
+
+static double bboxIoU(const cvb::CvBlob* a, const cvb::CvBlob* b) {
+    cv::Rect ra(a->minx, a->miny, a->maxx - a->minx + 1,
+            a->maxy - a->miny + 1);
+    cv::Rect rb(b->minx, b->miny, b->maxx - b->minx + 1,
+            b->maxy - b->miny + 1);
+    double inter = (ra & rb).area();
+    return inter / (ra.area() + rb.area() - inter);
+}
+
+// Mean over the reference blobs of the best bbox IoU with any candidate
+static double meanBestIoU(const cvb::CvBlobs& ref,
+        const cvb::CvBlobs& cand) {
+    double total = 0;
+    for (cvb::CvBlobs::const_iterator r = ref.begin(); r != ref.end(); ++r) {
+        double best = 0;
+        for (cvb::CvBlobs::const_iterator c = cand.begin();
+                c != cand.end(); ++c) {
+            best = std::max(best, bboxIoU(r->second, c->second));
+        }
+        total += best;
+    }
+    return total / ref.size();
+}
+
+static bool benchClip(const char* path) {
+    cv::VideoCapture cap(path);
+    cv::Mat color;
+    if (!cap.read(color)) {
+        std::cout << "unable to read " << path << std::endl;
+        return false;
+    }
+    int width = color.cols;
+    int height = color.rows;
+
+    // Background from the mean of the first frames
+    cv::Mat gray;
+    cv::Mat acc(height, width, CV_32FC1, cv::Scalar(0));
+    cv::Mat gray_f;
+    int warmup = 0;
+    do {
+        cv::cvtColor(color, gray, CV_BGR2GRAY);
+        gray.convertTo(gray_f, CV_32FC1);
+        cv::add(acc, gray_f, acc);
+        warmup++;
+    } while (warmup < WARMUP_FRAMES && cap.read(color));
+    cv::Mat bgd;
+    acc.convertTo(bgd, CV_8UC1, 1.0 / warmup);
+
+    // Single slot buffer, processFrame is called directly so no
+    // locking is needed
+    std::vector<VideoFrame_t> frame_buffer(1);
+    frame_buffer[0].exit_thread = false;
+
+    BackgroundStore bgd_store(width, height);
+    bgd_store.set(bgd);
+
+    std::vector<MotionLocBlobThresh*> detectors;
+    for (int i = 0; i < NUM_SCALES; i++) {
+        MotionLocBlobThresh* detector = new MotionLocBlobThresh(
+                &frame_buffer, 1, width, height);
+        detector->setScale(SCALES[i]);
+        detector->setFullDetectInterval(0);
+        detector->setBackgroundStore(&bgd_store);
+        detectors.push_back(detector);
+    }
+
+    std::vector<double> ticks(NUM_SCALES, 0);
+    std::vector<double> count_diff(NUM_SCALES, 0);
+    std::vector<double> iou(NUM_SCALES, 0);
+    int frames = 0;
+    int frames_with_blobs = 0;
+
+    cap.open(path);
+    while (cap.read(color)) {
+        cv::cvtColor(color, frame_buffer[0].frame, CV_BGR2GRAY);
+        // Every frame counts as changed so none is skipped as static
+        frame_buffer[0].seq = frames + 1;
+        frame_buffer[0].last_change_seq = frames + 1;
+
+        cvb::CvBlobs blobs[NUM_SCALES];
+        for (int i = 0; i < NUM_SCALES; i++) {
+            double start = (double) cv::getTickCount();
+            detectors[i]->processFrame();
+            ticks[i] += (double) cv::getTickCount() - start;
+            detectors[i]->getLastMotionBlobs(&blobs[i]);
+        }
+
+        for (int i = 0; i < NUM_SCALES; i++) {
+            count_diff[i] += abs((int) blobs[i].size() - 
+                    (int) blobs[0].size());
+            if (!blobs[0].empty()) {
+                iou[i] += meanBestIoU(blobs[0], blobs[i]);
+            }
+        }
+        if (!blobs[0].empty()) {
+            frames_with_blobs++;
+        }
+        frames++;
+    }
+
+    printf("%s: %dx%d, %d frames\n", path, width, height, frames);
+    printf("  scale  ms/frame  speedup  |dblobs|  bbox IoU\n");
+    double freq = cv::getTickFrequency();
+    for (int i = 0; i < NUM_SCALES; i++) {
+        printf("  1/%-4d %8.3f  %7.2f  %8.3f  %8.3f\n",
+                SCALES[i],
+                1000.0 * ticks[i] / freq / std::max(frames, 1),
+                ticks[0] / std::max(ticks[i], 1.0),
+                count_diff[i] / std::max(frames, 1),
+                iou[i] / std::max(frames_with_blobs, 1));
+    }
+
+    for (int i = 0; i < NUM_SCALES; i++) {
+        delete detectors[i];
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cout << "usage: motion_scale_bench clip [clip ...]" << std::endl;
+        return -1;
+    }
+    for (int i = 1; i < argc; i++) {
+        benchClip(argv[i]);
+    }
+    return 0;
+}
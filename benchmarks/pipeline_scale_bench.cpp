@@ -0,0 +1,279 @@
+// Scaling of the BgdCapturerAverage -> MotionLocBlobThresh ->
+// IPCamProcessor pipeline on synthetic scenes, see SyntheticScene.
+// Each sweep varies one of resolution, moving objects, cameras and
+// worker threads around a base of one 352x240 camera with 2 objects on
+// one thread, and reports the throughput and each stage's time per
+// frame at every point.
+//
+// Every camera has its own scene, frame buffer, bgd store and
+// processors. The cameras are dealt out to the worker threads, each of
+// which runs its cameras' frames through the three stages in turn.
+// Frames are rendered inline, but only processing is timed, and a
+// configuration takes as long as its busiest worker.
+//
+// Usage: pipeline_scale_bench [--frames=N] [--csv=file]
+//   --frames  frames timed per camera at each point (60)
+//   --csv     also write every point to file
+#include <opencv2/opencv.hpp>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "video_frame.h"
+#include "BackgroundStore.h"
+#include "BgdCapturerAverage.h"
+#include "MotionLocBlobThresh.h"
+#include "IPCamProcessor.h"
+#include "SyntheticScene.h"
+
+// Frames run through each camera before timing starts
+const static int WARMUP_FRAMES = 10;
+const static int FRAMES_PER_BGD = 20;
+
+enum Stage {
+    STAGE_BGD = 0,
+    STAGE_MOTION,
+    STAGE_IPCAM,
+    NUM_STAGES
+};
+
+typedef struct BenchPoint {
+    int width;
+    int height;
+    int objects;
+    int cameras;
+    int threads;
+} BenchPoint_t;
+
+// One camera's scene and pipeline. processFrame is called directly on
+// a single slot buffer, so no locking is needed.
+class BenchCamera {
+    public:
+        BenchCamera(const SyntheticSceneParams_t& params) :
+            _scene(params),
+            _buffer(1),
+            _store(params.width, params.height),
+            _bgd(&_buffer, 1, params.width, params.height, FRAMES_PER_BGD),
+            _motion(&_buffer, 1, params.width, params.height),
+            _ipcam(&_buffer, 1, params.width, params.height, &_motion),
+            _t(0) {
+                VideoFrame_t& slot = _buffer[0];
+                slot.frame.create(params.height, params.width, CV_8UC1);
+                slot.ip_frame.create(params.height, params.width, CV_8UC1);
+                slot.pixel_format = PIX_FMT_BGR;
+                slot.color_valid = false;
+                slot.exit_thread = false;
+                slot.rw_lock = NULL;
+                // Motion has a bgd from the first frame on
+                _store.set(_scene.background());
+                _bgd.setBackgroundStore(&_store);
+                _motion.setBackgroundStore(&_store);
+                _ipcam.setBackgroundStore(&_store);
+                _ipcam.setPtzControl(false);
+                for (int s = 0; s < NUM_STAGES; s++) {
+                    _ticks[s] = 0;
+                }
+            };
+
+        // Renders and processes the next frame, adding each stage's
+        // ticks when timed
+        void step(bool timed) {
+            VideoFrame_t& slot = _buffer[0];
+            _t++;
+            _scene.render(_t, &slot.frame, &slot.ip_frame);
+            slot.seq = _t;
+            slot.last_change_seq = _t;
+            slot.ip_last_change_seq = _t;
+
+            double t0 = (double) cv::getTickCount();
+            _bgd.processFrame();
+            double t1 = (double) cv::getTickCount();
+            _motion.processFrame();
+            double t2 = (double) cv::getTickCount();
+            _ipcam.processFrame();
+            double t3 = (double) cv::getTickCount();
+            if (timed) {
+                _ticks[STAGE_BGD] += t1 - t0;
+                _ticks[STAGE_MOTION] += t2 - t1;
+                _ticks[STAGE_IPCAM] += t3 - t2;
+            }
+        };
+
+        double ticks(int stage) const {
+            return _ticks[stage];
+        };
+
+    private:
+        SyntheticScene _scene;
+        std::vector<VideoFrame_t> _buffer;
+        BackgroundStore _store;
+        BgdCapturerAverage _bgd;
+        MotionLocBlobThresh _motion;
+        IPCamProcessor _ipcam;
+        unsigned long _t;
+        double _ticks[NUM_STAGES];
+};
+
+typedef struct Worker {
+    std::vector<BenchCamera*> cameras;
+    int frames;
+    double ticks;
+} Worker_t;
+
+static void* runWorker(void* arg) {
+    Worker_t* worker = (Worker_t*) arg;
+    for (int i = 0; i < WARMUP_FRAMES; i++) {
+        for (size_t c = 0; c < worker->cameras.size(); c++) {
+            worker->cameras[c]->step(false);
+        }
+    }
+    for (int i = 0; i < worker->frames; i++) {
+        for (size_t c = 0; c < worker->cameras.size(); c++) {
+            worker->cameras[c]->step(true);
+        }
+    }
+    worker->ticks = 0;
+    for (size_t c = 0; c < worker->cameras.size(); c++) {
+        for (int s = 0; s < NUM_STAGES; s++) {
+            worker->ticks += worker->cameras[c]->ticks(s);
+        }
+    }
+    return NULL;
+}
+
+static bool runPoint(const BenchPoint_t& point, int frames, FILE* csv) {
+    std::vector<BenchCamera*> cameras;
+    for (int c = 0; c < point.cameras; c++) {
+        SyntheticSceneParams_t params;
+        params.width = point.width;
+        params.height = point.height;
+        params.num_objects = point.objects;
+        params.seed = c + 1;
+        cameras.push_back(new BenchCamera(params));
+    }
+
+    std::vector<Worker_t> workers(point.threads);
+    for (int c = 0; c < point.cameras; c++) {
+        workers[c % point.threads].cameras.push_back(cameras[c]);
+    }
+    std::vector<pthread_t> threads(point.threads);
+    for (int w = 0; w < point.threads; w++) {
+        workers[w].frames = frames;
+        if (pthread_create(&threads[w], NULL, &runWorker, &workers[w])) {
+            perror("Could not create benchmark worker.");
+            return false;
+        }
+    }
+    double busiest = 0;
+    for (int w = 0; w < point.threads; w++) {
+        pthread_join(threads[w], NULL);
+        busiest = std::max(busiest, workers[w].ticks);
+    }
+
+    double seconds = busiest / cv::getTickFrequency();
+    double fps = point.cameras * frames / seconds;
+    double stage_ms[NUM_STAGES];
+    for (int s = 0; s < NUM_STAGES; s++) {
+        double ticks = 0;
+        for (int c = 0; c < point.cameras; c++) {
+            ticks += cameras[c]->ticks(s);
+        }
+        stage_ms[s] = 1000.0 * ticks / cv::getTickFrequency() /
+            (point.cameras * frames);
+    }
+
+    printf("  %4dx%-4d %4d %4d %4d %9.1f %9.1f %9.3f %9.3f %9.3f\n",
+            point.width, point.height, point.objects, point.cameras,
+            point.threads, fps, fps / point.cameras,
+            stage_ms[STAGE_BGD], stage_ms[STAGE_MOTION],
+            stage_ms[STAGE_IPCAM]);
+    if (csv != NULL) {
+        fprintf(csv, "%d,%d,%d,%d,%d,%.3f,%.4f,%.4f,%.4f\n",
+                point.width, point.height, point.objects, point.cameras,
+                point.threads, fps, stage_ms[STAGE_BGD],
+                stage_ms[STAGE_MOTION], stage_ms[STAGE_IPCAM]);
+    }
+
+    for (int c = 0; c < point.cameras; c++) {
+        delete cameras[c];
+    }
+    return true;
+}
+
+static void printHeader(const char* sweep) {
+    printf("%s\n", sweep);
+    printf("  %9s %4s %4s %4s %9s %9s %9s %9s %9s\n", "size", "objs",
+            "cams", "thrd", "fps", "fps/cam", "bgd ms", "motion ms",
+            "ipcam ms");
+}
+
+int main(int argc, char** argv) {
+    int frames = 60;
+    FILE* csv = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--csv=", 6) == 0) {
+            csv = fopen(argv[i] + 6, "w");
+            if (csv == NULL) {
+                perror(argv[i] + 6);
+                return -1;
+            }
+            fprintf(csv, "width,height,objects,cameras,threads,fps,"
+                    "bgd_ms,motion_ms,ipcam_ms\n");
+        } else {
+            std::cout << "usage: pipeline_scale_bench [--frames=N] "
+                "[--csv=file]" << std::endl;
+            return -1;
+        }
+    }
+    if (frames < 1) {
+        std::cout << "frames must be at least 1" << std::endl;
+        return -1;
+    }
+
+    const BenchPoint_t base = {352, 240, 2, 1, 1};
+    const int sizes[][2] = {{176, 120}, {352, 240}, {640, 480},
+        {1280, 720}};
+    const int objects[] = {0, 1, 2, 4, 8, 16};
+    const int counts[] = {1, 2, 4, 8};
+    const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    const int num_objects = sizeof(objects) / sizeof(objects[0]);
+    const int num_counts = sizeof(counts) / sizeof(counts[0]);
+
+    printHeader("resolution");
+    for (int i = 0; i < num_sizes; i++) {
+        BenchPoint_t point = base;
+        point.width = sizes[i][0];
+        point.height = sizes[i][1];
+        runPoint(point, frames, csv);
+    }
+
+    printHeader("moving objects");
+    for (int i = 0; i < num_objects; i++) {
+        BenchPoint_t point = base;
+        point.objects = objects[i];
+        runPoint(point, frames, csv);
+    }
+
+    // Cameras against threads; more threads than cameras would idle
+    printHeader("cameras x threads");
+    for (int t = 0; t < num_counts; t++) {
+        for (int c = 0; c < num_counts; c++) {
+            if (counts[t] > counts[c]) {
+                continue;
+            }
+            BenchPoint_t point = base;
+            point.cameras = counts[c];
+            point.threads = counts[t];
+            runPoint(point, frames, csv);
+        }
+    }
+
+    if (csv != NULL) {
+        fclose(csv);
+    }
+    return 0;
+}
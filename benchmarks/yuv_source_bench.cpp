@@ -0,0 +1,212 @@
+// Round trip check of the raw YUV capture path. A test card of flat
+// colour patches is written as a headerless I420, NV12 and YUYV file,
+// replayed through CaptureSourceYuvFile into a FramePool slot, and the
+// slot is read back as the processors and the display see it:
+//   gray   slot.frame must be the Y plane that was written
+//   bgr    getColorFrame must give back the card's colours
+// The patches are aligned to the chroma subsampling, so the only error
+// left in bgr is the rounding of the YUV conversion. Exits non-zero
+// when any check fails.
+//
+// Usage: yuv_source_bench [--frames=N]
+//   --frames  frames written to and replayed from each file (4)
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "video_frame.h"
+#include "CaptureSource.h"
+#include "CaptureSourceYuvFile.h"
+#include "FramePool.h"
+
+const static int WIDTH = 64;
+const static int HEIGHT = 48;
+const static int PATCH = 16;
+// Largest difference per channel the YUV rounding may leave in bgr
+const static int BGR_TOLERANCE = 3;
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    printf("  %-48s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        failures++;
+    }
+}
+
+// Patches of saturated and mid colours, one per PATCH x PATCH block,
+// shifted by frame so every frame differs
+static cv::Mat testCard(int frame) {
+    static const int COLOURS[][3] = {
+        {0, 0, 0}, {255, 255, 255}, {0, 0, 255}, {0, 255, 0},
+        {255, 0, 0}, {0, 255, 255}, {255, 0, 255}, {255, 255, 0},
+        {128, 128, 128}, {40, 90, 200}, {200, 40, 90}, {90, 200, 40}
+    };
+    const int num_colours = sizeof(COLOURS) / sizeof(COLOURS[0]);
+    cv::Mat card(HEIGHT, WIDTH, CV_8UC3);
+    for (int y = 0; y < HEIGHT; y++) {
+        cv::Vec3b* p = card.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < WIDTH; x++) {
+            int patch = (y / PATCH) * (WIDTH / PATCH) + x / PATCH + frame;
+            const int* c = COLOURS[patch % num_colours];
+            p[x] = cv::Vec3b(c[0], c[1], c[2]);
+        }
+    }
+    return card;
+}
+
+// BT.601 limited range, which is what OpenCV's YUV to BGR conversions
+// undo
+static void bgrToYuv(const cv::Vec3b& bgr, uchar* y, uchar* u, uchar* v) {
+    double b = bgr[0];
+    double g = bgr[1];
+    double r = bgr[2];
+    *y = cv::saturate_cast<uchar>(16 +
+            (65.481 * r + 128.553 * g + 24.966 * b) / 255);
+    *u = cv::saturate_cast<uchar>(128 +
+            (-37.797 * r - 74.203 * g + 112.0 * b) / 255);
+    *v = cv::saturate_cast<uchar>(128 +
+            (112.0 * r - 93.786 * g - 18.214 * b) / 255);
+}
+
+// Card in the file layout of format, and its Y plane
+static std::vector<uchar> encode(const cv::Mat& card, int format,
+        cv::Mat* luma) {
+    cv::Mat y_plane(HEIGHT, WIDTH, CV_8UC1);
+    cv::Mat u_plane(HEIGHT, WIDTH, CV_8UC1);
+    cv::Mat v_plane(HEIGHT, WIDTH, CV_8UC1);
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            bgrToYuv(card.at<cv::Vec3b>(y, x), &y_plane.at<uchar>(y, x),
+                    &u_plane.at<uchar>(y, x), &v_plane.at<uchar>(y, x));
+        }
+    }
+    *luma = y_plane;
+
+    std::vector<uchar> out;
+    if (format == PIX_FMT_YUYV) {
+        for (int y = 0; y < HEIGHT; y++) {
+            for (int x = 0; x < WIDTH; x += 2) {
+                out.push_back(y_plane.at<uchar>(y, x));
+                out.push_back(u_plane.at<uchar>(y, x));
+                out.push_back(y_plane.at<uchar>(y, x + 1));
+                out.push_back(v_plane.at<uchar>(y, x));
+            }
+        }
+        return out;
+    }
+    out.assign(y_plane.datastart, y_plane.dataend);
+    if (format == PIX_FMT_I420) {
+        for (int y = 0; y < HEIGHT; y += 2) {
+            for (int x = 0; x < WIDTH; x += 2) {
+                out.push_back(u_plane.at<uchar>(y, x));
+            }
+        }
+        for (int y = 0; y < HEIGHT; y += 2) {
+            for (int x = 0; x < WIDTH; x += 2) {
+                out.push_back(v_plane.at<uchar>(y, x));
+            }
+        }
+    } else {
+        for (int y = 0; y < HEIGHT; y += 2) {
+            for (int x = 0; x < WIDTH; x += 2) {
+                out.push_back(u_plane.at<uchar>(y, x));
+                out.push_back(v_plane.at<uchar>(y, x));
+            }
+        }
+    }
+    return out;
+}
+
+static int maxDiff(const cv::Mat& a, const cv::Mat& b) {
+    if (a.size() != b.size() || a.type() != b.type()) {
+        return 256;
+    }
+    cv::Mat diff;
+    cv::absdiff(a, b, diff);
+    double max_val = 0;
+    cv::minMaxLoc(diff.reshape(1), NULL, &max_val);
+    return (int) max_val;
+}
+
+static void roundTrip(const char* name, int format, int frames) {
+    printf("%s\n", name);
+    char path[] = "/tmp/yuv_source_benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("unable to create yuv file");
+        check(false, "file written");
+        return;
+    }
+    std::vector<cv::Mat> cards;
+    std::vector<cv::Mat> lumas;
+    bool written = true;
+    for (int f = 0; f < frames; f++) {
+        cv::Mat luma;
+        cards.push_back(testCard(f));
+        std::vector<uchar> data = encode(cards.back(), format, &luma);
+        lumas.push_back(luma);
+        written = written &&
+            write(fd, &data[0], data.size()) == (ssize_t) data.size();
+    }
+    close(fd);
+    check(written, "file written");
+
+    CaptureSourceYuvFile source(path, format, WIDTH, HEIGHT);
+    FramePool pool(1, format, WIDTH, HEIGHT, WIDTH, HEIGHT);
+    VideoFrame_t slot;
+    if (!source.isOpened() || !pool.allocate()) {
+        check(false, "source and pool set up");
+        unlink(path);
+        return;
+    }
+    pool.bindSlot(0, &slot);
+    const uchar* frame_data = slot.frame.data;
+
+    int replayed = 0;
+    int gray_diff = 0;
+    int bgr_diff = 0;
+    while (replayed < frames && source.grab() && source.retrieve(&slot)) {
+        gray_diff = std::max(gray_diff, maxDiff(slot.frame, lumas[replayed]));
+        cv::Mat bgr;
+        getColorFrame(slot, &bgr);
+        bgr_diff = std::max(bgr_diff, maxDiff(bgr, cards[replayed]));
+        replayed++;
+    }
+    printf("  %d of %d frames, gray max diff %d, bgr max diff %d\n",
+            replayed, frames, gray_diff, bgr_diff);
+    check(replayed == frames, "every frame replayed");
+    check(!source.grab() || !source.retrieve(&slot), "eof after the last");
+    check(slot.frame.data == frame_data, "frame stays in the pool");
+    check(gray_diff == 0, "gray is the Y plane");
+    check(bgr_diff <= BGR_TOLERANCE, "bgr matches the card");
+    unlink(path);
+}
+
+int main(int argc, char** argv) {
+    int frames = 4;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = atoi(argv[i] + 9);
+        } else {
+            std::cout << "usage: yuv_source_bench [--frames=N]" << std::endl;
+            return -1;
+        }
+    }
+    if (frames < 1) {
+        std::cout << "frames must be at least 1" << std::endl;
+        return -1;
+    }
+
+    roundTrip("yuyv", PIX_FMT_YUYV, frames);
+    roundTrip("i420", PIX_FMT_I420, frames);
+    roundTrip("nv12", PIX_FMT_NV12, frames);
+
+    printf("%s\n", failures == 0 ? "all checks passed" : "checks failed");
+    return failures == 0 ? 0 : 1;
+}
@@ -2,15 +2,37 @@
 #define VIDEO_FRAME_H
 
 #include <time.h>
+#include <sys/time.h>
 #include <opencv2/opencv.hpp>
 #include <pthread.h>
 
+// Layout of the raw capture data in VideoFrame_t::raw
+enum PixelFormat {
+    // No raw data, the source delivers BGR color_frame
+    PIX_FMT_BGR = 0,
+    // Planar Y, then U and V at quarter resolution
+    PIX_FMT_I420,
+    // Planar Y, then interleaved UV at quarter resolution
+    PIX_FMT_NV12,
+    // Packed Y0 U Y1 V
+    PIX_FMT_YUYV
+};
+
 // TODO: naming conventions? underscores?
 typedef struct VideoFrame {
     // Image data associated with this frame 
     cv::Mat frame;    
     
+    // Only valid when color_valid is set, see getColorFrame in
+    // CaptureSource.h for sources that deliver YUV
     cv::Mat color_frame;
+    bool color_valid;
+
+    // Raw YUV data as delivered by the capture source, in the layout
+    // OpenCV's YUV conversions expect. For the planar formats frame is
+    // a view of the Y rows of raw.
+    cv::Mat raw;
+    int pixel_format;
 
     // Image data associated with ip camera frame for this
     // iteration
@@ -20,6 +42,19 @@ typedef struct VideoFrame {
 
     // Time of frame capture 
     time_t timestamp;
+    // CLOCK_MONOTONIC time the source captured the frame; the driver's
+    // own timestamp for V4L2, otherwise the time of retrieval
+    struct timeval capture_time;
+
+    // Capture sequence number of this frame
+    unsigned long seq;
+    // Sequence number of the most recent frame (up to and including
+    // this one) that was flagged as changed; every frame since is
+    // within the change threshold of that one, and a frame is static
+    // when this is older than seq. A processor whose last result was
+    // computed on a frame at or after last_change_seq can reuse it.
+    unsigned long last_change_seq;
+    unsigned long ip_last_change_seq;
     // Lock for data within this videoframe (timestamp and
     // frame data) 
     pthread_rwlock_t* rw_lock;